@@ -15,6 +15,10 @@
 #include <libxml/HTMLparser.h>
 #include <sqlite3.h>
 
+#include "scrap500.h"
+
+char *scrap500_datadir = "/tmp/scrap500";
+
 static const char *datadir;
 static DIR *dirp;
 
@@ -137,7 +141,6 @@ out:
 static int do_system_html(const char *filename)
 {
     int ret = 0;
-    int opts = 0;
     htmlDocPtr doc = NULL;
     xmlNode *root = NULL;
     xmlNode *tmp = NULL;
@@ -148,10 +151,7 @@ static int do_system_html(const char *filename)
 
     printf("parsing.. %s\n", pathname);
 
-    opts = HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR
-           | HTML_PARSE_NOWARNING | HTML_PARSE_NONET;
-
-    doc = htmlReadFile(pathname, NULL, opts);
+    doc = scrap500_cache_read_html(pathname);
     if (!doc) {
         fprintf(stderr, "cannot parse the document %s\n", filename);
         ret = EIO;
@@ -0,0 +1,438 @@
+/* Copyright (C) 2019 Hyogi Sim <simh@ornl.gov>
+ * ---------------------------------------------------------------------------
+ * See COPYING for the license.
+ *
+ * scrap500-bench measures the fetcher against a local stand-in of top500.org
+ * (see scrap500-replay, and 'make bench-fetch' which runs both). every list
+ * found in the corpus directory is fetched with each event loop and in-flight
+ * limit, and the wall clock time, the time until each list completes and the
+ * response time of each page are reported. then, the site and system pages of
+ * the first few lists are fetched with each number of fetcher threads.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "scrap500.h"
+
+char *scrap500_datadir = "/tmp/scrap500-bench";
+
+static char *corpus = "__run/scrap500";
+static char *inflight_str = "5,16,64,330";
+static char *threads_str = "1,4,16";
+static uint32_t n_spec_lists = 2;
+static int rounds = 3;
+
+static scrap500_list_t *lists;
+static uint32_t n_lists;
+
+static double *latency;         /* per-list completion time of a round */
+static double start_time;
+
+static const char *loop_names[] = {
+    "epoll",
+    "wait",
+};
+
+static inline double now_sec(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int compare_list(const void *a, const void *b)
+{
+    const scrap500_list_t *x = (const scrap500_list_t *) a;
+    const scrap500_list_t *y = (const scrap500_list_t *) b;
+
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/*
+ * collects the ids of all lists whose first page is in the corpus.
+ */
+static int load_list_ids(void)
+{
+    int ret = 0;
+    unsigned long id = 0;
+    char *pos = NULL;
+    DIR *dirp = NULL;
+    struct dirent *dp = NULL;
+    char path[PATH_MAX] = { 0, };
+
+    sprintf(path, "%s/list", corpus);
+
+    dirp = opendir(path);
+    if (!dirp) {
+        fprintf(stderr, "cannot open the directory %s: %s\n",
+                        path, strerror(errno));
+        return errno;
+    }
+
+    lists = calloc(1024, sizeof(*lists));
+    if (!lists) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    while ((dp = readdir(dirp)) != NULL && n_lists < 1024) {
+        id = strtoul(dp->d_name, &pos, 10);
+        if (strcmp(pos, ".1.html"))
+            continue;
+
+        lists[n_lists++].id = (uint32_t) id;
+    }
+
+    qsort(lists, n_lists, sizeof(*lists), compare_list);
+
+out:
+    closedir(dirp);
+    return ret;
+}
+
+/*
+ * removes the cached pages of a type, so that the next round fetches all of
+ * them again. a page that is not cached is never requested conditionally,
+ * so every round downloads the whole pages rather than getting 304s.
+ */
+static void clear_cache_dir(const char *name)
+{
+    DIR *dirp = NULL;
+    struct dirent *dp = NULL;
+    char path[PATH_MAX] = { 0, };
+
+    sprintf(path, "%s/%s", scrap500_datadir, name);
+
+    dirp = opendir(path);
+    if (!dirp)
+        return;
+
+    while ((dp = readdir(dirp)) != NULL) {
+        if (dp->d_name[0] == '.')
+            continue;
+
+        sprintf(path, "%s/%s/%s", scrap500_datadir, name, dp->d_name);
+        unlink(path);
+    }
+
+    closedir(dirp);
+}
+
+static int bench_cb(scrap500_list_t *list, void *data)
+{
+    uint32_t *count = (uint32_t *) data;
+
+    latency[(*count)++] = now_sec() - start_time;
+
+    return 0;
+}
+
+static int run_bench(int loop, int inflight)
+{
+    int ret = 0;
+    int i = 0;
+    uint32_t count = 0;
+    double elapsed = 0;
+    double total = 0;
+    double p50 = 0;
+    double p99 = 0;
+    scrap500_http_stats_t stats = { 0, };
+
+    scrap500_http_config.loop = loop;
+    scrap500_http_config.max_inflight = inflight;
+
+    scrap500_http_get_stats(&stats, 1);
+
+    for (i = 0; i < rounds; i++) {
+        clear_cache_dir("list");
+
+        count = 0;
+        start_time = now_sec();
+
+        ret = scrap500_http_fetch_lists(lists, n_lists, bench_cb, &count);
+        if (ret) {
+            fprintf(stderr, "failed to fetch lists (loop=%s, inflight=%d)\n",
+                            loop_names[loop], inflight);
+            return ret;
+        }
+
+        elapsed = now_sec() - start_time;
+        total += elapsed;
+
+        qsort(latency, count, sizeof(*latency), compare_double);
+        p50 += latency[count/2];
+        p99 += latency[(count*99)/100];
+    }
+
+    scrap500_http_get_stats(&stats, 1);
+
+    printf("%-6s %8d %10.3f %10.1f %10.2f %10.2f %10.2f %10.2f\n",
+           loop_names[loop], inflight, total/rounds,
+           5.0*n_lists*rounds/total,
+           1e3*p50/rounds, 1e3*p99/rounds, 1e3*stats.p50, 1e3*stats.p99);
+
+    return 0;
+}
+
+static int run_spec_bench(int nthreads)
+{
+    int ret = 0;
+    int i = 0;
+    double start = 0;
+    double total = 0;
+    scrap500_http_stats_t stats = { 0, };
+
+    scrap500_http_config.nthreads = nthreads;
+
+    scrap500_http_get_stats(&stats, 1);
+
+    for (i = 0; i < rounds; i++) {
+        clear_cache_dir("site");
+        clear_cache_dir("system");
+
+        start = now_sec();
+
+        ret = scrap500_http_fetch_specs(lists, n_spec_lists);
+        if (ret) {
+            fprintf(stderr, "failed to fetch specs (threads=%d)\n", nthreads);
+            return ret;
+        }
+
+        total += now_sec() - start;
+    }
+
+    scrap500_http_get_stats(&stats, 1);
+
+    printf("%8d %10llu %10.3f %10.1f %10.2f %10.2f %10.2f\n",
+           nthreads, _llu(stats.pages/rounds), total/rounds,
+           stats.pages/total,
+           1e3*stats.p50, 1e3*stats.p99, 1e3*stats.max);
+
+    return 0;
+}
+
+/*
+ * runs the benchmark for each number in the comma-separated str.
+ */
+static int run_each(const char *str, int (*fn)(int, int), int arg)
+{
+    int ret = 0;
+    int n = 0;
+    char *buf = NULL;
+    char *tok = NULL;
+
+    buf = strdup(str);
+    if (!buf)
+        return ENOMEM;
+
+    for (tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        n = atoi(tok);
+        if (n < 1)
+            continue;
+
+        ret = fn(arg, n);
+        if (ret)
+            break;
+    }
+
+    free(buf);
+
+    return ret;
+}
+
+static int spec_bench_fn(int unused, int nthreads)
+{
+    return run_spec_bench(nthreads);
+}
+
+static int spec_bench(void)
+{
+    int ret = 0;
+    uint32_t i = 0;
+
+    if (n_spec_lists > n_lists)
+        n_spec_lists = n_lists;
+
+    /* the frontier comes from the rankings of the lists */
+    for (i = 0; i < n_spec_lists; i++) {
+        ret = scrap500_parser_parse_list(&lists[i]);
+        if (ret)
+            return ret;
+    }
+
+    printf("\n## site and system pages of %u lists (%u..%u)\n",
+           n_spec_lists, lists[0].id, lists[n_spec_lists-1].id);
+    printf("%8s %10s %10s %10s %10s %10s %10s\n",
+           "threads", "requests", "wall(s)", "req/s",
+           "resp50(ms)", "resp99(ms)", "max(ms)");
+
+    return run_each(threads_str, spec_bench_fn, 0);
+}
+
+static char program[PATH_MAX];
+
+static struct option const long_opts[] = {
+    { "corpus", 1, 0, 'c' },
+    { "datadir", 1, 0, 'd' },
+    { "help", 0, 0, 'h' },
+    { "inflight", 1, 0, 'I' },
+    { "rounds", 1, 0, 'r' },
+    { "spec-lists", 1, 0, 's' },
+    { "threads", 1, 0, 't' },
+    { "url", 1, 0, 'u' },
+    { 0, 0, 0, 0},
+};
+
+static const char *short_opts = "c:d:hI:r:s:t:u:";
+
+static const char *usage_str =
+"Usage: %s [options..]\n"
+"\n"
+"  available options:\n"
+"  -c, --corpus=<path>    lists in <path> (default: __run/scrap500)\n"
+"  -d, --datadir=<path>   store files in <path>\n"
+"                         (default: /tmp/scrap500-bench)\n"
+"  -h, --help             print help message\n"
+"  -I, --inflight=<N,..>  in-flight limits to test (default: 5,16,64,330)\n"
+"  -r, --rounds=<N>       repeat each test <N> times (default: 3)\n"
+"  -s, --spec-lists=<N>   fetch specs of the first <N> lists (default: 2),\n"
+"                         0 to skip the spec benchmark\n"
+"  -t, --threads=<N,..>   spec fetcher threads to test (default: 1,4,16)\n"
+"  -u, --url=<baseurl>    fetch from <baseurl>\n"
+"                         (default: http://127.0.0.1:8500)\n"
+"\n";
+
+static inline void usage(int ec)
+{
+    fprintf(stdout, usage_str, program);
+    exit(ec);
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int optidx = 0;
+    int ch = 0;
+    int loop = 0;
+    char path[PATH_MAX] = { 0, };
+
+    read_program_name(argv[0], program);
+
+    scrap500_http_config.baseurl = "http://127.0.0.1:8500";
+    scrap500_http_config.rate = 0;
+    scrap500_http_config.quiet = 1;
+
+    while ((ch = getopt_long(argc, argv,
+                             short_opts, long_opts, &optidx)) >= 0) {
+        switch (ch) {
+        case 'c':
+            corpus = optarg;
+            break;
+
+        case 'd':
+            scrap500_datadir = optarg;
+            break;
+
+        case 'I':
+            inflight_str = optarg;
+            break;
+
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+
+        case 's':
+            n_spec_lists = (uint32_t) atoi(optarg);
+            break;
+
+        case 't':
+            threads_str = optarg;
+            break;
+
+        case 'u':
+            scrap500_http_config.baseurl = optarg;
+            break;
+
+        case 'h':
+        default:
+            usage(0);
+            break;
+        }
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+
+    ret = load_list_ids();
+    if (ret || !n_lists) {
+        fprintf(stderr, "no list found in %s\n", corpus);
+        return ret ? ret : ENOENT;
+    }
+
+    latency = calloc(n_lists, sizeof(*latency));
+    if (!latency)
+        return ENOMEM;
+
+    mkdir(scrap500_datadir, 0755);
+    sprintf(path, "%s/list", scrap500_datadir);
+    mkdir(path, 0755);
+    sprintf(path, "%s/site", scrap500_datadir);
+    mkdir(path, 0755);
+    sprintf(path, "%s/system", scrap500_datadir);
+    mkdir(path, 0755);
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    ret = scrap500_http_init();
+    if (ret)
+        goto out;
+
+    /* the same pages are fetched over and over, nothing to resume */
+    scrap500_journal_close();
+
+    printf("## %u lists (%u pages) from %s, %d rounds each\n",
+           n_lists, 5*n_lists, scrap500_http_config.baseurl, rounds);
+    printf("%-6s %8s %10s %10s %10s %10s %10s %10s\n",
+           "loop", "inflight", "wall(s)", "pages/s", "p50(ms)", "p99(ms)",
+           "resp50(ms)", "resp99(ms)");
+
+    for (loop = SCRAP500_HTTP_LOOP_EPOLL; loop <= SCRAP500_HTTP_LOOP_WAIT;
+         loop++) {
+        ret = run_each(inflight_str, run_bench, loop);
+        if (ret)
+            break;
+    }
+
+    if (!ret && n_spec_lists)
+        ret = spec_bench();
+
+    scrap500_http_exit();
+
+out:
+    curl_global_cleanup();
+    free(latency);
+    free(lists);
+
+    return ret;
+}
@@ -21,6 +21,14 @@ static char output[PATH_MAX];
 
 static uint64_t site_id;
 static uint64_t system_id;
+static int update;
+static int verify;
+
+static const char *page_names[] = {
+    "list",
+    "site",
+    "system",
+};
 
 static sqlite3 *db;
 
@@ -33,11 +41,11 @@ static const char *schema_sqlstr =
 "\n"
 "begin transaction;\n"
 "\n"
-"drop table if exists site;\n"
-"drop table if exists system;\n"
-"drop table if exists sysattr_name;\n"
-"drop table if exists sysattr_val;\n"
 "drop table if exists top500;\n"
+"drop table if exists sysattr_val;\n"
+"drop table if exists sysattr_name;\n"
+"drop table if exists system;\n"
+"drop table if exists site;\n"
 "\n"
 "-- [table] site\n"
 "create table site (\n"
@@ -95,21 +103,34 @@ enum {
     SQL_SITE = 0,
     SQL_SYSTEM,
     SQL_TOP500,
+    SQL_TOP500_DELETE,
     N_SQLS,
 };
 
+/* the columns of the attributes of a system, as in SCRAP500_SYSTEM_ATTRS */
+#define SYSTEM_COLUMN(field, type, label, first, last, unit)    "," #field
+#define SYSTEM_VALUE(field, type, label, first, last, unit)     ",?"
+#define SYSTEM_UPDATE(field, type, label, first, last, unit)            \
+        "," #field "=excluded." #field
+
 static char *sqlstr[] = {
     /* site */
     "insert into site(site_id,name,url,segment,city,country)\n"
-    "values(?,?,?,?,?,?);\n",
+    "values(?,?,?,?,?,?)\n"
+    "on conflict(site_id) do update set name=excluded.name,\n"
+    "url=excluded.url,segment=excluded.segment,city=excluded.city,\n"
+    "country=excluded.country;\n",
     /* system */
-    "insert into system(system_id,site_id,name,manufacturer,url,\n"
-    "cores,memory,processor,interconnect,linpack,tpeak,nmax,nhalf,hpcg,\n"
-    "power,pml,mcores,os,compiler,mathlib,mpi)\n"
-    "values(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?);\n",
+    "insert into system(system_id,name"
+    SCRAP500_SYSTEM_ATTRS(SYSTEM_COLUMN) ")\n"
+    "values(?,?" SCRAP500_SYSTEM_ATTRS(SYSTEM_VALUE) ")\n"
+    "on conflict(system_id) do update set name=excluded.name"
+    SCRAP500_SYSTEM_ATTRS(SYSTEM_UPDATE) ";\n",
     /* top500 */
     "insert into top500(time,rank,system_id,site_id)\n"
     "values(?,?,?,?);\n",
+    /* top500_delete */
+    "delete from top500 where time=?;\n",
 };
 
 static sqlite3_stmt *sqlstmts[N_SQLS];
@@ -154,7 +175,12 @@ static sqlite3 *db_init(const char *dbname)
         return NULL;
     }
 
-    ret = exec_simple_sql(dbconn, schema_sqlstr);
+    /* to update, keep the tables of the previous build */
+    if (update && exec_simple_sql(dbconn, "select 1 from top500 limit 1;")
+                  == SQLITE_OK)
+        ret = SQLITE_OK;
+    else
+        ret = exec_simple_sql(dbconn, schema_sqlstr);
     if (ret != SQLITE_OK) {
         fprintf(stderr, "failed to create a database: %s\n",
                         sqlite3_errstr(ret));
@@ -215,33 +241,35 @@ out:
 static int db_insert_system(sqlite3 *dbconn, scrap500_system_t *system)
 {
     int ret = 0;
+    int i = 0;
     int n = 1;
-    uint64_t system_id = system->id;
+    void *val = NULL;
+    const scrap500_sysattr_t *attr = NULL;
     sqlite3_stmt *stmt = NULL;
 
     stmt = sqlstmts[SQL_SYSTEM];
 
-    ret |= sqlite3_bind_int64(stmt, n++, system_id);
-    ret |= sqlite3_bind_int64(stmt, n++, system->site_id);
+    ret |= sqlite3_bind_int64(stmt, n++, system->id);
     ret |= sqlite3_bind_text(stmt, n++, system->name, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_text(stmt, n++, system->manufacturer, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_text(stmt, n++, system->url, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_double(stmt, n++, system->cores);
-    ret |= sqlite3_bind_double(stmt, n++, system->memory);
-    ret |= sqlite3_bind_text(stmt, n++, system->processor, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_text(stmt, n++, system->interconnect, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_double(stmt, n++, system->linpack);
-    ret |= sqlite3_bind_double(stmt, n++, system->tpeak);
-    ret |= sqlite3_bind_double(stmt, n++, system->nmax);
-    ret |= sqlite3_bind_double(stmt, n++, system->nhalf);
-    ret |= sqlite3_bind_double(stmt, n++, system->hpcg);
-    ret |= sqlite3_bind_double(stmt, n++, system->power);
-    ret |= sqlite3_bind_double(stmt, n++, system->pml);
-    ret |= sqlite3_bind_double(stmt, n++, system->mcores);
-    ret |= sqlite3_bind_text(stmt, n++, system->os, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_text(stmt, n++, system->compiler, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_text(stmt, n++, system->mathlib, -1, SQLITE_STATIC);
-    ret |= sqlite3_bind_text(stmt, n++, system->mpi, -1, SQLITE_STATIC);
+
+    for (i = 0; i < N_SCRAP500_SYSATTRS; i++) {
+        attr = &scrap500_sysattrs[i];
+        val = scrap500_sysattr_field(system, attr);
+
+        switch (attr->type) {
+        case SCRAP500_ATTR_ID:
+            ret |= sqlite3_bind_int64(stmt, n++, *(uint64_t *) val);
+            break;
+        case SCRAP500_ATTR_NUM:
+            ret |= sqlite3_bind_double(stmt, n++, *(double *) val);
+            break;
+        default:
+            ret |= sqlite3_bind_text(stmt, n++, *(char **) val, -1,
+                                     SQLITE_STATIC);
+            break;
+        }
+    }
+
     if (ret) {
         fprintf(stderr, "failed to bind values: %s\n", sqlite3_errstr(ret));
         goto out;
@@ -271,6 +299,22 @@ static int db_insert_list(sqlite3 *dbconn, scrap500_list_t *list)
     scrap500_rank_t *rank = NULL;
     sqlite3_stmt *stmt = NULL;
 
+    /* a list built before is replaced as a whole */
+    stmt = sqlstmts[SQL_TOP500_DELETE];
+
+    ret = sqlite3_bind_int64(stmt, 1, list_id);
+    if (ret == SQLITE_OK)
+        ret = sqlite3_step(stmt);
+
+    sqlite3_reset(stmt);
+
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "failed to delete the list: %s\n",
+                        sqlite3_errstr(ret));
+        ret = EIO;
+        goto out;
+    }
+
     stmt = sqlstmts[SQL_TOP500];
 
     for (i = 0; i < 500; i++) {
@@ -333,47 +377,185 @@ static void dump_system(uint64_t system_id)
         scrap500_system_dump(&system);
 }
 
-static int populate_site(void)
+/*
+ * parses the id out of the name of a cached page, e.g., 123.html, or
+ * 199306.1.html for list pages. returns 0 if the name is not of a page.
+ */
+static uint64_t page_id_from_name(int type, const char *name)
+{
+    uint64_t id = 0;
+    uint64_t page = 0;
+    char *pos = NULL;
+
+    id = strtoull(name, &pos, 10);
+
+    if (type == SCRAP500_PAGE_LIST && pos[0] == '.') {
+        page = strtoull(&pos[1], &pos, 10);
+        id = scrap500_list_page_id((uint32_t) id, (int) page);
+    }
+
+    return strcmp(pos, ".html") ? 0 : id;
+}
+
+/*
+ * records the pages in <datadir>/<name> and the pack that the manifest does
+ * not know of, e.g., those of a data directory cached before there was one,
+ * which the fetcher may since have added a few pages to.
+ */
+static int adopt_pages(int type, const char *name)
 {
     int ret = 0;
-    uint64_t site_id = 0;
+    uint64_t i = 0;
+    uint64_t id = 0;
     uint64_t count = 0;
-    char *pos = NULL;
+    uint64_t n_indexed = 0;
+    uint64_t *indexed = NULL;
     DIR *dirp = NULL;
     struct dirent *dp = NULL;
+    scrap500_idset_t set = { 0, };
+    scrap500_idset_t known = { 0, };
+    scrap500_page_meta_t meta = { 0, };
     char path[PATH_MAX] = { 0, };
-    scrap500_site_t site = { 0, };
 
-    sprintf(path, "%s/site", scrap500_datadir);
+    ret = scrap500_index_list(type, 0, &indexed, &n_indexed);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < n_indexed; i++) {
+        if (ENOMEM == scrap500_idset_add(&known, indexed[i])) {
+            ret = ENOMEM;
+            goto out;
+        }
+    }
+
+    sprintf(path, "%s/%s", scrap500_datadir, name);
 
     dirp = opendir(path);
-    if (!dirp) {
+    if (!dirp && errno != ENOENT) {
         fprintf(stderr, "cannot open the directory %s: %s\n",
-                        scrap500_datadir, strerror(errno));
-        goto out;
+                        path, strerror(errno));
+        return errno;
     }
 
-    begin_transaction(db);
-
-    while ((dp = readdir(dirp)) != NULL) {
-        if (dp->d_name[0] == '.')
+    while (dirp && (dp = readdir(dirp)) != NULL) {
+        id = page_id_from_name(type, dp->d_name);
+        if (!id || scrap500_idset_has(&known, id))
             continue;
 
-        site_id = strtoull(dp->d_name, &pos, 0);
-        if (pos[0] != '.')
+        if (ENOMEM == scrap500_idset_add(&set, id)) {
+            ret = ENOMEM;
+            goto out;
+        }
+    }
+
+    ret = scrap500_pack_ids(type, &set);
+    if (ret)
+        goto out;
+
+    for (i = 0; i < set.size; i++) {
+        if (!set.slots[i] || scrap500_idset_has(&known, set.slots[i]))
             continue;
 
+        memset((void *) &meta, 0, sizeof(meta));
+        meta.type = type;
+        meta.id = set.slots[i];
+
+        ret = scrap500_cache_checksum(type, meta.id, &meta);
+        if (ret)
+            goto out;
+
+        ret = scrap500_index_update(&meta);
+        if (ret)
+            goto out;
+
         count++;
+    }
+
+    if (count)
+        printf("## recorded %llu %s pages in the manifest\n",
+               _llu(count), name);
+
+out:
+    if (dirp)
+        closedir(dirp);
+    scrap500_idset_free(&set);
+    scrap500_idset_free(&known);
+    free(indexed);
+
+    return ret;
+}
+
+/*
+ * collects the ids of the cached pages of the type from the manifest, in
+ * ascending order, only those not ingested yet if pending is set. the pages
+ * cached but missing from the manifest are recorded first. *_ids should be
+ * freed by the caller.
+ */
+static int get_page_ids(int type, const char *name, int pending,
+                        uint64_t **_ids, uint64_t *_count)
+{
+    int ret = 0;
+
+    ret = adopt_pages(type, name);
+    if (ret)
+        return ret;
+
+    return scrap500_index_list(type, pending, _ids, _count);
+}
+
+/*
+ * the number of pages read ahead of the parser. a cold cache would otherwise
+ * have the parser wait for each page in turn.
+ */
+#define PREFETCH_DEPTH  64
+
+static inline void prefetch_pages(int type, uint64_t *ids, uint64_t count,
+                                  uint64_t pos)
+{
+    uint64_t i = 0;
+
+    /* the whole window at first, then one page as each is parsed */
+    for (i = pos ? pos + PREFETCH_DEPTH - 1 : 0;
+         i < pos + PREFETCH_DEPTH && i < count; i++)
+        scrap500_cache_prefetch(type, ids[i]);
+}
+
+static void set_status(int type, uint64_t *ids, uint64_t count, int status)
+{
+    uint64_t i = 0;
+
+    for (i = 0; i < count; i++)
+        scrap500_index_set_status(type, ids[i], status);
+}
+
+static int populate_site(void)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    uint64_t count = 0;
+    uint64_t *ids = NULL;
+    scrap500_site_t site = { 0, };
+
+    ret = get_page_ids(SCRAP500_PAGE_SITE, "site", update, &ids, &count);
+    if (ret)
+        goto out;
+
+    begin_transaction(db);
+
+    for (i = 0; i < count; i++) {
+        prefetch_pages(SCRAP500_PAGE_SITE, ids, count, i);
 
         scrap500_site_reset(&site);
-        site.id = site_id;
+        site.id = ids[i];
 
         printf("## processing site %llu, total %8llu\n",
-               _llu(site_id), _llu(count));
+               _llu(ids[i]), _llu(i + 1));
 
-        ret = scrap500_parser_parse_site(site_id, &site);
+        ret = scrap500_parser_parse_site(ids[i], &site);
         if (ret) {
             fprintf(stderr, "failed to parse the site data.\n");
+            scrap500_index_set_status(SCRAP500_PAGE_SITE, ids[i],
+                                      SCRAP500_MANIFEST_FAILED);
             goto out_close;
         }
 
@@ -389,10 +571,12 @@ static int populate_site(void)
 out_close:
     if (ret)
         rollback_transaction(db);
-    else
+    else {
         end_transaction(db);
+        set_status(SCRAP500_PAGE_SITE, ids, count, SCRAP500_MANIFEST_INGESTED);
+    }
 
-    closedir(dirp);
+    free(ids);
 out:
     return ret;
 }
@@ -400,44 +584,31 @@ out:
 static int populate_system(void)
 {
     int ret = 0;
-    uint64_t system_id = 0;
+    uint64_t i = 0;
     uint64_t count = 0;
-    char *pos = NULL;
-    DIR *dirp = NULL;
-    struct dirent *dp = NULL;
-    char path[PATH_MAX] = { 0, };
+    uint64_t *ids = NULL;
     scrap500_system_t system = { 0, };
 
-    sprintf(path, "%s/system", scrap500_datadir);
-
-    dirp = opendir(path);
-    if (!dirp) {
-        fprintf(stderr, "cannot open the directory %s: %s\n",
-                        scrap500_datadir, strerror(errno));
+    ret = get_page_ids(SCRAP500_PAGE_SYSTEM, "system", update, &ids, &count);
+    if (ret)
         goto out;
-    }
 
     begin_transaction(db);
 
-    while ((dp = readdir(dirp)) != NULL) {
-        if (dp->d_name[0] == '.')
-            continue;
-
-        system_id = strtoull(dp->d_name, &pos, 0);
-        if (pos[0] != '.')
-            continue;
-
-        count++;
+    for (i = 0; i < count; i++) {
+        prefetch_pages(SCRAP500_PAGE_SYSTEM, ids, count, i);
 
         printf("## processing system %llu, total %8llu\n",
-               _llu(system_id), _llu(count));
+               _llu(ids[i]), _llu(i + 1));
 
         scrap500_system_reset(&system);
-        system.id = system_id;
+        system.id = ids[i];
 
-        ret = scrap500_parser_parse_system(system_id, &system);
+        ret = scrap500_parser_parse_system(ids[i], &system);
         if (ret) {
             fprintf(stderr, "failed to parse the system data.\n");
+            scrap500_index_set_status(SCRAP500_PAGE_SYSTEM, ids[i],
+                                      SCRAP500_MANIFEST_FAILED);
             goto out_close;
         }
 
@@ -453,49 +624,92 @@ static int populate_system(void)
 out_close:
     if (ret)
         rollback_transaction(db);
-    else
+    else {
         end_transaction(db);
+        set_status(SCRAP500_PAGE_SYSTEM, ids, count,
+                   SCRAP500_MANIFEST_INGESTED);
+    }
 
-    closedir(dirp);
+    free(ids);
 out:
     return ret;
 }
 
-static inline int get_list_ids(uint64_t **_ids, uint64_t *_count)
+/*
+ * collects the lists with a page to ingest, skipping those of which not all
+ * five pages have been cached.
+ */
+static int get_list_ids(uint64_t **_ids, uint64_t *_count)
 {
     int ret = 0;
-    int i = 0;
-    int count = 0;
-    uint64_t id = 0;
+    int page = 0;
+    uint32_t list_id = 0;
+    uint64_t i = 0;
+    uint64_t n_all = 0;
+    uint64_t n_pages = 0;
+    uint64_t count = 0;
+    uint64_t *all = NULL;
+    uint64_t *pages = NULL;
     uint64_t *ids = NULL;
-    time_t nowp = time(NULL);
-    struct tm *now = localtime(&nowp);
+    scrap500_idset_t cached = { 0, };
+
+    ret = get_page_ids(SCRAP500_PAGE_LIST, "list", 0, &all, &n_all);
+    if (ret)
+        goto out;
 
-    count = 2*((now->tm_year + 1900) - 1993);
+    ret = get_page_ids(SCRAP500_PAGE_LIST, "list", update, &pages, &n_pages);
+    if (ret)
+        goto out;
+
+    for (i = 0; i < n_all; i++) {
+        if (ENOMEM == scrap500_idset_add(&cached, all[i])) {
+            ret = ENOMEM;
+            goto out;
+        }
+    }
 
-    ids = calloc(count, sizeof(*ids));
+    ids = calloc(n_pages + 1, sizeof(*ids));
     if (!ids) {
-        perror("failed to allocate list ids");
-        ret = errno;
+        ret = ENOMEM;
         goto out;
     }
 
-    for (i = 0; i < count; i += 2) {
-        id = (1993 + i/2)*100;
-        ids[i] = id + 6;
-        ids[i+1] = id + 11;
+    /* the pages are in ascending order, so are the lists */
+    for (i = 0; i < n_pages; i++) {
+        list_id = (uint32_t) (pages[i]/10);
+        if (count && ids[count-1] == list_id)
+            continue;
+
+        for (page = 1; page <= 5; page++)
+            if (!scrap500_idset_has(&cached,
+                                    scrap500_list_page_id(list_id, page)))
+                break;
+
+        if (page <= 5) {
+            printf("## list %u is incomplete, skipped\n", list_id);
+            continue;
+        }
+
+        ids[count++] = list_id;
     }
 
     *_ids = ids;
     *_count = count;
+    ids = NULL;
 
 out:
+    free(all);
+    free(pages);
+    free(ids);
+    scrap500_idset_free(&cached);
+
     return ret;
 }
 
 static int populate_list(void)
 {
     int ret = 0;
+    int page = 0;
     uint64_t i = 0;
     uint64_t count = 0;
     uint64_t *ids = NULL;
@@ -535,35 +749,103 @@ static int populate_list(void)
 out_close:
     if (ret)
         rollback_transaction(db);
-    else
+    else {
         end_transaction(db);
 
+        for (i = 0; i < count; i++)
+            for (page = 1; page <= 5; page++)
+                scrap500_index_set_status(SCRAP500_PAGE_LIST,
+                        scrap500_list_page_id((uint32_t) ids[i], page),
+                        SCRAP500_MANIFEST_INGESTED);
+    }
+
+    free(ids);
 out:
     return ret;
 }
 
+/*
+ * checks every page in the manifest against the cache, and reports those
+ * missing, truncated or changed since they were fetched.
+ */
+static int verify_pages(void)
+{
+    int ret = 0;
+    int type = 0;
+    uint64_t i = 0;
+    uint64_t count = 0;
+    uint64_t n_checked = 0;
+    uint64_t n_bad = 0;
+    uint64_t *ids = NULL;
+    scrap500_page_meta_t meta = { 0, };
+    scrap500_page_meta_t found = { 0, };
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        ret = scrap500_index_list(type, 0, &ids, &count);
+        if (ret)
+            return ret;
+
+        for (i = 0; i < count; i++) {
+            if (scrap500_index_lookup(type, ids[i], &meta))
+                continue;
+
+            n_checked++;
+
+            ret = scrap500_cache_checksum(type, ids[i], &found);
+            if (ret)
+                printf("missing   %-6s %llu\n", page_names[type],
+                       _llu(ids[i]));
+            else if (found.stored < meta.stored)
+                printf("truncated %-6s %llu (%llu of %llu bytes)\n",
+                       page_names[type], _llu(ids[i]),
+                       _llu(found.stored), _llu(meta.stored));
+            else if (found.stored != meta.stored || found.crc != meta.crc)
+                printf("changed   %-6s %llu\n", page_names[type],
+                       _llu(ids[i]));
+            else
+                continue;
+
+            n_bad++;
+        }
+
+        free(ids);
+    }
+
+    printf("## verified %llu pages, %llu bad\n",
+           _llu(n_checked), _llu(n_bad));
+
+    return n_bad ? EIO : 0;
+}
+
 static char program[PATH_MAX];
 
 static struct option const long_opts[] = {
+    { "backend", 1, 0, 'b' },
     { "datadir", 1, 0, 'd' },
     { "help", 0, 0, 'h' },
     { "output", 1, 0, 'o' },
     { "site", 1, 0, 's' },
     { "system", 1, 0, 'S' },
+    { "update", 0, 0, 'u' },
+    { "verify", 0, 0, 'V' },
     { 0, 0, 0, 0},
 };
 
-static const char *short_opts = "d:ho:s:S:";
+static const char *short_opts = "b:d:ho:s:S:uV";
 
 static const char *usage_str =
 "Usage: %s [options..]\n"
 "\n"
 "  available options:\n"
+"  -b, --backend=<name>     parse pages with <name>: dom (default),\n"
+"                           sax or scan\n"
 "  -d, --datadir=<path>     store files in <path> (default: /tmp/scrap500)\n"
 "  -h, --help               print help message\n"
 "  -o, --output=<filename>  white database to <filename>\n"
 "  -s, --site=<site_id>     parse <site_id> and print the result\n"
 "  -S, --system=<system_id> parse <system_id> and print the result\n"
+"  -u, --update             ingest only pages not in the database yet\n"
+"  -V, --verify             check the cached pages against the manifest\n"
 "\n";
 
 static inline void usage(int ec)
@@ -583,6 +865,13 @@ int main(int argc, char **argv)
     while ((ch = getopt_long(argc, argv,
                              short_opts, long_opts, &optidx)) >= 0) {
         switch (ch) {
+        case 'b':
+            if (scrap500_parser_set_backend(optarg)) {
+                fprintf(stderr, "unknown parser backend: %s\n", optarg);
+                usage(EINVAL);
+            }
+            break;
+
         case 'd':
             scrap500_datadir = strdup(optarg);
             break;
@@ -599,6 +888,14 @@ int main(int argc, char **argv)
             system_id = strtoull(optarg, NULL, 0);
             break;
 
+        case 'u':
+            update = 1;
+            break;
+
+        case 'V':
+            verify = 1;
+            break;
+
         case 'h':
         default:
             usage(0);
@@ -616,35 +913,53 @@ int main(int argc, char **argv)
         goto out;
     }
 
+    ret = scrap500_index_open();
+    if (ret) {
+        fprintf(stderr, "failed to open the manifest.\n");
+        goto out;
+    }
+
+    if (verify) {
+        ret = verify_pages();
+        goto out_index;
+    }
+
     if (output[0] == '\0')
         sprintf(output, "%s/scrap500.db", scrap500_datadir);
 
     db = db_init(output);
     if (!db) {
         fprintf(stderr, "failed to create database %s\n", output);
-        goto out;
+        ret = EIO;
+        goto out_index;
     }
 
+    /* all pages are parsed by this thread, one after another */
+    scrap500_cache_batch_begin();
+
     ret = populate_site();
     if (ret) {
         fprintf(stderr, "failed to populate site data.\n");
-        goto out;
+        goto out_close;
     }
 
     ret = populate_system();
     if (ret) {
         fprintf(stderr, "failed to populate system data.\n");
-        goto out;
+        goto out_close;
     }
 
     ret = populate_list();
     if (ret) {
         fprintf(stderr, "failed to populate list data.\n");
-        goto out;
+        goto out_close;
     }
 
 out_close:
+    scrap500_cache_batch_end();
     db_close(db);
+out_index:
+    scrap500_index_close();
 
 out:
     return ret;
@@ -0,0 +1,982 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * cached pages are stored compressed, with gzip or, when built with libzstd,
+ * zstd. the pages keep their .html names, and the format of each file is told
+ * by its magic bytes, so that caches written with different settings (or raw
+ * pages from older versions) can be mixed freely. zstd pages repacked by
+ * scrap500-repack are compressed against a dictionary (<datadir>/pages.dict),
+ * which is loaded on the first such page.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "scrap500.h"
+
+#define CACHE_CHUNK     (64*1024)
+
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b };
+static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+struct _scrap500_cache_writer {
+    int format;
+    FILE *fp;
+    z_stream zs;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zc;
+#endif
+    char *mem;                  /* written to memory, see create_buffer */
+    size_t memlen;
+    uint64_t written;           /* bytes and crc32 of the stored page */
+    uint32_t crc;
+    unsigned char out[CACHE_CHUNK];
+};
+
+int scrap500_cache_format(const void *buf, size_t len)
+{
+    if (len >= sizeof(gzip_magic) && !memcmp(buf, gzip_magic,
+                                             sizeof(gzip_magic)))
+        return SCRAP500_CACHE_GZIP;
+
+    if (len >= sizeof(zstd_magic) && !memcmp(buf, zstd_magic,
+                                             sizeof(zstd_magic)))
+        return SCRAP500_CACHE_ZSTD;
+
+    return SCRAP500_CACHE_RAW;
+}
+
+static scrap500_cache_writer_t *cache_create(const char *filename,
+                                             int format)
+{
+    int ret = 0;
+    scrap500_cache_writer_t *w = NULL;
+
+    w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+
+#ifndef HAVE_ZSTD
+    if (format == SCRAP500_CACHE_ZSTD)
+        format = SCRAP500_CACHE_GZIP;
+#endif
+
+    w->format = format;
+
+    switch (format) {
+    case SCRAP500_CACHE_GZIP:
+        /* 15+16: a gzip header instead of zlib's */
+        ret = deflateInit2(&w->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           15 + 16, 8, Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK)
+            goto out_free;
+        break;
+
+#ifdef HAVE_ZSTD
+    case SCRAP500_CACHE_ZSTD:
+        w->zc = ZSTD_createCCtx();
+        if (!w->zc)
+            goto out_free;
+        ZSTD_CCtx_setParameter(w->zc, ZSTD_c_compressionLevel, 3);
+        break;
+#endif
+
+    default:
+        break;
+    }
+
+    if (filename)
+        w->fp = fopen(filename, "w");
+    else
+        w->fp = open_memstream(&w->mem, &w->memlen);
+    if (!w->fp) {
+        ret = errno;
+        scrap500_cache_abort(w);
+        errno = ret;
+        return NULL;
+    }
+
+    return w;
+
+out_free:
+    free(w);
+    errno = ENOMEM;
+    return NULL;
+}
+
+scrap500_cache_writer_t *scrap500_cache_create(const char *filename,
+                                               int format)
+{
+    return cache_create(filename, format);
+}
+
+scrap500_cache_writer_t *scrap500_cache_create_buffer(int format)
+{
+    return cache_create(NULL, format);
+}
+
+static int emit(scrap500_cache_writer_t *w, const void *buf, size_t len)
+{
+    if (len && fwrite(buf, 1, len, w->fp) != len)
+        return errno ? errno : EIO;
+
+    w->written += len;
+    w->crc = crc32(w->crc, (const Bytef *) buf, (uInt) len);
+
+    return 0;
+}
+
+static inline int flush_out(scrap500_cache_writer_t *w, size_t len)
+{
+    return emit(w, w->out, len);
+}
+
+static int write_gzip(scrap500_cache_writer_t *w, const void *buf,
+                      size_t len, int flush)
+{
+    int ret = 0;
+    int rc = 0;
+
+    w->zs.next_in = (Bytef *) buf;
+    w->zs.avail_in = (uInt) len;
+
+    do {
+        w->zs.next_out = w->out;
+        w->zs.avail_out = sizeof(w->out);
+
+        rc = deflate(&w->zs, flush);
+        if (rc == Z_STREAM_ERROR)
+            return EIO;
+
+        ret = flush_out(w, sizeof(w->out) - w->zs.avail_out);
+        if (ret)
+            return ret;
+    } while (w->zs.avail_out == 0
+             || (flush == Z_FINISH && rc != Z_STREAM_END));
+
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+static int write_zstd(scrap500_cache_writer_t *w, const void *buf,
+                      size_t len, ZSTD_EndDirective mode)
+{
+    int ret = 0;
+    size_t remaining = 0;
+    ZSTD_inBuffer in = { buf, len, 0 };
+    ZSTD_outBuffer out = { 0, };
+
+    do {
+        out.dst = w->out;
+        out.size = sizeof(w->out);
+        out.pos = 0;
+
+        remaining = ZSTD_compressStream2(w->zc, &out, &in, mode);
+        if (ZSTD_isError(remaining))
+            return EIO;
+
+        ret = flush_out(w, out.pos);
+        if (ret)
+            return ret;
+    } while (in.pos < in.size || (mode == ZSTD_e_end && remaining));
+
+    return 0;
+}
+#endif
+
+int scrap500_cache_write(scrap500_cache_writer_t *w, const void *buf,
+                         size_t len)
+{
+    switch (w->format) {
+    case SCRAP500_CACHE_GZIP:
+        return write_gzip(w, buf, len, Z_NO_FLUSH);
+#ifdef HAVE_ZSTD
+    case SCRAP500_CACHE_ZSTD:
+        return write_zstd(w, buf, len, ZSTD_e_continue);
+#endif
+    default:
+        return emit(w, buf, len);
+    }
+}
+
+static int cache_finish(scrap500_cache_writer_t *w)
+{
+    int ret = 0;
+
+    switch (w->format) {
+    case SCRAP500_CACHE_GZIP:
+        ret = write_gzip(w, NULL, 0, Z_FINISH);
+        break;
+#ifdef HAVE_ZSTD
+    case SCRAP500_CACHE_ZSTD:
+        ret = write_zstd(w, NULL, 0, ZSTD_e_end);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+static inline void set_checksum(scrap500_cache_writer_t *w,
+                                scrap500_page_meta_t *meta)
+{
+    if (meta) {
+        meta->stored = w->written;
+        meta->crc = w->crc;
+    }
+}
+
+int scrap500_cache_close(scrap500_cache_writer_t *w, int sync,
+                         scrap500_page_meta_t *meta)
+{
+    int ret = 0;
+
+    ret = cache_finish(w);
+    set_checksum(w, meta);
+
+    /* the page must be on disk before it is renamed into place */
+    if (!ret && sync && (fflush(w->fp) || fsync(fileno(w->fp))))
+        ret = errno;
+
+    if (fclose(w->fp) && !ret)
+        ret = errno;
+
+    w->fp = NULL;
+    scrap500_cache_abort(w);
+
+    return ret;
+}
+
+int scrap500_cache_take(scrap500_cache_writer_t *w, char **buf, size_t *len,
+                        scrap500_page_meta_t *meta)
+{
+    int ret = 0;
+
+    ret = cache_finish(w);
+    set_checksum(w, meta);
+
+    if (fclose(w->fp) && !ret)
+        ret = errno;
+
+    w->fp = NULL;
+
+    if (!ret) {
+        *buf = w->mem;
+        *len = w->memlen;
+        w->mem = NULL;
+    }
+
+    scrap500_cache_abort(w);
+
+    return ret;
+}
+
+void scrap500_cache_abort(scrap500_cache_writer_t *w)
+{
+    if (!w)
+        return;
+
+    if (w->fp)
+        fclose(w->fp);
+
+    if (w->format == SCRAP500_CACHE_GZIP)
+        deflateEnd(&w->zs);
+#ifdef HAVE_ZSTD
+    if (w->zc)
+        ZSTD_freeCCtx(w->zc);
+#endif
+
+    free(w->mem);
+    free(w);
+}
+
+/*
+ * grows the output buffer of a decompressor to hold at least need bytes.
+ */
+static int grow(char **buf, size_t *size, size_t need)
+{
+    char *tmp = NULL;
+    size_t n = *size ? *size : CACHE_CHUNK;
+
+    while (n < need)
+        n *= 2;
+
+    if (n == *size)
+        return 0;
+
+    tmp = realloc(*buf, n);
+    if (!tmp)
+        return ENOMEM;
+
+    *buf = tmp;
+    *size = n;
+
+    return 0;
+}
+
+static int read_gzip(const char *src, size_t len, char **buf, size_t *outlen)
+{
+    int ret = 0;
+    int rc = Z_OK;
+    size_t size = 0;
+    z_stream zs = { 0, };
+
+    /* 15+32: detect the gzip header */
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)
+        return ENOMEM;
+
+    zs.next_in = (Bytef *) src;
+    zs.avail_in = (uInt) len;
+
+    while (rc != Z_STREAM_END) {
+        ret = grow(buf, &size, zs.total_out + CACHE_CHUNK);
+        if (ret)
+            break;
+
+        zs.next_out = (Bytef *) *buf + zs.total_out;
+        zs.avail_out = (uInt) (size - zs.total_out);
+
+        rc = inflate(&zs, Z_NO_FLUSH);
+        if (rc != Z_OK && rc != Z_STREAM_END) {
+            ret = EIO;
+            break;
+        }
+
+        if (rc == Z_OK && zs.avail_in == 0 && zs.avail_out != 0) {
+            ret = EIO;      /* truncated */
+            break;
+        }
+    }
+
+    *outlen = zs.total_out;
+    inflateEnd(&zs);
+
+    return ret;
+}
+
+#ifdef HAVE_ZSTD
+static pthread_mutex_t dict_lock = PTHREAD_MUTEX_INITIALIZER;
+static ZSTD_DDict *ddict;
+static int dict_tried;
+
+/* the decoders of the threads are freed as the threads exit */
+static pthread_key_t dctx_key;
+static pthread_once_t dctx_once = PTHREAD_ONCE_INIT;
+
+static void free_dctx(void *zd)
+{
+    ZSTD_freeDCtx((ZSTD_DCtx *) zd);
+}
+
+static void create_dctx_key(void)
+{
+    pthread_key_create(&dctx_key, free_dctx);
+}
+
+/*
+ * loads the dictionary, with dict_lock held.
+ */
+static int load_dict(const char *filename)
+{
+    int ret = 0;
+    size_t len = 0;
+    char *buf = NULL;
+    ZSTD_DDict *dict = NULL;
+
+    ret = scrap500_cache_read(filename, &buf, &len);
+    if (ret)
+        return ret;
+
+    dict = ZSTD_createDDict(buf, len);
+    free(buf);
+    if (!dict)
+        return EINVAL;
+
+    if (ddict)
+        ZSTD_freeDDict(ddict);
+    ddict = dict;
+
+    return 0;
+}
+
+/*
+ * the other threads wait for the first one to load the dictionary, rather
+ * than take a page compressed against it for one without.
+ */
+static ZSTD_DDict *get_dict(void)
+{
+    ZSTD_DDict *dict = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    pthread_mutex_lock(&dict_lock);
+
+    if (!dict_tried) {
+        dict_tried = 1;
+
+        sprintf(filename, "%s/pages.dict", scrap500_datadir);
+        if (load_dict(filename))
+            fprintf(stderr, "failed to load the dictionary %s\n", filename);
+    }
+
+    dict = ddict;
+
+    pthread_mutex_unlock(&dict_lock);
+
+    return dict;
+}
+
+static int read_zstd(const char *src, size_t len, char **buf, size_t *outlen)
+{
+    int ret = 0;
+    size_t rc = 1;
+    size_t size = 0;
+    ZSTD_DDict *dict = NULL;
+    ZSTD_inBuffer in = { src, len, 0 };
+    ZSTD_outBuffer out = { 0, };
+    /* one per thread, decoding a page should not allocate a window */
+    static __thread ZSTD_DCtx *zd;
+
+    if (!zd) {
+        pthread_once(&dctx_once, create_dctx_key);
+
+        zd = ZSTD_createDCtx();
+        if (!zd)
+            return ENOMEM;
+
+        pthread_setspecific(dctx_key, zd);
+    }
+
+    ZSTD_DCtx_reset(zd, ZSTD_reset_session_only);
+
+    if (ZSTD_getDictID_fromFrame(src, len)) {
+        dict = get_dict();
+        if (!dict)
+            return ENOENT;
+    }
+
+    ZSTD_DCtx_refDDict(zd, dict);
+
+    /* the decompressed size is in the frame, unless streamed by the fetcher */
+    size = ZSTD_getFrameContentSize(src, len);
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+        size = 0;
+    else if (!(*buf = malloc(size + 1)))
+        return ENOMEM;
+    else
+        size++;
+
+    while (rc) {
+        if (out.pos == size) {
+            ret = grow(buf, &size, size + 1);
+            if (ret)
+                break;
+        }
+
+        out.dst = *buf;
+        out.size = size;
+
+        rc = ZSTD_decompressStream(zd, &out, &in);
+        if (ZSTD_isError(rc) || (rc && in.pos == in.size
+                                    && out.pos < out.size)) {
+            ret = EIO;
+            break;
+        }
+    }
+
+    *outlen = out.pos;
+
+    return ret;
+}
+#endif
+
+void scrap500_cache_drop_dict(void)
+{
+#ifdef HAVE_ZSTD
+    pthread_mutex_lock(&dict_lock);
+
+    if (ddict)
+        ZSTD_freeDDict(ddict);
+    ddict = NULL;
+    dict_tried = 0;
+
+    pthread_mutex_unlock(&dict_lock);
+#endif
+}
+
+/*
+ * decompresses src into *buf that the caller should free. *buf is left NULL
+ * if src is not compressed.
+ */
+static int cache_decode(const char *name, const char *src, size_t len,
+                        char **buf, size_t *outlen)
+{
+    int ret = 0;
+
+    *buf = NULL;
+    *outlen = 0;
+
+    switch (scrap500_cache_format(src, len)) {
+    case SCRAP500_CACHE_GZIP:
+        ret = read_gzip(src, len, buf, outlen);
+        break;
+    case SCRAP500_CACHE_ZSTD:
+#ifdef HAVE_ZSTD
+        ret = read_zstd(src, len, buf, outlen);
+#else
+        fprintf(stderr, "%s is compressed with zstd, which is not "
+                        "supported by this build\n", name);
+        ret = ENOTSUP;
+#endif
+        break;
+    default:
+        break;
+    }
+
+    if (ret && *buf) {
+        free(*buf);
+        *buf = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * maps the file read-only, to be read once from the start. an empty file is
+ * mapped to an empty string.
+ */
+static int map_file(const char *filename, const char **addr, size_t *len)
+{
+    int ret = 0;
+    int fd = 0;
+    void *map = NULL;
+    struct stat sb = { 0, };
+
+    *addr = NULL;
+    *len = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return errno;
+
+    if (fstat(fd, &sb) < 0) {
+        ret = errno;
+        goto out;
+    }
+
+    if (sb.st_size == 0) {
+        *addr = "";
+        goto out;
+    }
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ret = errno;
+        goto out;
+    }
+
+    madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+    *addr = map;
+    *len = sb.st_size;
+
+out:
+    close(fd);
+
+    return ret;
+}
+
+static inline void unmap_file(const char *addr, size_t len)
+{
+    if (len)
+        munmap((void *) addr, len);
+}
+
+int scrap500_cache_read(const char *filename, char **buf, size_t *len)
+{
+    int ret = 0;
+    size_t maplen = 0;
+    const char *map = NULL;
+
+    *buf = NULL;
+    *len = 0;
+
+    ret = map_file(filename, &map, &maplen);
+    if (ret)
+        return ret;
+
+    ret = cache_decode(filename, map, maplen, buf, len);
+    if (ret || *buf)
+        goto out;
+
+    *buf = malloc(maplen + 1);
+    if (!*buf) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    memcpy(*buf, map, maplen);
+    *len = maplen;
+
+out:
+    unmap_file(map, maplen);
+
+    return ret;
+}
+
+/*
+ * a thread in a batch keeps one parser context, and with it the dictionary of
+ * the element names and short strings, across the pages it parses. the
+ * context is renewed when the dictionary holds more strings than this.
+ */
+#define BATCH_DICT_MAX  65536
+
+static __thread htmlParserCtxtPtr batch_ctxt;
+
+int scrap500_cache_batch_begin(void)
+{
+    if (!batch_ctxt)
+        batch_ctxt = htmlNewParserCtxt();
+
+    return batch_ctxt ? 0 : ENOMEM;
+}
+
+void scrap500_cache_batch_end(void)
+{
+    if (batch_ctxt)
+        htmlFreeParserCtxt(batch_ctxt);
+    batch_ctxt = NULL;
+}
+
+/*
+ * parses the page in src, as stored, decompressing it first if needed. a raw
+ * page is parsed in place.
+ */
+static htmlDocPtr parse_page(const char *name, const char *src, size_t len)
+{
+    int ret = 0;
+    size_t outlen = 0;
+    char *buf = NULL;
+    htmlDocPtr doc = NULL;
+    htmlParserCtxtPtr ctxt = NULL;
+
+    ret = cache_decode(name, src, len, &buf, &outlen);
+    if (ret)
+        return NULL;
+
+    if (buf) {
+        src = buf;
+        len = outlen;
+    }
+
+    ctxt = batch_ctxt ? batch_ctxt : htmlNewParserCtxt();
+    if (ctxt) {
+        doc = htmlCtxtReadMemory(ctxt, src, (int) len, name, NULL,
+                                 SCRAP500_PARSER_OPTS);
+
+        if (!batch_ctxt)
+            htmlFreeParserCtxt(ctxt);
+        else if (xmlDictSize(ctxt->dict) > BATCH_DICT_MAX) {
+            scrap500_cache_batch_end();
+            scrap500_cache_batch_begin();
+        }
+    }
+
+    free(buf);
+
+    return doc;
+}
+
+htmlDocPtr scrap500_cache_read_html(const char *filename)
+{
+    int ret = 0;
+    size_t len = 0;
+    const char *map = NULL;
+    htmlDocPtr doc = NULL;
+
+    ret = map_file(filename, &map, &len);
+    if (ret)
+        return NULL;
+
+    doc = parse_page(filename, map, len);
+    unmap_file(map, len);
+
+    return doc;
+}
+
+static void page_filename(int type, uint64_t id, char *buf)
+{
+    switch (type) {
+    case SCRAP500_PAGE_LIST:
+        scrap500_list_page_html_filename((uint32_t) (id/10), id%10, buf);
+        break;
+    case SCRAP500_PAGE_SITE:
+        scrap500_site_html_filename(id, buf);
+        break;
+    default:
+        scrap500_system_html_filename(id, buf);
+        break;
+    }
+}
+
+int scrap500_cache_has_page(int type, uint64_t id)
+{
+    char filename[PATH_MAX] = { 0, };
+
+    if (scrap500_pack_has(type, id))
+        return 1;
+
+    page_filename(type, id, filename);
+
+    return access(filename, F_OK) == 0;
+}
+
+static const char *page_dirs[] = {
+    "list",
+    "site",
+    "system",
+};
+
+static int compare_id(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+int scrap500_cache_page_ids(int type, uint64_t **_ids, uint64_t *_count)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    uint64_t id = 0;
+    uint64_t count = 0;
+    uint64_t *ids = NULL;
+    char *pos = NULL;
+    DIR *dirp = NULL;
+    struct dirent *dp = NULL;
+    scrap500_idset_t set = { 0, };
+    scrap500_idset_t list_pages = { 0, };
+    char path[PATH_MAX] = { 0, };
+
+    sprintf(path, "%s/%s", scrap500_datadir, page_dirs[type]);
+
+    dirp = opendir(path);
+    while (dirp && (dp = readdir(dirp)) != NULL) {
+        id = strtoull(dp->d_name, &pos, 10);
+        if (strcmp(pos, type == SCRAP500_PAGE_LIST ? ".1.html" : ".html"))
+            continue;
+
+        if (ENOMEM == scrap500_idset_add(&set, id)) {
+            ret = ENOMEM;
+            goto out;
+        }
+    }
+
+    if (type == SCRAP500_PAGE_LIST) {
+        ret = scrap500_pack_ids(type, &list_pages);
+        if (ret)
+            goto out;
+
+        for (i = 0; i < list_pages.size; i++) {
+            id = list_pages.slots[i];
+            if (id % 10 == 1 && ENOMEM == scrap500_idset_add(&set, id/10)) {
+                ret = ENOMEM;
+                goto out;
+            }
+        }
+    }
+    else {
+        ret = scrap500_pack_ids(type, &set);
+        if (ret)
+            goto out;
+    }
+
+    ids = calloc(set.count + 1, sizeof(uint64_t));
+    if (!ids) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < set.size; i++)
+        if (set.slots[i])
+            ids[count++] = set.slots[i];
+
+    qsort(ids, count, sizeof(uint64_t), compare_id);
+
+    *_ids = ids;
+    *_count = count;
+
+out:
+    if (dirp)
+        closedir(dirp);
+    scrap500_idset_free(&set);
+    scrap500_idset_free(&list_pages);
+
+    return ret;
+}
+
+int scrap500_cache_read_page_data(int type, uint64_t id,
+                                  char **buf, size_t *len)
+{
+    int ret = 0;
+    size_t n = 0;
+    const char *src = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    page_filename(type, id, filename);
+
+    if (scrap500_pack_get(type, id, &src, &n))
+        return scrap500_cache_read(filename, buf, len);
+
+    ret = cache_decode(filename, src, n, buf, len);
+    if (ret || *buf)
+        return ret;
+
+    *buf = malloc(n + 1);
+    if (!*buf)
+        return ENOMEM;
+
+    memcpy(*buf, src, n);
+    *len = n;
+
+    return 0;
+}
+
+int scrap500_cache_checksum(int type, uint64_t id, scrap500_page_meta_t *meta)
+{
+    int ret = 0;
+    size_t len = 0;
+    size_t n = 0;
+    const char *src = NULL;
+    FILE *fp = NULL;
+    char buf[CACHE_CHUNK];
+    char filename[PATH_MAX] = { 0, };
+
+    meta->stored = 0;
+    meta->crc = 0;
+
+    if (0 == scrap500_pack_get(type, id, &src, &len)) {
+        meta->stored = len;
+        meta->crc = crc32(0, (const Bytef *) src, (uInt) len);
+        return 0;
+    }
+
+    page_filename(type, id, filename);
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return errno;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        meta->stored += n;
+        meta->crc = crc32(meta->crc, (const Bytef *) buf, (uInt) n);
+    }
+
+    if (ferror(fp))
+        ret = EIO;
+
+    fclose(fp);
+
+    return ret;
+}
+
+htmlDocPtr scrap500_cache_read_page(int type, uint64_t id)
+{
+    size_t len = 0;
+    const char *src = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    page_filename(type, id, filename);
+
+    /* the pack is written after the loose files, so it has the newer page */
+    if (scrap500_pack_get(type, id, &src, &len))
+        return scrap500_cache_read_html(filename);
+
+    return parse_page(filename, src, len);
+}
+
+int scrap500_cache_map_page(int type, uint64_t id, scrap500_page_t *page)
+{
+    int ret = 0;
+    size_t outlen = 0;
+    char filename[PATH_MAX] = { 0, };
+
+    memset((void *) page, 0, sizeof(*page));
+
+    page_filename(type, id, filename);
+
+    if (scrap500_pack_get(type, id, &page->data, &page->len)) {
+        ret = map_file(filename, &page->map, &page->maplen);
+        if (ret)
+            return ret;
+
+        page->data = page->map;
+        page->len = page->maplen;
+    }
+
+    ret = cache_decode(filename, page->data, page->len, &page->buf, &outlen);
+    if (ret) {
+        scrap500_cache_unmap_page(page);
+        return ret;
+    }
+
+    if (page->buf) {
+        page->data = page->buf;
+        page->len = outlen;
+    }
+
+    return 0;
+}
+
+void scrap500_cache_unmap_page(scrap500_page_t *page)
+{
+    unmap_file(page->map, page->maplen);
+    free(page->buf);
+
+    memset((void *) page, 0, sizeof(*page));
+}
+
+void scrap500_cache_prefetch(int type, uint64_t id)
+{
+    int fd = 0;
+    size_t len = 0;
+    uintptr_t start = 0;
+    const char *src = NULL;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    char filename[PATH_MAX] = { 0, };
+
+    if (0 == scrap500_pack_get(type, id, &src, &len)) {
+        start = (uintptr_t) src & ~((uintptr_t) pagesize - 1);
+        madvise((void *) start, len + ((uintptr_t) src - start),
+                MADV_WILLNEED);
+        return;
+    }
+
+    page_filename(type, id, filename);
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
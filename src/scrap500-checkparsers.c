@@ -0,0 +1,418 @@
+/* Copyright (C) 2019 Hyogi Sim <simh@ornl.gov>
+ * ---------------------------------------------------------------------------
+ * See COPYING for the license.
+ *
+ * scrap500-checkparsers parses every page cached in a data directory with the
+ * dom backend and with each of the other backends (see 'make check-parsers'),
+ * and reports every field of the records that differs from what the dom
+ * backend gives, along with the pages each backend parses per second. the
+ * backends take turns going first on each page, so that none of them pays for
+ * reading the pages from disk.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "scrap500.h"
+
+char *scrap500_datadir = "__run/scrap500";
+
+static const char *page_names[] = {
+    "list",
+    "site",
+    "system",
+};
+
+/* the backends to check, the dom backend first as the reference */
+static int backends[N_SCRAP500_PARSERS];
+static int n_backends;
+
+/* the cpu time each backend took for the pages of each type */
+static double cpu[N_SCRAP500_PARSERS][3];
+
+/* the pages of each type of which a backend gave a different record */
+static uint64_t n_diffs[N_SCRAP500_PARSERS][3];
+
+static scrap500_list_t lists[N_SCRAP500_PARSERS];
+static scrap500_site_t sites[N_SCRAP500_PARSERS];
+static scrap500_system_t systems[N_SCRAP500_PARSERS];
+static int rets[N_SCRAP500_PARSERS];
+
+static inline double cpu_sec(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* the record the current page and backend are compared in */
+static int cur_type;
+static uint64_t cur_id;
+static int cur_backend;
+
+static void report_begin(const char *field)
+{
+    printf("%-6s %llu %s: %s ", page_names[cur_type], _llu(cur_id), field,
+           scrap500_parser_backend_names[SCRAP500_PARSER_DOM]);
+}
+
+static void report_next(void)
+{
+    printf(", %s ", scrap500_parser_backend_names[cur_backend]);
+}
+
+static void report(const char *field, const char *ref, const char *val)
+{
+    report_begin(field);
+    fputs(ref, stdout);
+    report_next();
+    fputs(val, stdout);
+    fputc('\n', stdout);
+}
+
+/* a null string is told apart from an empty one */
+static inline void print_str(const char *str)
+{
+    if (str)
+        printf("\"%s\"", str);
+    else
+        fputs("null", stdout);
+}
+
+static int diff_str(const char *field, const char *ref, const char *val)
+{
+    if ((!ref && !val) || (ref && val && !strcmp(ref, val)))
+        return 0;
+
+    report_begin(field);
+    print_str(ref);
+    report_next();
+    print_str(val);
+    fputc('\n', stdout);
+
+    return 1;
+}
+
+static int diff_num(const char *field, double ref, double val)
+{
+    char a[32] = { 0, };
+    char b[32] = { 0, };
+
+    if (ref == val || (isnan(ref) && isnan(val)))
+        return 0;
+
+    sprintf(a, "%.17g", ref);
+    sprintf(b, "%.17g", val);
+    report(field, a, b);
+
+    return 1;
+}
+
+static int diff_id(const char *field, uint64_t ref, uint64_t val)
+{
+    char a[24] = { 0, };
+    char b[24] = { 0, };
+
+    if (ref == val)
+        return 0;
+
+    sprintf(a, "%llu", _llu(ref));
+    sprintf(b, "%llu", _llu(val));
+    report(field, a, b);
+
+    return 1;
+}
+
+#define DIFF_STR(ref, val, f)   diff_str(#f, (ref)->f, (val)->f)
+#define DIFF_ID(ref, val, f)    diff_id(#f, (ref)->f, (val)->f)
+
+static int diff_site(scrap500_site_t *ref, scrap500_site_t *val)
+{
+    int n = 0;
+
+    n += DIFF_ID(ref, val, id);
+    n += DIFF_STR(ref, val, name);
+    n += DIFF_STR(ref, val, url);
+    n += DIFF_STR(ref, val, segment);
+    n += DIFF_STR(ref, val, city);
+    n += DIFF_STR(ref, val, country);
+
+    return n;
+}
+
+static int diff_system(scrap500_system_t *ref, scrap500_system_t *val)
+{
+    int n = 0;
+    int i = 0;
+    void *a = NULL;
+    void *b = NULL;
+    const scrap500_sysattr_t *attr = NULL;
+
+    n += DIFF_ID(ref, val, id);
+    n += DIFF_STR(ref, val, name);
+
+    for (i = 0; i < N_SCRAP500_SYSATTRS; i++) {
+        attr = &scrap500_sysattrs[i];
+        a = scrap500_sysattr_field(ref, attr);
+        b = scrap500_sysattr_field(val, attr);
+
+        switch (attr->type) {
+        case SCRAP500_ATTR_ID:
+            n += diff_id(attr->field, *(uint64_t *) a, *(uint64_t *) b);
+            break;
+        case SCRAP500_ATTR_NUM:
+            n += diff_num(attr->field, *(double *) a, *(double *) b);
+            break;
+        default:
+            n += diff_str(attr->field, *(char **) a, *(char **) b);
+            break;
+        }
+    }
+
+    return n;
+}
+
+static int diff_list(scrap500_list_t *ref, scrap500_list_t *val)
+{
+    int n = 0;
+    int i = 0;
+    char field[64] = { 0, };
+
+    for (i = 0; i < 500; i++) {
+        scrap500_rank_t *a = &ref->rank[i];
+        scrap500_rank_t *b = &val->rank[i];
+
+        sprintf(field, "rank[%d].rank", i);
+        n += diff_id(field, (uint64_t) a->rank, (uint64_t) b->rank);
+        sprintf(field, "rank[%d].system_name", i);
+        n += diff_str(field, a->system_name, b->system_name);
+        sprintf(field, "rank[%d].system_id", i);
+        n += diff_id(field, a->system_id, b->system_id);
+        sprintf(field, "rank[%d].site_id", i);
+        n += diff_id(field, a->site_id, b->site_id);
+    }
+
+    return n;
+}
+
+static void reset_record(int type, int i)
+{
+    switch (type) {
+    case SCRAP500_PAGE_LIST:
+        /* the parsers do not own the names of the systems */
+        memset((void *) &lists[i], 0, sizeof(lists[i]));
+        break;
+    case SCRAP500_PAGE_SITE:
+        scrap500_site_reset(&sites[i]);
+        break;
+    default:
+        scrap500_system_reset(&systems[i]);
+        break;
+    }
+}
+
+static int parse_page(int type, uint64_t id, int i)
+{
+    switch (type) {
+    case SCRAP500_PAGE_LIST:
+        lists[i].id = (uint32_t) id;
+        return scrap500_parser_parse_list(&lists[i]);
+    case SCRAP500_PAGE_SITE:
+        sites[i].id = id;
+        return scrap500_parser_parse_site(id, &sites[i]);
+    default:
+        systems[i].id = id;
+        return scrap500_parser_parse_system(id, &systems[i]);
+    }
+}
+
+/*
+ * parses the page with every backend, and compares the records to the one of
+ * the dom backend. returns the number of backends that differ.
+ */
+static int check_page(int type, uint64_t id, uint64_t seq)
+{
+    int i = 0;
+    int k = 0;
+    int n = 0;
+    int count = 0;
+    double start = 0;
+
+    for (k = 0; k < n_backends; k++) {
+        i = (seq + k) % n_backends;
+        reset_record(type, i);
+
+        scrap500_parser_backend = backends[i];
+
+        start = cpu_sec();
+        rets[i] = parse_page(type, id, i);
+        cpu[backends[i]][type] += cpu_sec() - start;
+    }
+
+    cur_type = type;
+    cur_id = id;
+
+    for (i = 1; i < n_backends; i++) {
+        cur_backend = backends[i];
+
+        n = diff_id("return", (uint64_t) rets[0], (uint64_t) rets[i]);
+
+        switch (type) {
+        case SCRAP500_PAGE_LIST:
+            n += diff_list(&lists[0], &lists[i]);
+            break;
+        case SCRAP500_PAGE_SITE:
+            n += diff_site(&sites[0], &sites[i]);
+            break;
+        default:
+            n += diff_system(&systems[0], &systems[i]);
+            break;
+        }
+
+        if (n) {
+            n_diffs[backends[i]][type]++;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static char program[PATH_MAX];
+
+static struct option const long_opts[] = {
+    { "backend", 1, 0, 'b' },
+    { "datadir", 1, 0, 'd' },
+    { "help", 0, 0, 'h' },
+    { 0, 0, 0, 0},
+};
+
+static const char *short_opts = "b:d:h";
+
+static const char *usage_str =
+"Usage: %s [options..]\n"
+"\n"
+"  available options:\n"
+"  -b, --backend=<name>   check only <name> against dom: sax or scan\n"
+"                         (default: all of them)\n"
+"  -d, --datadir=<path>   check the pages in <path>\n"
+"                         (default: __run/scrap500)\n"
+"  -h, --help             print help message\n"
+"\n";
+
+static inline void usage(int ec)
+{
+    fprintf(stdout, usage_str, program);
+    exit(ec);
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int optidx = 0;
+    int ch = 0;
+    int type = 0;
+    int i = 0;
+    int only = -1;
+    uint64_t j = 0;
+    uint64_t pages = 0;
+    uint64_t n_bad = 0;
+    uint64_t *ids[3] = { 0, };
+    uint64_t n_ids[3] = { 0, };
+
+    read_program_name(argv[0], program);
+
+    while ((ch = getopt_long(argc, argv,
+                             short_opts, long_opts, &optidx)) >= 0) {
+        switch (ch) {
+        case 'b':
+            if (scrap500_parser_set_backend(optarg)
+                || scrap500_parser_backend == SCRAP500_PARSER_DOM) {
+                fprintf(stderr, "unknown parser backend: %s\n", optarg);
+                usage(EINVAL);
+            }
+            only = scrap500_parser_backend;
+            break;
+
+        case 'd':
+            scrap500_datadir = optarg;
+            break;
+
+        case 'h':
+        default:
+            usage(0);
+            break;
+        }
+    }
+
+    backends[n_backends++] = SCRAP500_PARSER_DOM;
+    for (i = SCRAP500_PARSER_DOM + 1; i < N_SCRAP500_PARSERS; i++)
+        if (only < 0 || i == only)
+            backends[n_backends++] = i;
+
+    xmlInitParser();
+    scrap500_cache_batch_begin();
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        ret = scrap500_cache_page_ids(type, &ids[type], &n_ids[type]);
+        if (ret) {
+            fprintf(stderr, "failed to collect the %s pages\n",
+                            page_names[type]);
+            goto out;
+        }
+
+        for (j = 0; j < n_ids[type]; j++)
+            if (check_page(type, ids[type][j], j))
+                n_bad++;
+    }
+
+    printf("## %llu lists, %llu sites and %llu systems in %s\n",
+           _llu(n_ids[SCRAP500_PAGE_LIST]), _llu(n_ids[SCRAP500_PAGE_SITE]),
+           _llu(n_ids[SCRAP500_PAGE_SYSTEM]), scrap500_datadir);
+    printf("%-6s %-8s %8s %10s %10s %10s\n",
+           "type", "backend", "pages", "cpu(s)", "pages/s", "mismatch");
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        if (!n_ids[type])
+            continue;
+
+        /* a list is parsed from its five pages */
+        pages = n_ids[type] * (type == SCRAP500_PAGE_LIST ? 5 : 1);
+
+        for (i = 0; i < n_backends; i++)
+            printf("%-6s %-8s %8llu %10.3f %10.1f %10llu\n",
+                   page_names[type],
+                   scrap500_parser_backend_names[backends[i]], _llu(pages),
+                   cpu[backends[i]][type], pages/cpu[backends[i]][type],
+                   _llu(n_diffs[backends[i]][type]));
+    }
+
+    printf("## checked %llu pages, %llu mismatched\n",
+           _llu(n_ids[0] + n_ids[1] + n_ids[2]), _llu(n_bad));
+
+    if (n_bad)
+        ret = EIO;
+
+out:
+    for (i = 0; i < n_backends; i++) {
+        scrap500_site_reset(&sites[i]);
+        scrap500_system_reset(&systems[i]);
+    }
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++)
+        free(ids[type]);
+
+    scrap500_cache_batch_end();
+    xmlCleanupParser();
+
+    return ret;
+}
@@ -153,8 +153,9 @@ int scrap500_db_write_list(scrap500_db_t db, scrap500_list_t *list)
                        "insert or ignore into site (site_id) values (%llu);\n",
                        _llu(rank->site_id));
         pos += sprintf(pos,
-                       "insert or ignore into system (system_id) values (%llu);\n",
-                       _llu(rank->system_id));
+                       "insert or ignore into system (system_id, site_id)\n"
+                       "values (%llu, %llu);\n",
+                       _llu(rank->system_id), _llu(rank->site_id));
         pos += sprintf(pos,
                        "insert or ignore into list (ym, rank, system_id, site_id)\n"
                        "values (%d, %d, %llu, %llu);\n",
@@ -175,3 +176,25 @@ out:
     return ret;
 }
 
+int scrap500_db_read_latest(scrap500_db_t db, uint32_t *latest)
+{
+    int ret = 0;
+    sqlite3 *dbconn = (sqlite3 *) db;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "select max(ym) from list;";
+
+    ret = sqlite3_prepare_v2(dbconn, sql, -1, &stmt, NULL);
+    if (ret != SQLITE_OK) {
+        fprintf(stderr, "db query failed, sql=\n%s\nerror: %s\n",
+                        sql, sqlite3_errmsg(dbconn));
+        return EIO;
+    }
+
+    *latest = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        *latest = (uint32_t) sqlite3_column_int(stmt, 0);
+
+    sqlite3_finalize(stmt);
+
+    return 0;
+}
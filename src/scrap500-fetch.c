@@ -16,32 +16,35 @@
 static scrap500_list_t *scrap500_list;
 static uint64_t n_list;
 
+static int update;
+static char *dbname = "scrap500.sqlite3.db";
+
 char *scrap500_datadir = "/tmp/scrap500";
 
 static inline int allocate_list(void)
 {
     time_t tnow = time(NULL);
     struct tm *now = localtime(&tnow);
-    uint32_t years = (now->tm_year + 1900) - 1993;
+    uint32_t years = (now->tm_year + 1900) - 1993 + 1;
+    uint32_t this_month = (now->tm_year + 1900)*100 + now->tm_mon + 1;
     uint32_t i = 0;
     uint32_t id = 0;
     scrap500_list_t *list = NULL;
 
-    n_list = years*2;
-    scrap500_list = (scrap500_list_t *) calloc(n_list, sizeof(*list));
+    scrap500_list = (scrap500_list_t *) calloc(years*2, sizeof(*list));
     if (!scrap500_list) {
         perror("cannot allocate memory for the list");
         return errno;
     }
 
-    for (i = 0; i < n_list; i += 2) {
-        id = (1993 + i/2)*100;
+    for (i = 0; i < years*2; i++) {
+        id = (1993 + i/2)*100 + (i % 2 ? 11 : 6);
 
-        list = &scrap500_list[i];
-        list->id = id + 6;
+        /* a list is published during its month, take it from the next */
+        if (id >= this_month)
+            break;
 
-        list = &list[1];
-        list->id = id + 11;
+        scrap500_list[n_list++].id = id;
     }
 
     return 0;
@@ -72,78 +75,93 @@ out:
     return 0;
 }
 
-static inline int open_tmpfiles(scrap500_list_t *list)
+static int parse_list_cb(scrap500_list_t *list, void *data)
 {
-    int i = 0;
-    FILE *fp = NULL;
-    char filename[PATH_MAX] = { 0, };
-
-    if (!list)
-        return EINVAL;
-
-    for (i = 0; i < 5; i++) {
-        scrap500_list_html_filename(list, i+1, filename);
-        fp = fopen(filename, "w");
-        if (!fp) {
-            perror("failed to create a tmpfile");
-            return errno;
-        }
+    int ret = 0;
 
-        list->tmpfp[i] = fp;
-    }
+    /*
+     * the pages have been parsed while they were fetched, unless some were
+     * not fetched at all, e.g., those of an interrupted crawl, or with -n.
+     */
+    if (scrap500_list_streamed(list))
+        return 0;
 
-    return 0;
+    ret = scrap500_parser_parse_list(list);
+    if (ret)
+        fprintf(stderr, "failed to parse the list.\n");
+
+    return ret;
 }
 
-static inline void close_tmpfiles(scrap500_list_t *list)
+/*
+ * for the incremental crawl (-U): keeps only the lists newer than the latest
+ * one in the database. of their sites and systems, the fetcher skips those
+ * that are cached already, as in any crawl.
+ */
+static int prepare_update(void)
 {
-    int i = 0;
+    int ret = 0;
+    uint64_t i = 0;
+    uint64_t n = 0;
+    uint32_t latest = 0;
+    scrap500_db_t db = NULL;
 
-    if (!list)
-        return;
+    db = scrap500_db_open(dbname, 0);
+    if (!db) {
+        fprintf(stderr, "failed to open the database %s\n", dbname);
+        return EIO;
+    }
 
-    for (i = 0; i < 5; i++)
-        if (list->tmpfp[i])
-            fclose(list->tmpfp[i]);
-}
+    ret = scrap500_db_read_latest(db, &latest);
 
+    scrap500_db_close(db);
 
-static int do_fetch(void)
-{
-    int i = 0;
-    int ret = 0;
-    int page = 0;
-    scrap500_db_t db = NULL;
-    scrap500_list_t *list = NULL;
+    if (ret)
+        return ret;
 
     for (i = 0; i < n_list; i++) {
-        list = &scrap500_list[i];
-        if (!list)
-            continue;
+        if (scrap500_list[i].id > latest)
+            scrap500_list[n++].id = scrap500_list[i].id;
+    }
 
-        open_tmpfiles(list);
+    n_list = n;
 
-        ret = scrap500_http_fetch_list(list);
-        if (ret) {
-            fprintf(stderr, "failed to fetch the list.\n");
-            goto out;
-        }
+    printf("## %llu new lists since %u\n", _llu(n_list), latest);
 
-        close_tmpfiles(list);
+    return 0;
+}
 
-        ret = scrap500_parser_parse_list(list);
-        if (ret) {
-            fprintf(stderr, "failed to parse the list.\n");
+static int do_fetch(void)
+{
+    int ret = 0;
+    int rc = 0;
+
+    if (update) {
+        ret = prepare_update();
+        if (ret || !n_list)
             goto out;
-        }
+    }
 
-        ret = scrap500_http_fetch_specs(list);
-        if (ret) {
-            fprintf(stderr, "failed to fetch specifications.\n");
+    ret = scrap500_http_fetch_lists(scrap500_list, n_list,
+                                    parse_list_cb, NULL);
+    if (ret) {
+        fprintf(stderr, "failed to fetch the list.\n");
+
+        /* EIO: some pages were given up on, keep going with the rest */
+        if (ret != EIO)
             goto out;
-        }
     }
 
+    rc = scrap500_http_fetch_specs(scrap500_list, n_list);
+    if (rc) {
+        fprintf(stderr, "failed to fetch specifications.\n");
+        ret = rc;
+    }
+
+    /* pages given up on do not make the crawl resumable */
+    if (!ret || ret == EIO)
+        scrap500_journal_finish();
+
 out:
     return ret;
 }
@@ -151,19 +169,53 @@ out:
 static char program[PATH_MAX];
 
 static struct option const long_opts[] = {
+    { "trim", 0, 0, 'c' },
     { "datadir", 1, 0, 'd' },
+    { "dbname", 1, 0, 'D' },
+    { "hedge", 0, 0, 'e' },
     { "help", 0, 0, 'h' },
+    { "http2", 0, 0, 'H' },
+    { "inflight", 1, 0, 'I' },
+    { "pack", 0, 0, 'k' },
+    { "max-rate", 1, 0, 'M' },
+    { "stream", 0, 0, 'P' },
+    { "refresh", 0, 0, 'r' },
+    { "rate", 1, 0, 'R' },
+    { "threads", 1, 0, 't' },
+    { "timeout", 1, 0, 'T' },
+    { "url", 1, 0, 'u' },
+    { "update", 0, 0, 'U' },
+    { "compress", 1, 0, 'z' },
     { 0, 0, 0, 0},
 };
 
-static const char *short_opts = "d:h";
+static const char *short_opts = "cd:D:ehHI:kM:PrR:t:T:u:Uz:";
 
 static const char *usage_str =
 "Usage: %s [options..]\n"
 "\n"
 "  available options:\n"
+"  -c, --trim             keep only the content of the fetched pages\n"
 "  -d, --datadir=<path>   store files in <path> (default: /tmp/scrap500)\n"
+"  -D, --dbname=<db file> with -U, the sqlite database built by scrap500\n"
+"  -e, --hedge            resend site/system requests slower than usual\n"
 "  -h, --help             print help message\n"
+"  -H, --http2            multiplex requests over HTTP/2 when supported\n"
+"  -I, --inflight=<N>     keep up to <N> list page requests in flight\n"
+"  -k, --pack             keep the pages in one file, <path>/pages.pack\n"
+"  -M, --max-rate=<N>     never send more than <N> requests per second\n"
+"                         (default: 32), 0 for no bound\n"
+"  -P, --stream           parse list pages while they are downloaded\n"
+"  -r, --refresh          revalidate cached pages with conditional requests\n"
+"  -R, --rate=<N>         limit the requests, starting at <N> per second\n"
+"                         (default: 8), 0 to disable rate limiting\n"
+"  -t, --threads=<N>      fetch specifications with <N> threads\n"
+"  -T, --timeout=<sec>    abort a request after <sec> seconds (default: 120)\n"
+"  -u, --url=<baseurl>    fetch pages from <baseurl> instead of top500.org\n"
+"  -U, --update           fetch only the lists newer than the database has,\n"
+"                         and the sites and systems not cached yet\n"
+"  -z, --compress=<fmt>   store pages with <fmt>: zstd (default if built\n"
+"                         with libzstd), gzip, or none\n"
 "\n";
 
 static inline void usage(int ec)
@@ -187,10 +239,75 @@ int main(int argc, char **argv)
     while ((ch = getopt_long(argc, argv,
                              short_opts, long_opts, &optidx)) >= 0) {
         switch (ch) {
+        case 'c':
+            scrap500_http_config.trim = 1;
+            break;
+
         case 'd':
             scrap500_datadir = strdup(optarg);
             break;
 
+        case 'D':
+            dbname = optarg;
+            break;
+
+        case 'e':
+            scrap500_http_config.hedge = 1;
+            break;
+
+        case 'H':
+            scrap500_http_config.http2 = 1;
+            break;
+
+        case 'I':
+            scrap500_http_config.max_inflight = atoi(optarg);
+            break;
+
+        case 'k':
+            scrap500_http_config.pack = 1;
+            break;
+
+        case 'M':
+            scrap500_http_config.max_rate = atof(optarg);
+            break;
+
+        case 'P':
+            scrap500_http_config.stream = 1;
+            break;
+
+        case 'r':
+            scrap500_http_config.refresh = 1;
+            break;
+
+        case 'R':
+            scrap500_http_config.rate = atof(optarg);
+            break;
+
+        case 't':
+            scrap500_http_config.nthreads = atoi(optarg);
+            break;
+
+        case 'T':
+            scrap500_http_config.timeout = atol(optarg);
+            break;
+
+        case 'u':
+            scrap500_http_config.baseurl = optarg;
+            break;
+
+        case 'U':
+            update = 1;
+            break;
+
+        case 'z':
+            scrap500_http_config.compress =
+                scrap500_cache_format_by_name(optarg);
+            if (scrap500_http_config.compress < 0) {
+                fprintf(stderr, "unknown format %s\n", optarg);
+                usage(1);
+            }
+            break;
+
         case 'h':
         default:
             usage(0);
@@ -202,8 +319,17 @@ int main(int argc, char **argv)
 
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
+    ret = scrap500_http_init();
+    if (ret) {
+        fprintf(stderr, "failed to initialize http.\n");
+        goto out_cleanup;
+    }
+
     ret = do_fetch();
 
+    scrap500_http_exit();
+
+out_cleanup:
     curl_global_cleanup();
 
 out:
@@ -13,16 +13,44 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <curl/curl.h>
+#include <zlib.h>
 
 #include "scrap500.h"
 
+scrap500_http_config_t scrap500_http_config = {
+    .nthreads = 1,
+    .max_inflight = 16,
+    .http2 = 0,
+    .loop = SCRAP500_HTTP_LOOP_EPOLL,
+    .baseurl = "https://www.top500.org",
+    .refresh = 0,
+    .rate = 8.0,
+    .max_rate = 32.0,
+    .max_retries = 5,
+    .stream = 0,
+    .nosave = 0,
+    .quiet = 0,
+    .timeout = 120,
+    .connect_timeout = 30,
+    .low_speed_limit = 100,
+    .low_speed_time = 30,
+    .hedge = 0,
+    .compress = SCRAP500_CACHE_DEFAULT,
+    .pack = 0,
+    .trim = 0,
+};
+
 #define call_curl(fn)                                           \
         do {                                                    \
             CURLcode c = (fn);                                  \
@@ -30,315 +58,2046 @@
                 fprintf(stderr, "%s\n", curl_easy_strerror(c)); \
         } while (0)
 
-static inline void prepare_list(CURLM *cm, scrap500_list_t *list)
+/*
+ * all easy handles share a single CURLSH for the dns cache, tls sessions and
+ * the connection cache, so that consecutive requests to top500.org reuse the
+ * established connection instead of resolving, connecting and handshaking for
+ * every page. the handles themselves are recycled through a free list.
+ */
+static CURLSH *share;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+static pthread_mutex_t handle_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static CURL **handle_pool;
+static int n_handle_pool;
+static int handle_pool_size;
+
+static void share_lock(CURL *curl, curl_lock_data data,
+                       curl_lock_access access, void *userptr)
+{
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+static void share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+static CURL *get_handle(void)
+{
+    CURL *curl = NULL;
+    CURLcode cc = 0;
+
+    pthread_mutex_lock(&handle_pool_lock);
+    if (n_handle_pool > 0)
+        curl = handle_pool[--n_handle_pool];
+    pthread_mutex_unlock(&handle_pool_lock);
+
+    if (curl)
+        return curl;
+
+    curl = curl_easy_init();
+    if (!curl)
+        return NULL;
+
+    cc = curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+    /* a stalled server must not hold up the crawl forever */
+    cc |= curl_easy_setopt(curl, CURLOPT_TIMEOUT,
+                                 scrap500_http_config.timeout);
+    cc |= curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT,
+                                 scrap500_http_config.connect_timeout);
+    cc |= curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
+                                 scrap500_http_config.low_speed_limit);
+    cc |= curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,
+                                 scrap500_http_config.low_speed_time);
+
+    if (share)
+        cc |= curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    if (scrap500_http_config.http2) {
+        cc |= curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                                     (long) CURL_HTTP_VERSION_2TLS);
+        cc |= curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    if (cc != CURLE_OK) {
+        fprintf(stderr, "curl error: %s\n", curl_easy_strerror(cc));
+        curl_easy_cleanup(curl);
+        return NULL;
+    }
+
+    return curl;
+}
+
+static void put_handle(CURL *curl)
+{
+    CURL **pool = NULL;
+
+    if (!curl)
+        return;
+
+    pthread_mutex_lock(&handle_pool_lock);
+
+    if (n_handle_pool == handle_pool_size) {
+        int size = handle_pool_size ? 2*handle_pool_size : 16;
+
+        pool = realloc(handle_pool, size*sizeof(*pool));
+        if (pool) {
+            handle_pool = pool;
+            handle_pool_size = size;
+        }
+    }
+
+    if (n_handle_pool < handle_pool_size) {
+        handle_pool[n_handle_pool++] = curl;
+        curl = NULL;
+    }
+
+    pthread_mutex_unlock(&handle_pool_lock);
+
+    if (curl)
+        curl_easy_cleanup(curl);
+}
+
+static inline uint64_t now_ms(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/*
+ * requests to the host are paced by a token bucket whose rate adapts to the
+ * server (aimd): successful responses raise the rate by one request per second
+ * up to max_rate, at most once per second however many arrive in it, and
+ * throttling responses (429, 503, 504) or timeouts halve it, also at most
+ * once per second so that a burst of failures counts as one signal. a
+ * Retry-After header additionally holds all requests until it expires. all
+ * pages are fetched from the same host, so a single bucket is shared by the
+ * list reactor and the spec fetcher threads.
+ */
+struct _limiter {
+    pthread_mutex_t lock;
+    double rate;            /* requests per second, 0 if not limited */
+    double tokens;
+    uint64_t stamp;         /* ms, of the last refill */
+    uint64_t last_raise;    /* ms, of the last increase */
+    uint64_t last_cut;      /* ms, of the last decrease */
+    uint64_t hold_until;    /* ms, from Retry-After */
+};
+
+typedef struct _limiter limiter_t;
+
+#define LIMITER_MIN_RATE    0.5
+
+static limiter_t limiter = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void limiter_init(void)
+{
+    pthread_mutex_lock(&limiter.lock);
+
+    limiter.rate = scrap500_http_config.rate;
+    if (limiter.rate > 0 && limiter.rate < LIMITER_MIN_RATE)
+        limiter.rate = LIMITER_MIN_RATE;
+    if (scrap500_http_config.max_rate > 0
+        && limiter.rate > scrap500_http_config.max_rate)
+        limiter.rate = scrap500_http_config.max_rate;
+
+    limiter.tokens = 1;
+    limiter.stamp = now_ms();
+    limiter.last_raise = limiter.stamp;
+    limiter.last_cut = 0;
+    limiter.hold_until = 0;
+
+    pthread_mutex_unlock(&limiter.lock);
+}
+
+/*
+ * takes a token if one is available and returns 0. otherwise, returns how
+ * long (ms) the caller should wait before trying again.
+ */
+static uint64_t limiter_take(void)
+{
+    uint64_t wait = 0;
+    uint64_t now = now_ms();
+    double burst = 0;
+
+    pthread_mutex_lock(&limiter.lock);
+
+    if (now < limiter.hold_until) {
+        wait = limiter.hold_until - now;
+        goto out;
+    }
+
+    if (limiter.rate <= 0)
+        goto out;
+
+    burst = limiter.rate < 1 ? 1 : limiter.rate;
+
+    limiter.tokens += limiter.rate*(now - limiter.stamp)/1000;
+    if (limiter.tokens > burst)
+        limiter.tokens = burst;
+    limiter.stamp = now;
+
+    if (limiter.tokens >= 1)
+        limiter.tokens -= 1;
+    else
+        wait = 1 + (uint64_t) ((1 - limiter.tokens)*1000/limiter.rate);
+
+out:
+    pthread_mutex_unlock(&limiter.lock);
+
+    return wait;
+}
+
+static void limiter_success(void)
+{
+    uint64_t now = now_ms();
+    double max_rate = scrap500_http_config.max_rate;
+
+    pthread_mutex_lock(&limiter.lock);
+
+    if (limiter.rate > 0 && now - limiter.last_raise >= 1000) {
+        limiter.rate += 1;
+        limiter.last_raise = now;
+        if (max_rate > 0 && limiter.rate > max_rate)
+            limiter.rate = max_rate;
+    }
+
+    pthread_mutex_unlock(&limiter.lock);
+}
+
+static void limiter_backoff(uint64_t retry_after)
+{
+    uint64_t now = now_ms();
+
+    pthread_mutex_lock(&limiter.lock);
+
+    if (limiter.rate > 0 && now - limiter.last_cut >= 1000) {
+        limiter.rate /= 2;
+        if (limiter.rate < LIMITER_MIN_RATE)
+            limiter.rate = LIMITER_MIN_RATE;
+        if (limiter.tokens > 1)
+            limiter.tokens = 1;
+        limiter.last_cut = now;
+
+        fprintf(stderr, "throttled, slowing down to %.1f requests/sec\n",
+                        limiter.rate);
+    }
+
+    if (retry_after && now + 1000*retry_after > limiter.hold_until)
+        limiter.hold_until = now + 1000*retry_after;
+
+    pthread_mutex_unlock(&limiter.lock);
+}
+
+static inline uint64_t limiter_rate(void)
+{
+    uint64_t rate = 0;
+
+    pthread_mutex_lock(&limiter.lock);
+    rate = (uint64_t) limiter.rate;
+    pthread_mutex_unlock(&limiter.lock);
+
+    return rate;
+}
+
+/*
+ * a page that failed for a transient reason is retried after an exponential
+ * backoff: 1s, 2s, 4s, .. up to a minute, or after Retry-After if longer.
+ */
+#define RETRY_BASE_MS       1000
+#define RETRY_MAX_MS        60000
+
+static inline uint64_t retry_delay(int attempts, uint64_t retry_after)
+{
+    uint64_t delay = RETRY_MAX_MS;
+
+    if (attempts < 16)
+        delay = (uint64_t) RETRY_BASE_MS << attempts;
+    if (delay > RETRY_MAX_MS)
+        delay = RETRY_MAX_MS;
+    if (1000*retry_after > delay)
+        delay = 1000*retry_after;
+
+    return delay;
+}
+
+/*
+ * response times of all transfers, for scrap500_http_get_stats(). the 95th
+ * percentile of the last HEDGE_WINDOW of them is recomputed every
+ * HEDGE_UPDATE samples: a site or system page that takes longer than that is
+ * requested once more (see fetch_hedged()). the window keeps the cost of the
+ * update the same however long the crawl runs, and follows the server as it
+ * speeds up or slows down.
+ */
+#define HEDGE_MIN_SAMPLES   32
+#define HEDGE_UPDATE        64
+#define HEDGE_WINDOW        512
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static double *stats_samples;
+static uint64_t n_stats_samples;
+static uint64_t stats_size;
+static double hedge_samples[HEDGE_WINDOW];      /* a ring of the last ones */
+static uint64_t n_hedge_samples;
+static uint64_t hedge_after;    /* ms, 0 until enough samples */
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void record_response_time(CURL *curl)
+{
+    double *samples = NULL;
+    double sec = 0;
+    double p95 = 0;
+    uint64_t n = 0;
+    curl_off_t usec = 0;
+    double window[HEDGE_WINDOW];
+
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &usec);
+    sec = usec*1e-6;
+
+    pthread_mutex_lock(&stats_lock);
+
+    if (n_stats_samples == stats_size) {
+        uint64_t size = stats_size ? 2*stats_size : 1024;
+
+        samples = realloc(stats_samples, size*sizeof(*samples));
+        if (samples) {
+            stats_samples = samples;
+            stats_size = size;
+        }
+    }
+
+    if (n_stats_samples < stats_size)
+        stats_samples[n_stats_samples++] = sec;
+
+    hedge_samples[n_hedge_samples++ % HEDGE_WINDOW] = sec;
+
+    if (n_hedge_samples >= HEDGE_MIN_SAMPLES
+        && n_hedge_samples % HEDGE_UPDATE == 0) {
+        n = n_hedge_samples < HEDGE_WINDOW ? n_hedge_samples : HEDGE_WINDOW;
+        memcpy(window, hedge_samples, n*sizeof(*window));
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+
+    /* sorted out of the lock, the ring keeps its order */
+    if (n) {
+        qsort(window, n, sizeof(*window), compare_double);
+        p95 = window[(n*95)/100];
+        __atomic_store_n(&hedge_after, (uint64_t) (1e3*p95) + 1,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+void scrap500_http_get_stats(scrap500_http_stats_t *stats, int reset)
+{
+    uint64_t n = 0;
+
+    memset((void *) stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&stats_lock);
+
+    n = n_stats_samples;
+    if (n) {
+        qsort(stats_samples, n, sizeof(*stats_samples), compare_double);
+
+        stats->pages = n;
+        stats->p50 = stats_samples[n/2];
+        stats->p99 = stats_samples[(n*99)/100];
+        stats->max = stats_samples[n-1];
+    }
+
+    if (reset)
+        n_stats_samples = 0;
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+int scrap500_http_init(void)
+{
+    int ret = 0;
+    int i = 0;
+    CURLSHcode sc = 0;
+    curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+
+    if (scrap500_http_config.http2 && !(info->features & CURL_VERSION_HTTP2)) {
+        fprintf(stderr, "libcurl %s has no HTTP/2 support, using HTTP/1.1\n",
+                        info->version);
+        scrap500_http_config.http2 = 0;
+    }
+
+    share = curl_share_init();
+    if (!share) {
+        fprintf(stderr, "curl share init failed\n");
+        return ENOMEM;
+    }
+
+    if (scrap500_index_open())
+        fprintf(stderr, "continuing without the page index\n");
+
+    if (scrap500_journal_open())
+        fprintf(stderr, "continuing without the crawl journal\n");
+
+    /* once there is a pack, the pages keep going there */
+    ret = scrap500_pack_open(scrap500_http_config.pack ? SCRAP500_PACK_CREATE
+                                                       : SCRAP500_PACK_APPEND);
+    if (ret && ret != ENOENT) {
+        scrap500_http_exit();
+        return ret;
+    }
+
+    limiter_init();
+
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        pthread_mutex_init(&share_locks[i], NULL);
+
+    sc = curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    sc |= curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    sc |= curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    sc |= curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    sc |= curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    if (sc != CURLSHE_OK) {
+        fprintf(stderr, "curl share setup failed: %s\n",
+                        curl_share_strerror(sc));
+        scrap500_http_exit();
+        return EIO;
+    }
+
+    return 0;
+}
+
+void scrap500_http_exit(void)
+{
+    int i = 0;
+
+    scrap500_index_close();
+    scrap500_journal_close();
+    scrap500_pack_close();
+
+    for (i = 0; i < n_handle_pool; i++)
+        curl_easy_cleanup(handle_pool[i]);
+
+    if (handle_pool)
+        free(handle_pool);
+
+    handle_pool = NULL;
+    n_handle_pool = handle_pool_size = 0;
+
+    if (stats_samples)
+        free(stats_samples);
+
+    stats_samples = NULL;
+    n_stats_samples = stats_size = 0;
+    n_hedge_samples = hedge_after = 0;
+
+    if (share) {
+        curl_share_cleanup(share);
+        share = NULL;
+
+        for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+            pthread_mutex_destroy(&share_locks[i]);
+    }
+}
+
+/*
+ * the reactor drives a multi handle from an epoll loop: libcurl reports the
+ * sockets it is interested in through CURLMOPT_SOCKETFUNCTION and its next
+ * deadline through CURLMOPT_TIMERFUNCTION, and we only call back into
+ * curl_multi_socket_action() for sockets that are actually ready. the old
+ * curl_multi_wait() loop is kept as SCRAP500_HTTP_LOOP_WAIT for comparison.
+ */
+struct _reactor {
+    int loop;
+    CURLM *cm;
+    int epfd;
+    int running;
+    long timeout;           /* ms from timer_stamp, -1 if not armed */
+    uint64_t timer_stamp;
+    int repeats;            /* SCRAP500_HTTP_LOOP_WAIT only */
+};
+
+typedef struct _reactor reactor_t;
+
+#define REACTOR_MAX_EVENTS  64
+
+static int reactor_socket_cb(CURL *curl, curl_socket_t s, int what,
+                             void *userp, void *socketp)
+{
+    int ret = 0;
+    reactor_t *r = (reactor_t *) userp;
+    struct epoll_event ev = { 0, };
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(r->epfd, EPOLL_CTL_DEL, s, NULL);
+        curl_multi_assign(r->cm, s, NULL);
+        return 0;
+    }
+
+    if (what & CURL_POLL_IN)
+        ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = s;
+
+    if (socketp)
+        ret = epoll_ctl(r->epfd, EPOLL_CTL_MOD, s, &ev);
+    else {
+        ret = epoll_ctl(r->epfd, EPOLL_CTL_ADD, s, &ev);
+        if (ret < 0 && errno == EEXIST)
+            ret = epoll_ctl(r->epfd, EPOLL_CTL_MOD, s, &ev);
+
+        curl_multi_assign(r->cm, s, (void *) r);
+    }
+
+    if (ret < 0)
+        fprintf(stderr, "epoll_ctl failed on socket %d: %s\n",
+                        (int) s, strerror(errno));
+
+    return 0;
+}
+
+static int reactor_timer_cb(CURLM *cm, long timeout_ms, void *userp)
+{
+    reactor_t *r = (reactor_t *) userp;
+
+    r->timeout = timeout_ms;
+    r->timer_stamp = now_ms();
+
+    return 0;
+}
+
+static int reactor_init(reactor_t *r, int loop)
+{
+    memset((void *) r, 0, sizeof(*r));
+
+    r->loop = loop;
+    r->epfd = -1;
+    r->timeout = -1;
+
+    r->cm = curl_multi_init();
+    if (!r->cm) {
+        fprintf(stderr, "curl multi init failed\n");
+        return ENOMEM;
+    }
+
+    curl_multi_setopt(r->cm, CURLMOPT_PIPELINING,
+                      scrap500_http_config.http2 ? CURLPIPE_MULTIPLEX
+                                                 : CURLPIPE_NOTHING);
+
+    if (loop == SCRAP500_HTTP_LOOP_WAIT)
+        return 0;
+
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
+        perror("failed to create epoll instance");
+        curl_multi_cleanup(r->cm);
+        return errno;
+    }
+
+    curl_multi_setopt(r->cm, CURLMOPT_SOCKETFUNCTION, reactor_socket_cb);
+    curl_multi_setopt(r->cm, CURLMOPT_SOCKETDATA, (void *) r);
+    curl_multi_setopt(r->cm, CURLMOPT_TIMERFUNCTION, reactor_timer_cb);
+    curl_multi_setopt(r->cm, CURLMOPT_TIMERDATA, (void *) r);
+
+    return 0;
+}
+
+static void reactor_exit(reactor_t *r)
+{
+    if (r->cm)
+        curl_multi_cleanup(r->cm);
+    if (r->epfd >= 0)
+        close(r->epfd);
+
+    r->cm = NULL;
+    r->epfd = -1;
+}
+
+static inline void reactor_add(reactor_t *r, CURL *curl)
+{
+    curl_multi_add_handle(r->cm, curl);
+}
+
+static inline void reactor_remove(reactor_t *r, CURL *curl)
+{
+    curl_multi_remove_handle(r->cm, curl);
+}
+
+static int reactor_wait_legacy(reactor_t *r, long max_wait)
+{
+    CURLMcode mc = 0;
+    int numfds = 0;
+
+    if (max_wait < 0 || max_wait > 1000)
+        max_wait = 1000;
+
+    mc = curl_multi_wait(r->cm, NULL, 0, (int) max_wait, &numfds);
+    if (mc != CURLM_OK) {
+        fprintf(stderr, "curl multi processing failed: %d\n", mc);
+        return EIO;
+    }
+
+    if (!numfds) {
+        r->repeats++;
+        if (r->repeats > 1)
+            usleep(1e5);
+    }
+    else
+        r->repeats = 0;
+
+    curl_multi_perform(r->cm, &r->running);
+
+    return 0;
+}
+
+/*
+ * wait until any socket becomes ready or the curl timer expires, but no longer
+ * than max_wait ms (-1 for no bound), and let libcurl make progress on them.
+ * completed transfers are then available from curl_multi_info_read().
+ */
+static int reactor_wait(reactor_t *r, long max_wait)
+{
+    int i = 0;
+    int n = 0;
+    int flags = 0;
+    long timeout = -1;
+    uint64_t elapsed = 0;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    if (r->loop == SCRAP500_HTTP_LOOP_WAIT)
+        return reactor_wait_legacy(r, max_wait);
+
+    if (r->timeout >= 0) {
+        elapsed = now_ms() - r->timer_stamp;
+        timeout = elapsed >= (uint64_t) r->timeout ? 0 : r->timeout - elapsed;
+    }
+
+    if (max_wait >= 0 && (timeout < 0 || timeout > max_wait))
+        timeout = max_wait;
+
+    if (timeout != 0) {
+        n = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, (int) timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                return 0;
+
+            perror("epoll_wait failed");
+            return errno;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        flags = 0;
+        if (events[i].events & EPOLLIN)
+            flags |= CURL_CSELECT_IN;
+        if (events[i].events & EPOLLOUT)
+            flags |= CURL_CSELECT_OUT;
+        if (events[i].events & (EPOLLERR|EPOLLHUP))
+            flags |= CURL_CSELECT_ERR;
+
+        curl_multi_socket_action(r->cm, events[i].data.fd, flags,
+                                 &r->running);
+    }
+
+    if (r->timeout >= 0 &&
+        now_ms() - r->timer_stamp >= (uint64_t) r->timeout) {
+        r->timeout = -1;
+        curl_multi_socket_action(r->cm, CURL_SOCKET_TIMEOUT, 0, &r->running);
+    }
+
+    return 0;
+}
+
+/*
+ * a transfer downloads one page into <filename>.tmp and renames it into place
+ * once the page has arrived completely. when revalidating a cached page whose
+ * etag or last-modified date is in the page index, the request is made
+ * conditional, and a 304 response keeps the cached copy.
+ *
+ * with parse set, the body is also fed to a push parser while it arrives, and
+ * the document is in doc when the transfer ends (read from the cached copy on
+ * 304). with nosave set, the body is not written to disk at all.
+ */
+struct _transfer {
+    int type;
+    uint64_t id;                /* for list pages, YYYYMM*10 + page */
+    int revalidate;
+    int parse;
+    int nosave;
+    int hedge;                  /* the duplicate of a slow request */
+    int trim;                   /* store only the content, see transfer_trim */
+    uint64_t raw_len;           /* of the page as received, when trimming */
+    uint32_t raw_crc;
+    char url[PATH_MAX];
+    char filename[PATH_MAX];
+    char tmpname[PATH_MAX];
+    scrap500_cache_writer_t *cw;
+    htmlParserCtxtPtr parser;
+    htmlDocPtr doc;
+    struct curl_slist *headers;
+    uint64_t retry_after;       /* sec, from the response */
+    scrap500_page_meta_t meta;  /* of the response */
+};
+
+typedef struct _transfer transfer_t;
+
+static const char *page_names[] = {
+    "list",
+    "site",
+    "system",
+};
+
+static uint64_t n_fetched;
+static uint64_t n_not_modified;
+static uint64_t n_retried;
+static uint64_t n_failed;
+static uint64_t n_hedged;
+
+static void transfer_set_names(transfer_t *x)
+{
+    uint32_t list_id = 0;
+    int page = 0;
+    const char *baseurl = scrap500_http_config.baseurl;
+
+    switch (x->type) {
+    case SCRAP500_PAGE_LIST:
+        list_id = (uint32_t) (x->id/10);
+        page = (int) (x->id%10);
+
+        scrap500_list_page_html_filename(list_id, page, x->filename);
+        sprintf(x->url, "%s/list/%u/%u/?page=%d",
+                        baseurl, list_id/100, list_id%100, page);
+        break;
+
+    case SCRAP500_PAGE_SITE:
+        scrap500_site_html_filename(x->id, x->filename);
+        sprintf(x->url, "%s/site/%llu", baseurl, _llu(x->id));
+        break;
+
+    case SCRAP500_PAGE_SYSTEM:
+    default:
+        scrap500_system_html_filename(x->id, x->filename);
+        sprintf(x->url, "%s/system/%llu", baseurl, _llu(x->id));
+        break;
+    }
+
+    /* the duplicate downloads next to the original request */
+    sprintf(x->tmpname, x->hedge ? "%s.hedge.tmp" : "%s.tmp", x->filename);
+}
+
+static int copy_header(const char *buf, size_t len, const char *name,
+                       char *val, size_t vlen)
+{
+    size_t nlen = strlen(name);
+
+    if (len <= nlen || strncasecmp(buf, name, nlen))
+        return 0;
+
+    buf += nlen;
+    len -= nlen;
+
+    while (len && isspace(buf[0])) {
+        buf++;
+        len--;
+    }
+
+    while (len && isspace(buf[len-1]))
+        len--;
+
+    if (len >= vlen)
+        len = vlen - 1;
+
+    memcpy(val, buf, len);
+    val[len] = '\0';
+
+    return 1;
+}
+
+static size_t transfer_header_cb(char *buf, size_t size, size_t nitems,
+                                 void *userdata)
+{
+    transfer_t *x = (transfer_t *) userdata;
+    scrap500_page_meta_t *meta = &x->meta;
+    size_t len = size*nitems;
+
+    if (len > 5 && 0 == strncmp(buf, "HTTP/", 5)) {
+        /* a new response begins, e.g., after a redirect */
+        meta->etag[0] = '\0';
+        meta->last_modified[0] = '\0';
+    }
+    else if (!copy_header(buf, len, "etag:",
+                          meta->etag, sizeof(meta->etag)))
+        copy_header(buf, len, "last-modified:",
+                    meta->last_modified, sizeof(meta->last_modified));
+
+    return len;
+}
+
+static size_t transfer_write_cb(char *buf, size_t size, size_t nmemb,
+                                void *userdata)
+{
+    transfer_t *x = (transfer_t *) userdata;
+    size_t len = size*nmemb;
+
+    if (x->trim) {
+        x->raw_len += len;
+        x->raw_crc = crc32(x->raw_crc, (const Bytef *) buf, (uInt) len);
+    }
+    else if (x->cw && scrap500_cache_write(x->cw, buf, len))
+        return 0;
+
+    if (x->parser)
+        htmlParseChunk(x->parser, buf, (int) len, 0);
+
+    return len;
+}
+
+static void transfer_cleanup(transfer_t *x)
+{
+    if (x->cw) {
+        scrap500_cache_abort(x->cw);
+        x->cw = NULL;
+        unlink(x->tmpname);
+    }
+
+    if (x->parser) {
+        if (x->parser->myDoc)
+            xmlFreeDoc(x->parser->myDoc);
+        htmlFreeParserCtxt(x->parser);
+        x->parser = NULL;
+    }
+
+    if (x->headers) {
+        curl_slist_free_all(x->headers);
+        x->headers = NULL;
+    }
+}
+
+static int transfer_begin(CURL *curl, transfer_t *x)
+{
+    int ret = 0;
+    CURLcode cc = 0;
+    scrap500_page_meta_t cached = { 0, };
+    char buf[256] = { 0, };
+
+    transfer_set_names(x);
+
+    memset((void *) &x->meta, 0, sizeof(x->meta));
+    x->meta.type = x->type;
+    x->meta.id = x->id;
+    x->headers = NULL;
+    x->retry_after = 0;
+    x->doc = NULL;
+    x->trim = scrap500_http_config.trim && !x->nosave;
+    x->raw_len = 0;
+    x->raw_crc = 0;
+
+    if (x->revalidate && scrap500_cache_has_page(x->type, x->id)
+        && 0 == scrap500_index_lookup(x->type, x->id, &cached)) {
+        if (cached.etag[0]) {
+            snprintf(buf, sizeof(buf), "If-None-Match: %s", cached.etag);
+            x->headers = curl_slist_append(x->headers, buf);
+        }
+
+        if (cached.last_modified[0]) {
+            snprintf(buf, sizeof(buf), "If-Modified-Since: %s",
+                                       cached.last_modified);
+            x->headers = curl_slist_append(x->headers, buf);
+        }
+    }
+
+    if (!x->nosave && scrap500_pack_active()) {
+        x->cw = scrap500_cache_create_buffer(scrap500_http_config.compress);
+        if (!x->cw) {
+            ret = ENOMEM;
+            goto out;
+        }
+    }
+    else if (!x->nosave) {
+        x->cw = scrap500_cache_create(x->tmpname,
+                                      scrap500_http_config.compress);
+        if (!x->cw) {
+            ret = errno;
+            fprintf(stderr, "failed to create a file %s: %s\n",
+                            x->tmpname, strerror(ret));
+            goto out;
+        }
+    }
+
+    if (x->parse || x->trim) {
+        x->parser = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, x->url,
+                                             XML_CHAR_ENCODING_NONE);
+        if (!x->parser) {
+            fprintf(stderr, "failed to create a parser for %s\n", x->url);
+            ret = ENOMEM;
+            goto out;
+        }
+
+        htmlCtxtUseOptions(x->parser, SCRAP500_PARSER_OPTS);
+    }
+
+    cc = curl_easy_setopt(curl, CURLOPT_URL, x->url);
+    cc |= curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, transfer_write_cb);
+    cc |= curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) x);
+    cc |= curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, transfer_header_cb);
+    cc |= curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) x);
+    cc |= curl_easy_setopt(curl, CURLOPT_HTTPHEADER, x->headers);
+    /* any encoding libcurl can decode, the callbacks see the plain page */
+    cc |= curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    if (cc != CURLE_OK) {
+        fprintf(stderr, "curl error: %s\n", curl_easy_strerror(cc));
+        ret = EIO;
+    }
+
+out:
+    if (ret)
+        transfer_cleanup(x);
+
+    return ret;
+}
+
+/*
+ * transient failures worth retrying: the server or the network may recover.
+ */
+static inline int curl_error_retryable(CURLcode cc)
+{
+    switch (cc) {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static inline uint64_t get_retry_after(CURL *curl)
+{
+    curl_off_t retry_after = 0;
+
+#if LIBCURL_VERSION_NUM >= 0x074200
+    curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+#endif
+
+    return retry_after > 0 ? (uint64_t) retry_after : 0;
+}
+
+/*
+ * the parsers only read the content div of a page, so that is all a trimmed
+ * page keeps. the page is parsed while it arrives, and the content is written
+ * out once it is complete.
+ */
+static int transfer_trim(transfer_t *x)
+{
+    int ret = 0;
+    size_t len = 0;
+    char *buf = NULL;
+
+    htmlParseChunk(x->parser, NULL, 0, 1);
+    x->doc = x->parser->myDoc;
+    x->parser->myDoc = NULL;
+    htmlFreeParserCtxt(x->parser);
+    x->parser = NULL;
+
+    ret = scrap500_parser_trim_doc(x->doc, x->raw_len, x->raw_crc,
+                                   &buf, &len);
+    if (ret)
+        goto out;
+
+    ret = scrap500_cache_write(x->cw, buf, len);
+    free(buf);
+
+out:
+    if (!x->parse && x->doc) {
+        xmlFreeDoc(x->doc);
+        x->doc = NULL;
+    }
+
+    return ret;
+}
+
+/*
+ * completes the transfer and feeds the outcome to the rate limiter. returns
+ * 0 on success, EAGAIN if the page should be retried later, ENOENT if the
+ * server does not have the page (no point in retrying), or any other error
+ * that should stop the whole crawl, e.g., failing to write the cache.
+ */
+static int transfer_end(CURL *curl, transfer_t *x, CURLcode cc)
+{
+    int ret = 0;
+    int rc = 0;
+    long http_rc = 0;
+    size_t page_len = 0;
+    char *page = NULL;
+    curl_off_t size = 0;
+    scrap500_page_meta_t old = { 0, };
+    scrap500_page_meta_t *meta = &x->meta;
+
+    if (cc != CURLE_OK) {
+        fprintf(stderr, "curl processing failed for %s: %s\n",
+                        x->url, curl_easy_strerror(cc));
+
+        if (cc == CURLE_OPERATION_TIMEDOUT)
+            limiter_backoff(0);
+
+        ret = curl_error_retryable(cc) ? EAGAIN : EIO;
+        goto out;
+    }
+
+    record_response_time(curl);
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_rc);
+
+    if (x->trim && x->cw && http_rc == 200) {
+        rc = transfer_trim(x);
+        if (rc) {
+            ret = rc;
+            fprintf(stderr, "failed to trim %s: %s\n",
+                            x->url, strerror(ret));
+            goto out;
+        }
+    }
+
+    if (x->cw && scrap500_pack_active()) {
+        if (http_rc == 200)
+            rc = scrap500_cache_take(x->cw, &page, &page_len, meta);
+        else
+            scrap500_cache_abort(x->cw);
+        x->cw = NULL;
+        if (rc) {
+            ret = rc;
+            fprintf(stderr, "failed to compress %s: %s\n",
+                            x->url, strerror(ret));
+            goto out;
+        }
+    }
+    else if (x->cw) {
+        /* the page must be on disk before it is renamed into place */
+        rc = scrap500_cache_close(x->cw, http_rc == 200, meta);
+        x->cw = NULL;
+        if (rc) {
+            ret = rc;
+            fprintf(stderr, "failed to write %s: %s\n",
+                            x->tmpname, strerror(ret));
+            unlink(x->tmpname);
+            goto out;
+        }
+
+        if (http_rc != 200)
+            unlink(x->tmpname);
+    }
+
+    if (http_rc == 304) {
+        /* the cached copy is still current */
+        if (x->parse)
+            x->doc = scrap500_cache_read_page(x->type, x->id);
+
+        limiter_success();
+        __atomic_add_fetch(&n_not_modified, 1, __ATOMIC_RELAXED);
+        scrap500_journal_record(SCRAP500_JOURNAL_COMPLETED, x->type, x->id);
+
+        if (0 == scrap500_index_lookup(x->type, x->id, meta)) {
+            meta->fetched = time(NULL);
+            scrap500_index_update(meta);
+        }
+        goto out;
+    }
+
+    if (http_rc != 200) {
+        fprintf(stderr, "curl failed (%s): HTTP status code=%ld\n",
+                        x->url, http_rc);
+
+        switch (http_rc) {
+        case 429:
+        case 503:
+        case 504:
+            x->retry_after = get_retry_after(curl);
+            limiter_backoff(x->retry_after);
+            ret = EAGAIN;
+            break;
+        case 500:
+        case 502:
+            ret = EAGAIN;
+            break;
+        default:
+            ret = ENOENT;
+            break;
+        }
+        goto out;
+    }
+
+    if (x->parser) {
+        htmlParseChunk(x->parser, NULL, 0, 1);
+        x->doc = x->parser->myDoc;
+        x->parser->myDoc = NULL;
+    }
+
+    limiter_success();
+    __atomic_add_fetch(&n_fetched, 1, __ATOMIC_RELAXED);
+
+    if (x->nosave)
+        goto out;   /* nothing cached, nothing to index */
+
+    if (page) {
+        ret = scrap500_pack_append(x->type, x->id, page, page_len);
+        if (ret) {
+            fprintf(stderr, "failed to append %s to the pack: %s\n",
+                            x->url, strerror(ret));
+            goto out;
+        }
+
+        /* the loose copy from before the pack is stale now */
+        unlink(x->filename);
+    }
+    else if (rename(x->tmpname, x->filename) < 0) {
+        ret = errno;
+        fprintf(stderr, "failed to rename %s: %s\n",
+                        x->tmpname, strerror(ret));
+        unlink(x->tmpname);
+        goto out;
+    }
+
+    scrap500_journal_record(SCRAP500_JOURNAL_COMPLETED, x->type, x->id);
+
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &size);
+    meta->size = (uint64_t) size;
+    meta->fetched = time(NULL);
+
+    /* an unchanged page need not be ingested again */
+    if (0 == scrap500_index_lookup(x->type, x->id, &old)
+        && old.stored == meta->stored && old.crc == meta->crc)
+        meta->status = old.status;
+
+    /* a stale index entry only costs a full download next time */
+    scrap500_index_update(meta);
+
+out:
+    if (page)
+        free(page);
+    transfer_cleanup(x);
+    return ret;
+}
+
+static void report_transfers(const char *what)
+{
+    if (scrap500_http_config.quiet) {
+        n_fetched = n_not_modified = n_retried = n_failed = n_hedged = 0;
+        return;
+    }
+
+    printf("## %s: %llu pages downloaded, %llu not modified, "
+           "%llu retried, %llu failed, %llu hedged (%llu requests/sec)\n",
+           what,
+           _llu(__atomic_exchange_n(&n_fetched, 0, __ATOMIC_RELAXED)),
+           _llu(__atomic_exchange_n(&n_not_modified, 0, __ATOMIC_RELAXED)),
+           _llu(__atomic_exchange_n(&n_retried, 0, __ATOMIC_RELAXED)),
+           _llu(__atomic_exchange_n(&n_failed, 0, __ATOMIC_RELAXED)),
+           _llu(__atomic_exchange_n(&n_hedged, 0, __ATOMIC_RELAXED)),
+           _llu(limiter_rate()));
+}
+
+/*
+ * adds the ids of all cached pages in <datadir>/<type> to the set (if given),
+ * with a single pass over the directory, and those in the pack. partial
+ * downloads (*.tmp) left behind by a crashed run are removed on the way.
+ */
+static int scan_cache_dir(int type, scrap500_idset_t *cached)
 {
-    int i = 0;
-    char *url = NULL;
-    FILE *fp = NULL;
+    int ret = 0;
+    uint64_t id = 0;
+    char *pos = NULL;
+    DIR *dirp = NULL;
+    struct dirent *dp = NULL;
+    char path[PATH_MAX] = { 0, };
+
+    sprintf(path, "%s/%s", scrap500_datadir, page_names[type]);
+
+    dirp = opendir(path);
+    if (!dirp) {
+        fprintf(stderr, "cannot open the directory %s: %s\n",
+                        path, strerror(errno));
+        return errno;
+    }
+
+    while ((dp = readdir(dirp)) != NULL) {
+        if (dp->d_name[0] == '.')
+            continue;
+
+        pos = strrchr(dp->d_name, '.');
+        if (pos && 0 == strcmp(pos, ".tmp")) {
+            sprintf(path, "%s/%s/%s",
+                          scrap500_datadir, page_names[type], dp->d_name);
+            unlink(path);
+            continue;
+        }
+
+        if (!cached)
+            continue;
+
+        id = strtoull(dp->d_name, &pos, 10);
+        if (strcmp(pos, ".html"))
+            continue;
+
+        ret = scrap500_idset_add(cached, id);
+        if (ret == ENOMEM)
+            break;
+
+        ret = 0;
+    }
+
+    closedir(dirp);
+
+    if (!ret && cached)
+        ret = scrap500_pack_ids(type, cached);
+
+    return ret;
+}
+
+/*
+ * list pages of all requested lists are fetched through a single multi handle.
+ * the pages are queued up front and at most max_inflight of them are in
+ * flight at a time. once all five pages of a list arrive, the list is handed
+ * to the caller's callback, e.g., for parsing, while the rest keep going.
+ * pages that failed transiently wait in a retry queue until their backoff
+ * expires, and a list with a page that could not be fetched at all is skipped.
+ * in the stream mode, each page is parsed into the list while it arrives and
+ * marked in list->streamed. the pages that were not, e.g., those skipped when
+ * resuming a crawl, are left for the callback to parse from the cache.
+ */
+struct _list_page {
+    uint32_t idx;       /* index of the list in the given array */
+    int page;           /* 0..4 */
+    CURL *curl;         /* set while the page is in flight */
+    transfer_t *xfer;
+    int attempts;
+    uint64_t not_before;    /* ms, when queued for a retry */
+};
+
+typedef struct _list_page list_page_t;
+
+static inline uint64_t list_page_id(scrap500_list_t *list, int page)
+{
+    return scrap500_list_page_id(list->id, page + 1);
+}
+
+/*
+ * returns 1 if the interrupted crawl has already fetched the page.
+ */
+static int list_page_done(scrap500_list_t *list, int page)
+{
+    uint64_t id = list_page_id(list, page);
+
+    if (!scrap500_journal_done(SCRAP500_PAGE_LIST, id))
+        return 0;
+
+    return scrap500_cache_has_page(SCRAP500_PAGE_LIST, id);
+}
+
+static CURL *prepare_list_page(scrap500_list_t *list, list_page_t *lp)
+{
+    int ret = 0;
     CURL *curl = NULL;
-    CURLcode cc = 0;
+    transfer_t *xfer = NULL;
+
+    xfer = calloc(1, sizeof(*xfer));
+    curl = get_handle();
+    if (!xfer || !curl) {
+        fprintf(stderr, "curl init failed for list %u\n", list->id);
+        goto out_fail;
+    }
+
+    /* list pages are always fetched, revalidating the cached copy */
+    xfer->type = SCRAP500_PAGE_LIST;
+    xfer->id = list_page_id(list, lp->page);
+    xfer->revalidate = 1;
+    xfer->parse = scrap500_http_config.stream;
+    xfer->nosave = scrap500_http_config.stream && scrap500_http_config.nosave;
+
+    ret = transfer_begin(curl, xfer);
+    if (ret)
+        goto out_fail;
+
+    sprintf(list->url[lp->page], "%s", xfer->url);
+
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *) lp);
+    lp->curl = curl;
+    lp->xfer = xfer;
+
+    return curl;
+
+out_fail:
+    if (curl)
+        put_handle(curl);
+    if (xfer)
+        free(xfer);
+
+    return NULL;
+}
 
-    for (i = 0; i < 5; i++) {
-        curl = curl_easy_init();
+static inline void finish_list_page(list_page_t *lp)
+{
+    if (lp->xfer) {
+        transfer_cleanup(lp->xfer);
+        if (lp->xfer->doc)
+            xmlFreeDoc(lp->xfer->doc);
+        free(lp->xfer);
+    }
+
+    if (lp->curl)
+        put_handle(lp->curl);
+
+    lp->xfer = NULL;
+    lp->curl = NULL;
+}
+
+/*
+ * returns the next page to dispatch, a retry whose backoff has expired first,
+ * without dequeueing it. if none is ready, *delay is set to how long (ms) to
+ * wait for the earliest retry, or UINT64_MAX if there are no more pages.
+ */
+static list_page_t *peek_list_page(list_page_t *pages, uint32_t n_pages,
+                                   uint32_t next, list_page_t **retry,
+                                   uint32_t n_retry, uint32_t *pos,
+                                   uint64_t *delay)
+{
+    uint32_t i = 0;
+    uint64_t now = now_ms();
+    uint64_t earliest = UINT64_MAX;
 
-        fp = list->tmpfp[i];
-        url = list->url[i];
-        sprintf(url, "https://www.top500.org/list/%d/%d/?page=%d",
-                     list->id/100, list->id%100, i+1);
+    *delay = 0;
 
-        cc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) fp);
-        cc |= curl_easy_setopt(curl, CURLOPT_URL, url);
-        if (cc != CURLE_OK) {
-            fprintf(stderr, "## curl processing failed: %s\n",
-                            curl_easy_strerror(cc));
-            return;
+    for (i = 0; i < n_retry; i++) {
+        if (retry[i]->not_before <= now) {
+            *pos = i;
+            return retry[i];
         }
 
-        curl_multi_add_handle(cm, curl);
+        if (retry[i]->not_before < earliest)
+            earliest = retry[i]->not_before;
     }
+
+    if (next < n_pages) {
+        *pos = n_retry;
+        return &pages[next];
+    }
+
+    *delay = n_retry ? earliest - now : UINT64_MAX;
+
+    return NULL;
 }
 
-int scrap500_http_fetch_list(scrap500_list_t *list)
+int scrap500_http_fetch_lists(scrap500_list_t *lists, uint32_t n_lists,
+                              scrap500_list_cb_t cb, void *cb_data)
 {
     int ret = 0;
-    int still_running = 0;
+    int rc = 0;
     int len = 0;
-    int repeats = 0;
-    int http_rc = 0;
-    CURLM *cm = NULL;
+    int max_inflight = 0;
+    int max_retries = 0;
+    int inflight = 0;
+    uint32_t i = 0;
+    uint32_t n_pages = 0;
+    uint32_t n_queued = 0;
+    uint32_t next = 0;
+    uint32_t n_retry = 0;
+    uint32_t n_given_up = 0;
+    uint32_t pos = 0;
+    uint64_t delay = 0;
+    uint64_t retry_after = 0;
+    int *remaining = NULL;
+    list_page_t *pages = NULL;
+    list_page_t **retry = NULL;
+    list_page_t *lp = NULL;
+    scrap500_list_t *list = NULL;
+    reactor_t reactor = { 0, };
     CURL *curl = NULL;
     CURLcode cc = 0;
     CURLMsg *msg = NULL;
 
-    if (!list)
+    if (!lists)
         return EINVAL;
 
-    cm = curl_multi_init();
+    max_inflight = scrap500_http_config.max_inflight;
+    if (max_inflight < 1)
+        max_inflight = 1;
 
-    prepare_list(cm, list);
+    max_retries = scrap500_http_config.max_retries;
 
-    curl_multi_perform(cm, &still_running);
+    n_pages = 5*n_lists;
+    pages = calloc(n_pages, sizeof(*pages));
+    retry = calloc(n_pages, sizeof(*retry));
+    remaining = calloc(n_lists, sizeof(*remaining));
+    if (!pages || !retry || !remaining) {
+        perror("failed to allocate memory");
+        ret = ENOMEM;
+        goto out_free;
+    }
 
-    while (still_running) {
-        CURLMcode mc = 0;
-        int numfds = 0;
+    for (i = 0; i < n_pages; i++) {
+        pages[i].idx = i/5;
+        pages[i].page = i%5;
+    }
 
-        mc = curl_multi_wait(cm, NULL, 0, 1000, &numfds);
-        if (mc != CURLM_OK) {
-            fprintf(stderr, "curl multi processing failed: %d\n", mc);
-            break;
-        }
+    for (i = 0; i < n_lists; i++)
+        remaining[i] = 5;
+
+    scan_cache_dir(SCRAP500_PAGE_LIST, NULL);
 
-        if (!numfds) {
-            repeats++;
-            if (repeats > 1)
-                usleep(1e5);
+    /* skip the pages that the interrupted crawl has fetched already */
+    for (i = 0; i < n_pages; i++) {
+        lp = &pages[i];
+        list = &lists[lp->idx];
+
+        if (list_page_done(list, lp->page)) {
+            remaining[lp->idx]--;
+            continue;
         }
-        else
-            repeats = 0;
 
-        curl_multi_perform(cm, &still_running);
+        pages[n_queued++] = *lp;
+        scrap500_journal_record(SCRAP500_JOURNAL_PENDING, SCRAP500_PAGE_LIST,
+                                list_page_id(list, lp->page));
+    }
+
+    for (i = 0; i < n_lists && cb; i++) {
+        if (remaining[i] == 0) {
+            ret = cb(&lists[i], cb_data);
+            if (ret) {
+                fprintf(stderr, "failed to process list %u\n", lists[i].id);
+                goto out_free;
+            }
+        }
     }
 
-    while (NULL != (msg = curl_multi_info_read(cm, &len))) {
-        if (msg->msg == CURLMSG_DONE) {
+    n_pages = n_queued;
+
+    ret = reactor_init(&reactor, scrap500_http_config.loop);
+    if (ret)
+        goto out_free;
+
+    do {
+        delay = 0;
+
+        while (!ret && inflight < max_inflight) {
+            lp = peek_list_page(pages, n_pages, next, retry, n_retry,
+                                &pos, &delay);
+            if (!lp)
+                break;
+
+            delay = limiter_take();
+            if (delay)
+                break;
+
+            if (pos < n_retry)
+                retry[pos] = retry[--n_retry];
+            else
+                next++;
+
+            curl = prepare_list_page(&lists[lp->idx], lp);
+            if (!curl) {
+                ret = EIO;
+                break;
+            }
+
+            reactor_add(&reactor, curl);
+            inflight++;
+        }
+
+        while (NULL != (msg = curl_multi_info_read(reactor.cm, &len))) {
+            if (msg->msg != CURLMSG_DONE) {
+                fprintf(stderr, "curl multi processing error (msg=%d)\n",
+                                msg->msg);
+                continue;
+            }
+
             curl = msg->easy_handle;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &lp);
+            list = &lists[lp->idx];
 
             cc = msg->data.result;
-            if (cc != CURLE_OK) {
-                fprintf(stderr, "curl handle failed: %s\n",
-                                curl_easy_strerror(cc));
-                ret = EIO;
+            reactor_remove(&reactor, curl);
+
+            rc = transfer_end(curl, lp->xfer, cc);
+            retry_after = lp->xfer->retry_after;
+
+            if (!rc && lp->xfer->parse) {
+                /* the page has been parsed while it arrived */
+                rc = lp->xfer->doc
+                     ? scrap500_parser_parse_list_doc(list, lp->xfer->doc)
+                     : EIO;
+                if (rc)
+                    fprintf(stderr, "failed to parse page %d of list %u\n",
+                                    lp->page + 1, list->id);
+                else
+                    list->streamed |= 1 << lp->page;
             }
 
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_rc);
+            finish_list_page(lp);
+            inflight--;
 
-            if (http_rc != 200) {
-                fprintf(stderr, "curl failed: HTTP status code=%d\n", http_rc);
-                ret = EIO;
+            if (rc == EAGAIN && lp->attempts < max_retries) {
+                lp->not_before = now_ms()
+                                 + retry_delay(lp->attempts, retry_after);
+                lp->attempts++;
+                retry[n_retry++] = lp;
+                __atomic_add_fetch(&n_retried, 1, __ATOMIC_RELAXED);
+
+                delay = 0;  /* look at the retry queue again */
+                continue;
+            }
+            else if (rc == EAGAIN || rc == ENOENT) {
+                fprintf(stderr, "giving up on page %d of list %u\n",
+                                lp->page + 1, list->id);
+                __atomic_add_fetch(&n_failed, 1, __ATOMIC_RELAXED);
+                scrap500_journal_record(SCRAP500_JOURNAL_FAILED,
+                                        SCRAP500_PAGE_LIST,
+                                        list_page_id(list, lp->page));
+                n_given_up++;
+
+                /* the list is incomplete, never hand it to the callback */
+                remaining[lp->idx] = -1;
+                continue;
+            }
+            else if (rc && !ret)
+                ret = rc;
+
+            if (ret || remaining[lp->idx] < 0)
+                continue;
+
+            remaining[lp->idx]--;
+            if (remaining[lp->idx] == 0 && cb) {
+                ret = cb(list, cb_data);
+                if (ret)
+                    fprintf(stderr, "failed to process list %u\n", list->id);
             }
         }
-        else
-            fprintf(stderr, "curl multi processing error (msg=%d)\n",
-                            msg->msg);
 
-        curl_multi_remove_handle(cm, curl);
-        curl_easy_cleanup(curl);
+        if (!inflight && (ret || (next == n_pages && !n_retry)))
+            break;
 
-        if (ret)
+        if (!ret && inflight < max_inflight && !delay)
+            continue;   /* completions made room, dispatch before waiting */
+
+        if (!inflight) {
+            /* nothing to wait for but the limiter or a backoff */
+            usleep(1000*delay);
+            continue;
+        }
+
+        rc = reactor_wait(&reactor, delay && delay != UINT64_MAX ?
+                                    (long) delay : -1);
+        if (rc) {
+            ret = rc;
             break;
+        }
+    } while (1);
+
+    /* abandon whatever is still in flight after an error */
+    for (i = 0; i < next; i++) {
+        lp = &pages[i];
+        if (!lp->curl)
+            continue;
+
+        reactor_remove(&reactor, lp->curl);
+        finish_list_page(lp);
     }
 
-out:
-    curl_multi_cleanup(cm);
+    reactor_exit(&reactor);
+
+    report_transfers("lists");
+
+    if (!ret && n_given_up) {
+        fprintf(stderr, "failed to fetch %u list pages\n", n_given_up);
+        ret = EIO;
+    }
+
+out_free:
+    if (remaining)
+        free(remaining);
+    if (retry)
+        free(retry);
+    if (pages)
+        free(pages);
 
     return ret;
 }
 
-struct _worker_data {
-    int range;
-    scrap500_list_t *list;
+/*
+ * site and system pages are fetched by a pool of worker threads. the jobs are
+ * the pages missing from the cache, or all referenced pages when refreshing
+ * (see build_frontier()), and the workers pull the next job from the shared
+ * queue until it drains or one of them fails. a page that failed transiently
+ * is put back in a retry queue with a backoff, and one that keeps failing is
+ * given up on without stopping the others.
+ */
+struct _fetch_job {
+    int type;           /* SCRAP500_PAGE_SITE or SCRAP500_PAGE_SYSTEM */
+    uint64_t id;
+    int attempts;
+    uint64_t not_before;    /* ms, when queued for a retry */
+};
+
+typedef struct _fetch_job fetch_job_t;
+
+struct _fetch_pool {
+    pthread_mutex_t lock;
+    fetch_job_t *jobs;
+    uint64_t n_jobs;
+    uint64_t next;
+    fetch_job_t **retry;
+    uint64_t n_retry;
+    uint64_t active;        /* jobs being fetched, which may come back */
+    uint64_t n_given_up;
+    int error;
 };
 
-typedef struct _worker_data worker_data_t;
+typedef struct _fetch_pool fetch_pool_t;
 
-static void *site_fetch_func(void *_data)
+/*
+ * returns the next job, or NULL with *wait set to how long (ms) to sleep
+ * before asking again. NULL with *wait 0 means that all jobs are done.
+ */
+static fetch_job_t *fetch_pool_next(fetch_pool_t *pool, uint64_t *wait)
+{
+    uint64_t i = 0;
+    uint64_t now = now_ms();
+    uint64_t earliest = UINT64_MAX;
+    fetch_job_t *job = NULL;
+
+    *wait = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->error)
+        goto out;
+
+    for (i = 0; i < pool->n_retry; i++) {
+        if (pool->retry[i]->not_before <= now) {
+            job = pool->retry[i];
+            pool->retry[i] = pool->retry[--pool->n_retry];
+            goto out;
+        }
+
+        if (pool->retry[i]->not_before < earliest)
+            earliest = pool->retry[i]->not_before;
+    }
+
+    if (pool->next < pool->n_jobs)
+        job = &pool->jobs[pool->next++];
+    else if (pool->n_retry)
+        *wait = earliest - now;
+    else if (pool->active)
+        *wait = 100;    /* the jobs in flight may be retried */
+
+out:
+    if (job)
+        pool->active++;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return job;
+}
+
+static void fetch_pool_done(fetch_pool_t *pool, fetch_job_t *job,
+                            int error, uint64_t retry_after)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->active--;
+
+    if (error == EAGAIN && job->attempts < scrap500_http_config.max_retries) {
+        job->not_before = now_ms() + retry_delay(job->attempts, retry_after);
+        job->attempts++;
+        pool->retry[pool->n_retry++] = job;
+        __atomic_add_fetch(&n_retried, 1, __ATOMIC_RELAXED);
+    }
+    else if (error == EAGAIN || error == ENOENT) {
+        fprintf(stderr, "giving up on %s %llu\n",
+                        page_names[job->type], _llu(job->id));
+        __atomic_add_fetch(&n_failed, 1, __ATOMIC_RELAXED);
+        scrap500_journal_record(SCRAP500_JOURNAL_FAILED, job->type, job->id);
+        pool->n_given_up++;
+    }
+    else if (error && !pool->error)
+        pool->error = error;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void fetch_pool_fail(fetch_pool_t *pool, int error)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    if (!pool->error)
+        pool->error = error;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * each worker owns two handles and transfers: the request, and its duplicate
+ * when hedging. with hedging, the request is driven through the worker's own
+ * multi handle, so that the duplicate can be added while it is in flight.
+ */
+struct _fetch_worker {
+    fetch_pool_t *pool;
+    CURLM *cm;                  /* only when hedging */
+    CURL *curl[2];
+    transfer_t xfer[2];
+};
+
+typedef struct _fetch_worker fetch_worker_t;
+
+/*
+ * runs the request of w->xfer[0] like curl_easy_perform(). once it has taken
+ * longer than the 95th percentile of the response times so far, the same page
+ * is requested once more, and whichever response completes first is kept while
+ * the other is cancelled. returns the index of the winner, whose result is in
+ * *cc, or -1 on a multi handle error.
+ */
+static int fetch_hedged(fetch_worker_t *w, CURLcode *cc)
 {
-    int ret = 0;
     int i = 0;
-    int fd = 0;
-    FILE *fp = NULL;
-    worker_data_t *data = (worker_data_t *) _data;
-    int range = data->range;
-    scrap500_list_t *list = data->list;
-    scrap500_rank_t *rank = NULL;
-    char filename[PATH_MAX] = { 0, };
-    CURL *curl = NULL;
-    CURLcode cc = 0;
+    int n = 0;
+    int running = 0;
+    int winner = -1;
+    int inflight[2] = { 1, 0 };
+    uint64_t start = now_ms();
+    uint64_t elapsed = 0;
+    uint64_t after = __atomic_load_n(&hedge_after, __ATOMIC_RELAXED);
+    long timeout = 0;
+    transfer_t *hx = &w->xfer[1];
+    CURLMsg *msg = NULL;
+    CURLMcode mc = 0;
+
+    curl_multi_add_handle(w->cm, w->curl[0]);
+
+    while (winner < 0) {
+        mc = curl_multi_perform(w->cm, &running);
+        if (mc != CURLM_OK)
+            break;
+
+        while (winner < 0
+               && NULL != (msg = curl_multi_info_read(w->cm, &n))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
 
-//    for (i = range*100; i < range*100+100; i++) {
-    for (i = 0; i < 500; i++) {
-        rank = &list->rank[i];
-        scrap500_site_html_filename(rank->site_id, filename);
+            i = msg->easy_handle == w->curl[0] ? 0 : 1;
+            inflight[i] = 0;
 
-        fd = open(filename, O_RDWR|O_CREAT|O_EXCL, 0644);
-        if (fd < 0) {
-            if (errno == EEXIST)
+            /* a failed request still has the other one to wait for */
+            if (msg->data.result != CURLE_OK && inflight[!i]) {
+                curl_multi_remove_handle(w->cm, w->curl[i]);
+                transfer_cleanup(&w->xfer[i]);
                 continue;
-            else {
-                fprintf(stderr, "failed to create a file %s: %s\n",
-                                filename, strerror(errno));
-                goto out;
             }
-        }
 
-        fp = fdopen(fd, "w");
-        if (!fp) {
-            fprintf(stderr, "failed to open file %s: %s\n",
-                            filename, strerror(errno));
-            goto out;
+            winner = i;
+            *cc = msg->data.result;
         }
 
-        curl = curl_easy_init();
-        if (!curl) {
-            fprintf(stderr, "curl init failed for %s\n", filename);
-            goto out;
-        }
+        if (winner >= 0 || (!inflight[0] && !inflight[1]))
+            break;
 
-        sprintf(filename, "https://www.top500.org/site/%llu",
-                          _llu(rank->site_id));
-        printf("downloading.. %s\n", filename);
+        elapsed = now_ms() - start;
 
-        cc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) fp);
-        cc |= curl_easy_setopt(curl, CURLOPT_URL, filename);
-        if (cc != CURLE_OK) {
-            fprintf(stderr, "curl error: %s\n", curl_easy_strerror(cc));
-            goto out;
-        }
+        if (after && inflight[0] && !hx->url[0] && elapsed >= after
+            && 0 == limiter_take()) {
+            hx->type = w->xfer[0].type;
+            hx->id = w->xfer[0].id;
+            hx->revalidate = w->xfer[0].revalidate;
+            hx->hedge = 1;
 
-        cc = curl_easy_perform(curl);
-        if (cc != CURLE_OK) {
-            fprintf(stderr, "curl processing failed for %s: %s\n",
-                            filename, curl_easy_strerror(cc));
-            goto out;
+            if (0 == transfer_begin(w->curl[1], hx)) {
+                curl_multi_add_handle(w->cm, w->curl[1]);
+                inflight[1] = 1;
+                __atomic_add_fetch(&n_hedged, 1, __ATOMIC_RELAXED);
+                continue;
+            }
         }
 
-        if (curl)
-            curl_easy_cleanup(curl);
+        /* wake up in time to hedge, or to take a token for it */
+        timeout = 1000;
+        if (after && !hx->url[0])
+            timeout = elapsed < after ? (long) (after - elapsed) : 10;
 
-        fclose(fp);
+        mc = curl_multi_wait(w->cm, NULL, 0, (int) timeout, NULL);
+        if (mc != CURLM_OK)
+            break;
     }
 
-out:
-    return NULL;
+    if (mc != CURLM_OK)
+        fprintf(stderr, "curl multi error: %s\n", curl_multi_strerror(mc));
+
+    for (i = 0; i < 2; i++) {
+        curl_multi_remove_handle(w->cm, w->curl[i]);
+        if (i != winner)
+            transfer_cleanup(&w->xfer[i]);
+    }
+
+    return winner;
 }
 
-static void *system_fetch_func(void *_data)
+static int fetch_page(fetch_worker_t *w, fetch_job_t *job)
 {
     int ret = 0;
     int i = 0;
-    int fd = 0;
-    FILE *fp = NULL;
-    worker_data_t *data = (worker_data_t *) _data;
-    int range = data->range;
-    scrap500_list_t *list = data->list;
-    scrap500_rank_t *rank = NULL;
-    char filename[PATH_MAX] = { 0, };
-    CURL *curl = NULL;
+    uint64_t wait = 0;
     CURLcode cc = 0;
+    transfer_t *xfer = &w->xfer[0];
 
-//    for (i = range*100; i < range*100+100; i++) {
-    for (i = 0; i < 500; i++) {
-        rank = &list->rank[i];
-        scrap500_system_html_filename(rank->system_id, filename);
+    memset((void *) w->xfer, 0, sizeof(w->xfer));
+    xfer->type = job->type;
+    xfer->id = job->id;
+    xfer->revalidate = scrap500_http_config.refresh;
 
-        fd = open(filename, O_RDWR|O_CREAT|O_EXCL, 0644);
-        if (fd < 0) {
-            if (errno == EEXIST)
-                continue;
-            else {
-                fprintf(stderr, "failed to create a file %s: %s\n",
-                                filename, strerror(errno));
-                goto out;
-            }
-        }
+    ret = transfer_begin(w->curl[0], xfer);
+    if (ret)
+        return ret;
 
-        fp = fdopen(fd, "w");
-        if (!fp) {
-            fprintf(stderr, "failed to open file %s: %s\n",
-                            filename, strerror(errno));
-            goto out;
-        }
+    while ((wait = limiter_take()) > 0)
+        usleep(1000*wait);
 
-        curl = curl_easy_init();
-        if (!curl) {
-            fprintf(stderr, "curl init failed for %s\n", filename);
-            goto out;
-        }
+    if (!scrap500_http_config.quiet)
+        printf("downloading.. %s\n", xfer->url);
 
-        sprintf(filename, "https://www.top500.org/system/%llu",
-                          _llu(rank->system_id));
-        printf("downloading.. %s\n", filename);
+    if (!w->cm) {
+        cc = curl_easy_perform(w->curl[0]);
+        return transfer_end(w->curl[0], xfer, cc);
+    }
 
-        cc = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) fp);
-        cc |= curl_easy_setopt(curl, CURLOPT_URL, filename);
-        if (cc != CURLE_OK) {
-            fprintf(stderr, "curl error: %s\n", curl_easy_strerror(cc));
-            goto out;
+    i = fetch_hedged(w, &cc);
+    if (i < 0)
+        return EIO;
+
+    ret = transfer_end(w->curl[i], &w->xfer[i], cc);
+    w->xfer[0].retry_after = w->xfer[i].retry_after;
+
+    return ret;
+}
+
+static void *fetch_worker_func(void *_data)
+{
+    int ret = 0;
+    int i = 0;
+    uint64_t wait = 0;
+    fetch_pool_t *pool = (fetch_pool_t *) _data;
+    fetch_job_t *job = NULL;
+    fetch_worker_t *w = NULL;
+
+    w = calloc(1, sizeof(*w));
+    if (!w) {
+        fetch_pool_fail(pool, ENOMEM);
+        return NULL;
+    }
+
+    w->pool = pool;
+    w->curl[0] = get_handle();
+    if (scrap500_http_config.hedge) {
+        w->curl[1] = get_handle();
+        w->cm = curl_multi_init();
+        if (!w->curl[1] || !w->cm)
+            ret = ENOMEM;
+    }
+
+    if (!w->curl[0] || ret) {
+        fprintf(stderr, "curl init failed\n");
+        fetch_pool_fail(pool, ENOMEM);
+        goto out;
+    }
+
+    while (1) {
+        job = fetch_pool_next(pool, &wait);
+        if (!job) {
+            if (!wait)
+                break;
+
+            usleep(1000*(wait < 100 ? wait : 100));
+            continue;
         }
 
-        cc = curl_easy_perform(curl);
-        if (cc != CURLE_OK) {
-            fprintf(stderr, "curl processing failed for %s: %s\n",
-                            filename, curl_easy_strerror(cc));
+        ret = fetch_page(w, job);
+        fetch_pool_done(pool, job, ret, w->xfer[0].retry_after);
+    }
+
+out:
+    if (w->cm)
+        curl_multi_cleanup(w->cm);
+    for (i = 0; i < 2; i++)
+        put_handle(w->curl[i]);
+    free(w);
+
+    return NULL;
+}
+
+/*
+ * builds the fetch frontier: the unique site and system ids referenced by the
+ * given lists that are not in the cache yet, or when refreshing, that have not
+ * been revalidated by this crawl yet. site and system pages of the same rank
+ * are queued next to each other.
+ */
+static int build_frontier(fetch_pool_t *pool,
+                          scrap500_list_t *lists, uint32_t n_lists)
+{
+    int ret = 0;
+    uint32_t i = 0;
+    int r = 0;
+    int t = 0;
+    uint64_t id = 0;
+    uint64_t n_refs = 0;
+    int refresh = scrap500_http_config.refresh;
+    scrap500_rank_t *rank = NULL;
+    scrap500_idset_t cached[2] = { { 0, }, };
+    scrap500_idset_t queued[2] = { { 0, }, };
+    const int types[2] = { SCRAP500_PAGE_SITE, SCRAP500_PAGE_SYSTEM };
+
+    for (t = 0; t < 2; t++) {
+        ret = scan_cache_dir(types[t], &cached[t]);
+        if (ret)
             goto out;
-        }
+    }
+
+    pool->jobs = calloc(2*500*(uint64_t) n_lists, sizeof(*pool->jobs));
+    pool->retry = calloc(2*500*(uint64_t) n_lists, sizeof(*pool->retry));
+    if (!pool->jobs || !pool->retry) {
+        perror("failed to allocate memory");
+        ret = ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < n_lists; i++) {
+        for (r = 0; r < 500; r++) {
+            rank = &lists[i].rank[r];
 
-        if (curl)
-            curl_easy_cleanup(curl);
+            for (t = 0; t < 2; t++) {
+                id = t == 0 ? rank->site_id : rank->system_id;
+                if (!id)
+                    continue;
 
-        fclose(fp);
+                n_refs++;
+
+                /* when refreshing, skip only what this crawl has revalidated */
+                if (scrap500_idset_has(&cached[t], id)
+                    && (!refresh || scrap500_journal_done(types[t], id)))
+                    continue;
+
+                ret = scrap500_idset_add(&queued[t], id);
+                if (ret == EEXIST)
+                    continue;
+                else if (ret)
+                    goto out;
+
+                pool->jobs[pool->n_jobs].type = types[t];
+                pool->jobs[pool->n_jobs].id = id;
+                pool->n_jobs++;
+
+                scrap500_journal_record(SCRAP500_JOURNAL_PENDING, types[t], id);
+            }
+        }
     }
 
+    ret = 0;
+
+    if (!scrap500_http_config.quiet)
+        printf("## %llu references to %llu sites and %llu systems, "
+               "%llu sites and %llu systems to %s\n",
+               _llu(n_refs),
+               _llu(refresh ? queued[0].count
+                            : cached[0].count + queued[0].count),
+               _llu(refresh ? queued[1].count
+                            : cached[1].count + queued[1].count),
+               _llu(queued[0].count), _llu(queued[1].count),
+               refresh ? "revalidate" : "fetch");
+
 out:
-    return NULL;
+    for (t = 0; t < 2; t++) {
+        scrap500_idset_free(&cached[t]);
+        scrap500_idset_free(&queued[t]);
+    }
+
+    return ret;
 }
 
-int scrap500_http_fetch_specs(scrap500_list_t *list)
+int scrap500_http_fetch_specs(scrap500_list_t *lists, uint32_t n_lists)
 {
     int ret = 0;
     int i = 0;
-#if 0
-    int nthreads = 5;
-    pthread_t workers[5];
-    worker_data_t data[5];
-#endif
-    worker_data_t data = { 0, };
+    int nthreads = 0;
+    pthread_t *workers = NULL;
+    fetch_pool_t pool = { 0, };
 
-    if (!list)
+    if (!lists)
         return EINVAL;
 
-    data.range = 0;
-    data.list = list;
-
-    site_fetch_func((void *) &data);
-    system_fetch_func((void *) &data);
+    nthreads = scrap500_http_config.nthreads;
+    if (nthreads < 1)
+        nthreads = 1;
 
-#if 0
-    for (i = 0; i < nthreads; i++) {
-        worker_data_t *d = &data[i];
-        d->range = i;
-        d->list = list;
+    workers = calloc(nthreads, sizeof(*workers));
+    if (!workers) {
+        perror("failed to allocate memory");
+        ret = ENOMEM;
+        goto out;
+    }
 
-        ret = pthread_create(&workers[i], NULL,
-                             site_fetch_func, (void *) d);
-        if (ret) {
-            perror("failed to create a site fetcher thread");
-            goto out;
-        }
+    ret = build_frontier(&pool, lists, n_lists);
+    if (ret) {
+        fprintf(stderr, "failed to build the fetch frontier\n");
+        goto out;
     }
 
-    for (i = 0; i < nthreads; i++)
-        ret = pthread_join(workers[i], NULL);
+    pthread_mutex_init(&pool.lock, NULL);
 
     for (i = 0; i < nthreads; i++) {
-        worker_data_t *d = &data[i];
-        d->range = i;
-        d->list = list;
-
         ret = pthread_create(&workers[i], NULL,
-                             system_fetch_func, (void *) d);
+                             fetch_worker_func, (void *) &pool);
         if (ret) {
-            perror("failed to create a site fetcher thread");
-            goto out;
+            perror("failed to create a fetcher thread");
+            fetch_pool_fail(&pool, ret);
+            break;
         }
     }
 
+    nthreads = i;
+
     for (i = 0; i < nthreads; i++)
-        ret = pthread_join(workers[i], NULL);
-#endif
+        pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&pool.lock);
+
+    report_transfers("specs");
+
+    ret = pool.error;
+    if (!ret && pool.n_given_up) {
+        fprintf(stderr, "failed to fetch %llu pages\n", _llu(pool.n_given_up));
+        ret = EIO;
+    }
 
 out:
+    if (workers)
+        free(workers);
+    if (pool.jobs)
+        free(pool.jobs);
+    if (pool.retry)
+        free(pool.retry);
+
     return ret;
 }
-
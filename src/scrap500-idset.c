@@ -0,0 +1,113 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * a set of site/system ids: open addressing with linear probing. id 0 is
+ * never a valid site or system id and marks empty slots.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scrap500.h"
+
+static inline uint64_t hash_id(uint64_t id)
+{
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+
+    return id;
+}
+
+static int idset_grow(scrap500_idset_t *set)
+{
+    uint64_t i = 0;
+    uint64_t pos = 0;
+    uint64_t size = set->size ? 2*set->size : 1024;
+    uint64_t *slots = NULL;
+
+    slots = calloc(size, sizeof(*slots));
+    if (!slots)
+        return ENOMEM;
+
+    for (i = 0; i < set->size; i++) {
+        if (!set->slots[i])
+            continue;
+
+        pos = hash_id(set->slots[i]) & (size - 1);
+        while (slots[pos])
+            pos = (pos + 1) & (size - 1);
+
+        slots[pos] = set->slots[i];
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->size = size;
+
+    return 0;
+}
+
+void scrap500_idset_free(scrap500_idset_t *set)
+{
+    if (set && set->slots)
+        free(set->slots);
+
+    if (set)
+        memset((void *) set, 0, sizeof(*set));
+}
+
+int scrap500_idset_has(scrap500_idset_t *set, uint64_t id)
+{
+    uint64_t pos = 0;
+
+    if (!id || !set->size)
+        return 0;
+
+    pos = hash_id(id) & (set->size - 1);
+
+    while (set->slots[pos]) {
+        if (set->slots[pos] == id)
+            return 1;
+
+        pos = (pos + 1) & (set->size - 1);
+    }
+
+    return 0;
+}
+
+int scrap500_idset_add(scrap500_idset_t *set, uint64_t id)
+{
+    int ret = 0;
+    uint64_t pos = 0;
+
+    if (!id)
+        return EINVAL;
+
+    if (2*(set->count + 1) > set->size) {
+        ret = idset_grow(set);
+        if (ret)
+            return ret;
+    }
+
+    pos = hash_id(id) & (set->size - 1);
+
+    while (set->slots[pos]) {
+        if (set->slots[pos] == id)
+            return EEXIST;
+
+        pos = (pos + 1) & (set->size - 1);
+    }
+
+    set->slots[pos] = id;
+    set->count++;
+
+    return 0;
+}
@@ -0,0 +1,366 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * the page index keeps the response metadata (etag, last-modified, size and
+ * fetch time) of every cached page in <datadir>/index.db, so that cached pages
+ * can be revalidated with conditional requests instead of downloaded again.
+ * it is shared by all fetcher threads and serialized with a mutex.
+ *
+ * it also serves as the manifest of the cache: the size and crc32 of each page
+ * as stored, to verify the cache, and whether scrap500-build has ingested it.
+ * a page fetched again with different content goes back to the new state.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "scrap500.h"
+
+static const char *index_schema =
+"create table if not exists page (\n"
+"    type integer not null,\n"
+"    id integer not null,\n"
+"    etag text,\n"
+"    last_modified text,\n"
+"    size integer,\n"
+"    fetched integer,\n"
+"    stored integer,\n"
+"    crc integer,\n"
+"    status integer not null default 0,\n"
+"    primary key(type, id)\n"
+");\n";
+
+/* the columns added to the indexes of older versions */
+static const char *index_upgrade[] = {
+    "alter table page add column stored integer;",
+    "alter table page add column crc integer;",
+    "alter table page add column status integer not null default 0;",
+};
+
+enum {
+    SQL_LOOKUP = 0,
+    SQL_UPDATE,
+    SQL_STATUS,
+    SQL_LIST,
+    SQL_LIST_PENDING,
+    N_SQLS,
+};
+
+static const char *sqlstr[] = {
+    /* lookup */
+    "select etag,last_modified,size,fetched,stored,crc,status from page\n"
+    "where type=? and id=?;\n",
+    /* update */
+    "insert or replace into page(type,id,etag,last_modified,size,fetched,\n"
+    "stored,crc,status)\n"
+    "values(?,?,?,?,?,?,?,?,?);\n",
+    /* status */
+    "update page set status=? where type=? and id=?;\n",
+    /* list */
+    "select id from page where type=? order by id;\n",
+    /* list_pending */
+    "select id from page where type=? and status!=1 order by id;\n",
+};
+
+/* commit the pending updates every this many updates */
+#define INDEX_COMMIT_INTERVAL   512
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static sqlite3 *index_db;
+static sqlite3_stmt *sqlstmts[N_SQLS];
+static uint64_t n_pending;
+
+static inline int exec_simple_sql(sqlite3 *dbconn, const char *sql)
+{
+    return sqlite3_exec(dbconn, sql, 0, 0, 0);
+}
+
+int scrap500_index_open(void)
+{
+    int ret = 0;
+    int i = 0;
+    char dbname[PATH_MAX] = { 0, };
+
+    sprintf(dbname, "%s/index.db", scrap500_datadir);
+
+    ret = sqlite3_open(dbname, &index_db);
+    if (ret != SQLITE_OK) {
+        fprintf(stderr, "failed to open the page index %s: %s\n",
+                        dbname, sqlite3_errstr(ret));
+        goto out_close;
+    }
+
+    ret = exec_simple_sql(index_db, "pragma synchronous=normal;");
+    ret |= exec_simple_sql(index_db, index_schema);
+    if (ret != SQLITE_OK) {
+        fprintf(stderr, "failed to initialize the page index: %s\n",
+                        sqlite3_errmsg(index_db));
+        goto out_close;
+    }
+
+    /* fails for the columns that are already there */
+    for (i = 0; i < (int) (sizeof(index_upgrade)/sizeof(index_upgrade[0]));
+         i++)
+        exec_simple_sql(index_db, index_upgrade[i]);
+
+    for (i = 0; i < N_SQLS; i++) {
+        ret = sqlite3_prepare_v2(index_db, sqlstr[i], -1, &sqlstmts[i], NULL);
+        if (ret != SQLITE_OK) {
+            fprintf(stderr, "failed to prepare sql: %s, error: %s\n",
+                            sqlstr[i], sqlite3_errmsg(index_db));
+            goto out_close;
+        }
+    }
+
+    exec_simple_sql(index_db, "begin transaction;");
+
+    return 0;
+
+out_close:
+    scrap500_index_close();
+    return EIO;
+}
+
+void scrap500_index_close(void)
+{
+    int i = 0;
+
+    if (!index_db)
+        return;
+
+    exec_simple_sql(index_db, "end transaction;");
+
+    for (i = 0; i < N_SQLS; i++) {
+        if (sqlstmts[i])
+            sqlite3_finalize(sqlstmts[i]);
+        sqlstmts[i] = NULL;
+    }
+
+    sqlite3_close(index_db);
+    index_db = NULL;
+}
+
+static inline void copy_column(sqlite3_stmt *stmt, int col,
+                               char *buf, size_t len)
+{
+    const char *str = (const char *) sqlite3_column_text(stmt, col);
+
+    snprintf(buf, len, "%s", __strprint(str));
+}
+
+int scrap500_index_lookup(int type, uint64_t id, scrap500_page_meta_t *meta)
+{
+    int ret = 0;
+    sqlite3_stmt *stmt = NULL;
+
+    if (!index_db)
+        return ENOENT;
+
+    pthread_mutex_lock(&index_lock);
+
+    stmt = sqlstmts[SQL_LOOKUP];
+
+    ret = sqlite3_bind_int(stmt, 1, type);
+    ret |= sqlite3_bind_int64(stmt, 2, id);
+    if (ret) {
+        fprintf(stderr, "failed to bind values: %s\n", sqlite3_errstr(ret));
+        ret = EIO;
+        goto out;
+    }
+
+    ret = sqlite3_step(stmt);
+    if (ret == SQLITE_ROW) {
+        meta->type = type;
+        meta->id = id;
+        copy_column(stmt, 0, meta->etag, sizeof(meta->etag));
+        copy_column(stmt, 1, meta->last_modified, sizeof(meta->last_modified));
+        meta->size = sqlite3_column_int64(stmt, 2);
+        meta->fetched = sqlite3_column_int64(stmt, 3);
+        meta->stored = sqlite3_column_int64(stmt, 4);
+        meta->crc = (uint32_t) sqlite3_column_int64(stmt, 5);
+        meta->status = sqlite3_column_int(stmt, 6);
+        ret = 0;
+    }
+    else if (ret == SQLITE_DONE)
+        ret = ENOENT;
+    else {
+        fprintf(stderr, "failed to look up the page index: %s\n",
+                        sqlite3_errmsg(index_db));
+        ret = EIO;
+    }
+
+out:
+    sqlite3_reset(stmt);
+    pthread_mutex_unlock(&index_lock);
+
+    return ret;
+}
+
+int scrap500_index_update(scrap500_page_meta_t *meta)
+{
+    int ret = 0;
+    sqlite3_stmt *stmt = NULL;
+
+    if (!index_db)
+        return 0;
+
+    pthread_mutex_lock(&index_lock);
+
+    stmt = sqlstmts[SQL_UPDATE];
+
+    ret = sqlite3_bind_int(stmt, 1, meta->type);
+    ret |= sqlite3_bind_int64(stmt, 2, meta->id);
+    ret |= sqlite3_bind_text(stmt, 3, meta->etag[0] ? meta->etag : NULL,
+                             -1, SQLITE_STATIC);
+    ret |= sqlite3_bind_text(stmt, 4,
+                             meta->last_modified[0] ? meta->last_modified
+                                                    : NULL,
+                             -1, SQLITE_STATIC);
+    ret |= sqlite3_bind_int64(stmt, 5, meta->size);
+    ret |= sqlite3_bind_int64(stmt, 6, meta->fetched);
+    ret |= sqlite3_bind_int64(stmt, 7, meta->stored);
+    ret |= sqlite3_bind_int64(stmt, 8, meta->crc);
+    ret |= sqlite3_bind_int(stmt, 9, meta->status);
+    if (ret) {
+        fprintf(stderr, "failed to bind values: %s\n", sqlite3_errstr(ret));
+        ret = EIO;
+        goto out;
+    }
+
+    do {
+        ret = sqlite3_step(stmt);
+    } while (ret == SQLITE_BUSY);
+
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "failed to update the page index: %s\n",
+                        sqlite3_errmsg(index_db));
+        ret = EIO;
+        goto out;
+    }
+
+    ret = 0;
+
+    if (++n_pending % INDEX_COMMIT_INTERVAL == 0) {
+        exec_simple_sql(index_db, "end transaction;");
+        exec_simple_sql(index_db, "begin transaction;");
+    }
+
+out:
+    sqlite3_reset(stmt);
+    pthread_mutex_unlock(&index_lock);
+
+    return ret;
+}
+
+int scrap500_index_set_status(int type, uint64_t id, int status)
+{
+    int ret = 0;
+    sqlite3_stmt *stmt = NULL;
+
+    if (!index_db)
+        return 0;
+
+    pthread_mutex_lock(&index_lock);
+
+    stmt = sqlstmts[SQL_STATUS];
+
+    ret = sqlite3_bind_int(stmt, 1, status);
+    ret |= sqlite3_bind_int(stmt, 2, type);
+    ret |= sqlite3_bind_int64(stmt, 3, id);
+    if (ret) {
+        fprintf(stderr, "failed to bind values: %s\n", sqlite3_errstr(ret));
+        ret = EIO;
+        goto out;
+    }
+
+    ret = sqlite3_step(stmt);
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "failed to update the page index: %s\n",
+                        sqlite3_errmsg(index_db));
+        ret = EIO;
+        goto out;
+    }
+
+    ret = 0;
+
+    if (++n_pending % INDEX_COMMIT_INTERVAL == 0) {
+        exec_simple_sql(index_db, "end transaction;");
+        exec_simple_sql(index_db, "begin transaction;");
+    }
+
+out:
+    sqlite3_reset(stmt);
+    pthread_mutex_unlock(&index_lock);
+
+    return ret;
+}
+
+int scrap500_index_list(int type, int pending, uint64_t **_ids,
+                        uint64_t *_count)
+{
+    int ret = 0;
+    uint64_t count = 0;
+    uint64_t size = 0;
+    uint64_t *ids = NULL;
+    uint64_t *tmp = NULL;
+    sqlite3_stmt *stmt = NULL;
+
+    *_ids = NULL;
+    *_count = 0;
+
+    if (!index_db)
+        return ENOENT;
+
+    pthread_mutex_lock(&index_lock);
+
+    stmt = sqlstmts[pending ? SQL_LIST_PENDING : SQL_LIST];
+
+    ret = sqlite3_bind_int(stmt, 1, type);
+    if (ret) {
+        fprintf(stderr, "failed to bind values: %s\n", sqlite3_errstr(ret));
+        ret = EIO;
+        goto out;
+    }
+
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (count == size) {
+            size = size ? 2*size : 1024;
+            tmp = realloc(ids, size*sizeof(*ids));
+            if (!tmp) {
+                ret = ENOMEM;
+                goto out;
+            }
+            ids = tmp;
+        }
+
+        ids[count++] = sqlite3_column_int64(stmt, 0);
+    }
+
+    if (ret != SQLITE_DONE) {
+        fprintf(stderr, "failed to read the page index: %s\n",
+                        sqlite3_errmsg(index_db));
+        ret = EIO;
+        goto out;
+    }
+
+    ret = 0;
+    *_ids = ids;
+    *_count = count;
+    ids = NULL;
+
+out:
+    free(ids);
+    sqlite3_reset(stmt);
+    pthread_mutex_unlock(&index_lock);
+
+    return ret;
+}
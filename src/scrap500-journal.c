@@ -0,0 +1,160 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * the crawl journal (<datadir>/journal) is an append-only log of a crawl, one
+ * record per line:
+ *
+ *   B                  a crawl begins
+ *   P <type> <id>      the page is queued (pending)
+ *   C <type> <id>      the page has been fetched and stored
+ *   F <type> <id>      the page has been given up on
+ *   E                  the crawl has finished
+ *
+ * when the last crawl in the journal has no E record, it has been interrupted
+ * and the pages it completed are skipped by the next run, which continues the
+ * same crawl. otherwise, the journal is truncated and a new crawl begins.
+ * each record is appended with a single write(2) on an O_APPEND descriptor,
+ * so records from concurrent fetcher threads never interleave.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "scrap500.h"
+
+static int journal_fd = -1;
+static scrap500_idset_t journal_done;   /* completed by the interrupted run */
+
+static inline uint64_t journal_key(int type, uint64_t id)
+{
+    return ((uint64_t) type << 56) | id;
+}
+
+/*
+ * loads the completed pages of the last crawl. returns 1 if the crawl has
+ * been interrupted, 0 if it has finished (or there is no journal).
+ */
+static int journal_load(const char *filename)
+{
+    int ret = 0;
+    int type = 0;
+    char state = 0;
+    unsigned long long id = 0;
+    uint64_t n_done = 0;
+    FILE *fp = NULL;
+    char line[128] = { 0, };
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        switch (line[0]) {
+        case 'B':
+            scrap500_idset_free(&journal_done);
+            n_done = 0;
+            ret = 1;
+            break;
+
+        case 'E':
+            ret = 0;
+            break;
+
+        case 'C':
+            if (3 == sscanf(line, "%c %d %llu", &state, &type, &id)
+                && 0 == scrap500_idset_add(&journal_done,
+                                           journal_key(type, id)))
+                n_done++;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    if (ret)
+        printf("## resuming an interrupted crawl, %llu pages done\n",
+               _llu(n_done));
+    else
+        scrap500_idset_free(&journal_done);
+
+    return ret;
+}
+
+static void journal_append(const char *record, size_t len)
+{
+    if (journal_fd < 0)
+        return;
+
+    if (write(journal_fd, record, len) != (ssize_t) len)
+        fprintf(stderr, "failed to write the journal: %s\n",
+                        strerror(errno));
+}
+
+int scrap500_journal_open(void)
+{
+    int resume = 0;
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+    char filename[PATH_MAX] = { 0, };
+
+    sprintf(filename, "%s/journal", scrap500_datadir);
+
+    resume = journal_load(filename);
+    if (!resume)
+        flags |= O_TRUNC;
+
+    journal_fd = open(filename, flags, 0644);
+    if (journal_fd < 0) {
+        fprintf(stderr, "failed to open the journal %s: %s\n",
+                        filename, strerror(errno));
+        scrap500_idset_free(&journal_done);
+        return errno;
+    }
+
+    if (!resume)
+        journal_append("B\n", 2);
+
+    return 0;
+}
+
+void scrap500_journal_close(void)
+{
+    if (journal_fd >= 0) {
+        fsync(journal_fd);
+        close(journal_fd);
+    }
+
+    journal_fd = -1;
+    scrap500_idset_free(&journal_done);
+}
+
+void scrap500_journal_record(int state, int type, uint64_t id)
+{
+    int len = 0;
+    char record[64] = { 0, };
+
+    len = sprintf(record, "%c %d %llu\n", state, type, _llu(id));
+
+    journal_append(record, len);
+}
+
+void scrap500_journal_finish(void)
+{
+    journal_append("E\n", 2);
+}
+
+int scrap500_journal_done(int type, uint64_t id)
+{
+    return scrap500_idset_has(&journal_done, journal_key(type, id));
+}
@@ -0,0 +1,363 @@
+/* Copyright (C) 2019 Hyogi Sim <simh@ornl.gov>
+ * ---------------------------------------------------------------------------
+ * See COPYING for the license.
+ *
+ * scrap500-numbench compares scrap500_parser_number() with the sscanf() path
+ * it replaced (see 'make bench-number'). the cells of the numeric attributes
+ * are taken from the system pages cached in a data directory, and each parser
+ * reads all of them a number of times. the cells parsed per second by each
+ * and the units found are reported, along with any cell the two read
+ * differently.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "scrap500.h"
+
+char *scrap500_datadir = "__run/scrap500";
+
+static int rounds = 3;
+
+static char **cells;
+static uint64_t n_cells;
+static uint64_t max_cells;
+
+static const char *unit_names[] = {
+    "none",
+    "flop/s",
+    "byte",
+    "watt",
+    "unknown",
+};
+
+static inline double cpu_sec(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* how the numbers were parsed before scrap500_parser_number() */
+static int parse_sscanf(const char *str, double *val)
+{
+    int i = 0;
+    char buf[512] = { 0, };
+    const char *pos = NULL;
+
+    errno = 0;
+
+    for (pos = str; *pos != '\0' && i < (int) sizeof(buf) - 1; pos++) {
+        if (pos[0] == ',')
+            continue;
+
+        buf[i++] = pos[0];
+    }
+
+    i = sscanf(buf, "%lf", val);
+
+    return i == 1 ? 0 : errno;
+}
+
+static int add_cell(const char *str)
+{
+    char **tmp = NULL;
+
+    if (n_cells == max_cells) {
+        tmp = realloc(cells, sizeof(char *)*(max_cells + 4096));
+        if (!tmp)
+            return ENOMEM;
+
+        cells = tmp;
+        max_cells += 4096;
+    }
+
+    cells[n_cells] = strdup(str);
+    if (!cells[n_cells])
+        return ENOMEM;
+
+    n_cells++;
+
+    return 0;
+}
+
+static xmlNode *first_child(xmlNode *node, const char *name)
+{
+    xmlNode *current = NULL;
+
+    for (current = node->children; current; current = current->next)
+        if (current->type == XML_ELEMENT_NODE
+            && 0 == strcmp((char *) current->name, name))
+            return current;
+
+    return NULL;
+}
+
+/* returns 1 if the label of the row is that of a numeric attribute */
+static int is_number_row(const char *label)
+{
+    int i = 0;
+    size_t len = 0;
+    const char *pos = strrchr(label, ':');
+    const scrap500_sysattr_t *attr = NULL;
+
+    len = pos ? (size_t) (pos - label) : strlen(label);
+
+    for (i = 0; i < N_SCRAP500_SYSATTRS; i++) {
+        attr = &scrap500_sysattrs[i];
+        if (attr->type == SCRAP500_ATTR_NUM
+            && 0 == strncasecmp(label, attr->label, len)
+            && attr->label[len] == '\0')
+            return 1;
+    }
+
+    return 0;
+}
+
+/* collects the text of the td of the numeric rows under node */
+static int collect_cells(xmlNode *node)
+{
+    int ret = 0;
+    xmlNode *current = NULL;
+    xmlNode *th = NULL;
+    xmlNode *td = NULL;
+
+    for (current = node; current && !ret; current = current->next) {
+        if (current->type != XML_ELEMENT_NODE)
+            continue;
+
+        if (strcmp((char *) current->name, "tr")) {
+            ret = collect_cells(current->children);
+            continue;
+        }
+
+        th = first_child(current, "th");
+        td = first_child(current, "td");
+        if (!th || !td || !th->children || !td->children
+            || !th->children->content || !td->children->content)
+            continue;
+
+        if (is_number_row((char *) th->children->content))
+            ret = add_cell((char *) td->children->content);
+    }
+
+    return ret;
+}
+
+static int load_cells(uint64_t *n_pages)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    uint64_t count = 0;
+    uint64_t *ids = NULL;
+    htmlDocPtr doc = NULL;
+
+    ret = scrap500_cache_page_ids(SCRAP500_PAGE_SYSTEM, &ids, &count);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < count && !ret; i++) {
+        doc = scrap500_cache_read_page(SCRAP500_PAGE_SYSTEM, ids[i]);
+        if (!doc) {
+            fprintf(stderr, "failed to read system %llu\n", _llu(ids[i]));
+            continue;
+        }
+
+        ret = collect_cells(xmlDocGetRootElement(doc));
+        xmlFreeDoc(doc);
+    }
+
+    free(ids);
+    *n_pages = count;
+
+    return ret;
+}
+
+/* reports the cells the two parsers read differently */
+static uint64_t check_cells(uint64_t *units)
+{
+    uint64_t i = 0;
+    uint64_t n_diffs = 0;
+    double a = 0;
+    double b = 0;
+    scrap500_unit_t unit = { 0, };
+
+    for (i = 0; i < n_cells; i++) {
+        a = 0;
+        b = 0;
+
+        parse_sscanf(cells[i], &a);
+        scrap500_parser_number(cells[i], &b, &unit);
+        units[unit.base]++;
+
+        if (a == b || (isnan(a) && isnan(b)))
+            continue;
+
+        printf("differ: \"%s\": sscanf %.17g, number %.17g\n",
+               cells[i], a, b);
+        n_diffs++;
+    }
+
+    return n_diffs;
+}
+
+static double run_sscanf(void)
+{
+    uint64_t i = 0;
+    double val = 0;
+    double sum = 0;
+
+    for (i = 0; i < n_cells; i++) {
+        val = 0;
+        parse_sscanf(cells[i], &val);
+        sum += val;
+    }
+
+    return sum;
+}
+
+static double run_number(void)
+{
+    uint64_t i = 0;
+    double val = 0;
+    double sum = 0;
+    scrap500_unit_t unit = { 0, };
+
+    for (i = 0; i < n_cells; i++) {
+        val = 0;
+        scrap500_parser_number(cells[i], &val, &unit);
+        sum += val;
+    }
+
+    return sum;
+}
+
+static char program[PATH_MAX];
+
+static struct option const long_opts[] = {
+    { "datadir", 1, 0, 'd' },
+    { "help", 0, 0, 'h' },
+    { "rounds", 1, 0, 'r' },
+    { 0, 0, 0, 0},
+};
+
+static const char *short_opts = "d:hr:";
+
+static const char *usage_str =
+"Usage: %s [options..]\n"
+"\n"
+"  available options:\n"
+"  -d, --datadir=<path>   take the cells from the pages in <path>\n"
+"                         (default: __run/scrap500)\n"
+"  -h, --help             print help message\n"
+"  -r, --rounds=<N>       repeat each test <N> times (default: 3)\n"
+"\n";
+
+static inline void usage(int ec)
+{
+    fprintf(stdout, usage_str, program);
+    exit(ec);
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int optidx = 0;
+    int ch = 0;
+    int i = 0;
+    uint64_t j = 0;
+    uint64_t n_pages = 0;
+    uint64_t n_diffs = 0;
+    uint64_t units[SCRAP500_UNIT_UNKNOWN + 1] = { 0, };
+    double start = 0;
+    double cpu[2] = { 0, };
+    volatile double sink = 0;
+
+    read_program_name(argv[0], program);
+
+    while ((ch = getopt_long(argc, argv,
+                             short_opts, long_opts, &optidx)) >= 0) {
+        switch (ch) {
+        case 'd':
+            scrap500_datadir = optarg;
+            break;
+
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+
+        case 'h':
+        default:
+            usage(0);
+            break;
+        }
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+
+    xmlInitParser();
+
+    ret = load_cells(&n_pages);
+    if (ret) {
+        fprintf(stderr, "failed to collect the cells: %s\n", strerror(ret));
+        goto out;
+    }
+
+    n_diffs = check_cells(units);
+
+    /* the two take turns going first, as the host drifts during a run */
+    for (i = 0; i < rounds; i++) {
+        if (i & 1) {
+            start = cpu_sec();
+            sink += run_number();
+            cpu[1] += cpu_sec() - start;
+        }
+
+        start = cpu_sec();
+        sink += run_sscanf();
+        cpu[0] += cpu_sec() - start;
+
+        if (!(i & 1)) {
+            start = cpu_sec();
+            sink += run_number();
+            cpu[1] += cpu_sec() - start;
+        }
+    }
+
+    printf("## %llu cells of %llu systems in %s, %d rounds each\n",
+           _llu(n_cells), _llu(n_pages), scrap500_datadir, rounds);
+    printf("%-8s %10s %12s %10s\n", "parser", "cpu(s)", "cells/s", "ns/cell");
+
+    for (i = 0; i < 2; i++)
+        printf("%-8s %10.3f %12.1f %10.1f\n", i ? "number" : "sscanf",
+               cpu[i]/rounds, n_cells*rounds/cpu[i],
+               cpu[i]*1e9/(n_cells*rounds));
+
+    printf("## units:");
+    for (i = 0; i <= SCRAP500_UNIT_UNKNOWN; i++)
+        printf(" %s %llu", unit_names[i], _llu(units[i]));
+    printf("\n## %llu cells differ\n", _llu(n_diffs));
+
+    if (n_diffs)
+        ret = EIO;
+
+out:
+    for (j = 0; j < n_cells; j++)
+        free(cells[j]);
+    free(cells);
+
+    xmlCleanupParser();
+
+    return ret;
+}
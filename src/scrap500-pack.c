@@ -0,0 +1,825 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * the pack (<datadir>/pages.pack) keeps cached pages in a single file instead
+ * of a file per page. pages are appended as records,
+ *
+ *   [magic, length, (type << 56) | id, crc32] [page, as stored by the cache]
+ *
+ * and the newest record of a page wins. the offset index (pages.pack.idx) is
+ * written when the pack is closed: the length of the pack it covers, followed
+ * by (key, offset, length) of every page, sorted by the key. records beyond
+ * the index, e.g., appended by a crashed run, are scanned on open, and a torn
+ * record at the end is cut off. pages are read straight out of a read-only
+ * mapping of the pack.
+ *
+ * once a data directory has a pack, the fetcher appends every page to it.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include "scrap500.h"
+
+#define PACK_MAGIC          0x4b503553      /* "S5PK" */
+#define PACK_RECORD_MAGIC   0x43523553      /* "S5RC" */
+#define PACK_INDEX_MAGIC    0x58493553      /* "S5IX" */
+#define PACK_DICT_MAGIC     0xec30a437      /* of a zstd dictionary */
+#define PACK_VERSION        1
+
+struct _pack_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dict_id;       /* of the dictionary of the pages, 0 if none */
+    uint32_t reserved;
+};
+
+struct _pack_record {
+    uint32_t magic;
+    uint32_t len;
+    uint64_t key;
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+struct _pack_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t covered;       /* length of the pack the index covers */
+    uint64_t count;
+};
+
+struct _pack_entry {
+    uint64_t key;
+    uint64_t offset;        /* of the page, past the record header */
+    uint32_t len;
+    uint32_t reserved;
+};
+
+typedef struct _pack_header pack_header_t;
+typedef struct _pack_record pack_record_t;
+typedef struct _pack_index_header pack_index_header_t;
+typedef struct _pack_entry pack_entry_t;
+
+static pthread_mutex_t pack_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pack_fd = -1;
+static int pack_writable;
+static int pack_dirty;
+static int pack_tried;          /* opened on demand once by the readers */
+static uint64_t pack_len;       /* up to the end of the last whole record */
+
+static char *pack_map;
+static uint64_t pack_map_len;
+static char **retired_maps;     /* earlier mappings, pages may point there */
+static uint64_t *retired_lens;
+static int n_retired;
+
+static pack_entry_t *entries;
+static uint64_t n_entries;
+static uint64_t entries_size;
+static uint64_t *slots;         /* open addressing, entry index + 1 */
+static uint64_t n_slots;
+
+static inline uint64_t pack_key(int type, uint64_t id)
+{
+    return ((uint64_t) type << 56) | id;
+}
+
+static inline uint64_t hash_key(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+static inline void pack_filename(char *buf, const char *suffix)
+{
+    sprintf(buf, "%s/pages.pack%s", scrap500_datadir, suffix);
+}
+
+static pack_entry_t *find_entry(uint64_t key)
+{
+    uint64_t pos = 0;
+
+    if (!n_slots)
+        return NULL;
+
+    pos = hash_key(key) & (n_slots - 1);
+
+    while (slots[pos]) {
+        if (entries[slots[pos] - 1].key == key)
+            return &entries[slots[pos] - 1];
+
+        pos = (pos + 1) & (n_slots - 1);
+    }
+
+    return NULL;
+}
+
+static int grow_slots(void)
+{
+    uint64_t i = 0;
+    uint64_t pos = 0;
+    uint64_t size = n_slots ? 2*n_slots : 4096;
+    uint64_t *tmp = NULL;
+
+    tmp = calloc(size, sizeof(*tmp));
+    if (!tmp)
+        return ENOMEM;
+
+    for (i = 0; i < n_entries; i++) {
+        pos = hash_key(entries[i].key) & (size - 1);
+        while (tmp[pos])
+            pos = (pos + 1) & (size - 1);
+
+        tmp[pos] = i + 1;
+    }
+
+    free(slots);
+    slots = tmp;
+    n_slots = size;
+
+    return 0;
+}
+
+static int put_entry(uint64_t key, uint64_t offset, uint32_t len)
+{
+    uint64_t pos = 0;
+    pack_entry_t *e = NULL;
+
+    e = find_entry(key);
+    if (e) {
+        e->offset = offset;
+        e->len = len;
+        return 0;
+    }
+
+    if (n_entries == entries_size) {
+        uint64_t size = entries_size ? 2*entries_size : 4096;
+
+        e = realloc(entries, size*sizeof(*e));
+        if (!e)
+            return ENOMEM;
+
+        entries = e;
+        entries_size = size;
+    }
+
+    if (2*(n_entries + 1) > n_slots && grow_slots())
+        return ENOMEM;
+
+    e = &entries[n_entries++];
+    e->key = key;
+    e->offset = offset;
+    e->len = len;
+    e->reserved = 0;
+
+    pos = hash_key(key) & (n_slots - 1);
+    while (slots[pos])
+        pos = (pos + 1) & (n_slots - 1);
+
+    slots[pos] = n_entries;
+
+    return 0;
+}
+
+/*
+ * loads the offset index, and returns the length of the pack it covers (the
+ * pack header only if there is no usable index).
+ */
+static uint64_t load_index(uint64_t size)
+{
+    uint64_t i = 0;
+    FILE *fp = NULL;
+    pack_entry_t e = { 0, };
+    pack_index_header_t h = { 0, };
+    char filename[PATH_MAX] = { 0, };
+
+    pack_filename(filename, ".idx");
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return sizeof(pack_header_t);
+
+    if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != PACK_INDEX_MAGIC
+        || h.version != PACK_VERSION || h.covered > size)
+        goto out_stale;
+
+    for (i = 0; i < h.count; i++) {
+        if (fread(&e, sizeof(e), 1, fp) != 1 || e.offset + e.len > h.covered
+            || put_entry(e.key, e.offset, e.len))
+            goto out_stale;
+    }
+
+    fclose(fp);
+
+    return h.covered;
+
+out_stale:
+    fclose(fp);
+
+    n_entries = 0;
+    if (slots)
+        memset((void *) slots, 0, n_slots*sizeof(*slots));
+
+    return sizeof(pack_header_t);
+}
+
+/*
+ * indexes the records from offset to the end of the pack. a torn or corrupt
+ * record ends the pack, and is cut off if the pack is writable.
+ */
+static int scan_records(uint64_t offset, uint64_t size)
+{
+    int ret = 0;
+    char *buf = NULL;
+    pack_record_t r = { 0, };
+
+    while (offset + sizeof(r) <= size) {
+        if (pread(pack_fd, &r, sizeof(r), offset) != sizeof(r)
+            || r.magic != PACK_RECORD_MAGIC
+            || offset + sizeof(r) + r.len > size)
+            break;
+
+        buf = realloc(buf, r.len ? r.len : 1);
+        if (!buf) {
+            ret = ENOMEM;
+            goto out;
+        }
+
+        if (pread(pack_fd, buf, r.len, offset + sizeof(r)) != (ssize_t) r.len
+            || crc32(0, (Bytef *) buf, r.len) != r.crc)
+            break;
+
+        ret = put_entry(r.key, offset + sizeof(r), r.len);
+        if (ret)
+            goto out;
+
+        offset += sizeof(r) + r.len;
+        pack_dirty = 1;
+    }
+
+    if (offset < size) {
+        fprintf(stderr, "the pack is damaged at %llu, dropping %llu bytes\n",
+                        _llu(offset), _llu(size - offset));
+
+        if (pack_writable && ftruncate(pack_fd, offset) < 0)
+            ret = errno;
+    }
+
+    pack_len = offset;
+
+out:
+    free(buf);
+    return ret;
+}
+
+static int pack_remap(void)
+{
+    char *map = NULL;
+    char **maps = NULL;
+    uint64_t *lens = NULL;
+
+    if (pack_len <= pack_map_len)
+        return 0;
+
+    map = mmap(NULL, pack_len, PROT_READ, MAP_SHARED, pack_fd, 0);
+    if (map == MAP_FAILED)
+        return errno;
+
+    if (pack_map) {
+        maps = realloc(retired_maps, (n_retired + 1)*sizeof(*maps));
+        if (maps)
+            retired_maps = maps;
+        lens = realloc(retired_lens, (n_retired + 1)*sizeof(*lens));
+        if (lens)
+            retired_lens = lens;
+        if (!maps || !lens) {
+            munmap(map, pack_len);
+            return ENOMEM;
+        }
+
+        retired_maps[n_retired] = pack_map;
+        retired_lens[n_retired] = pack_map_len;
+        n_retired++;
+    }
+
+    pack_map = map;
+    pack_map_len = pack_len;
+
+    return 0;
+}
+
+/*
+ * unmaps and closes the pack, with pack_lock held.
+ */
+static void pack_release(void)
+{
+    int i = 0;
+
+    for (i = 0; i < n_retired; i++)
+        munmap(retired_maps[i], retired_lens[i]);
+
+    if (pack_map)
+        munmap(pack_map, pack_map_len);
+
+    if (pack_fd >= 0)
+        close(pack_fd);
+
+    free(retired_maps);
+    free(retired_lens);
+    free(entries);
+    free(slots);
+
+    pack_fd = -1;
+    pack_writable = pack_dirty = 0;
+    pack_len = pack_map_len = 0;
+    pack_map = NULL;
+    retired_maps = NULL;
+    retired_lens = NULL;
+    n_retired = 0;
+    entries = NULL;
+    slots = NULL;
+    n_entries = entries_size = n_slots = 0;
+}
+
+/* the id of the zstd dictionary in filename, 0 if there is none */
+static uint32_t dict_id(const char *filename)
+{
+    int fd = 0;
+    uint32_t h[2] = { 0, };
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    if (pread(fd, h, sizeof(h), 0) != sizeof(h) || h[0] != PACK_DICT_MAGIC)
+        h[1] = 0;
+
+    close(fd);
+
+    return h[1];
+}
+
+/*
+ * scrap500-repack renames the new pack into place before its dictionary
+ * (pages.dict.new), so a crash in between leaves the pack with the old one.
+ * the rename is finished here, and a pack is never read with a dictionary
+ * other than that in its header.
+ */
+static int check_dict(uint32_t id)
+{
+    char filename[PATH_MAX] = { 0, };
+    char newname[PATH_MAX + 4] = { 0, };
+
+    sprintf(filename, "%s/pages.dict", scrap500_datadir);
+    if (dict_id(filename) == id)
+        return 0;
+
+    sprintf(newname, "%s.new", filename);
+    if (dict_id(newname) == id) {
+        if (rename(newname, filename) < 0)
+            return errno;
+        return 0;
+    }
+
+    fprintf(stderr, "%s is not the dictionary of the pack\n", filename);
+    return EINVAL;
+}
+
+static int pack_open(int mode)
+{
+    int ret = 0;
+    int flags = O_RDONLY;
+    uint64_t covered = 0;
+    struct stat sb = { 0, };
+    pack_header_t h = { PACK_MAGIC, PACK_VERSION, 0 };
+    char filename[PATH_MAX] = { 0, };
+
+    pack_filename(filename, "");
+
+    if (mode != SCRAP500_PACK_READ)
+        flags = O_RDWR;
+    if (mode == SCRAP500_PACK_CREATE)
+        flags |= O_CREAT;
+
+    pack_fd = open(filename, flags | O_CLOEXEC, 0644);
+    if (pack_fd < 0)
+        return errno;
+
+    pack_writable = mode != SCRAP500_PACK_READ;
+
+    if (fstat(pack_fd, &sb) < 0) {
+        ret = errno;
+        goto out_close;
+    }
+
+    if (sb.st_size == 0 && pack_writable) {
+        if (pwrite(pack_fd, &h, sizeof(h), 0) != sizeof(h)) {
+            ret = errno ? errno : EIO;
+            goto out_close;
+        }
+        sb.st_size = sizeof(h);
+    }
+    else if (pread(pack_fd, &h, sizeof(h), 0) != sizeof(h)
+             || h.magic != PACK_MAGIC || h.version != PACK_VERSION) {
+        fprintf(stderr, "%s is not a pack\n", filename);
+        ret = EINVAL;
+        goto out_close;
+    }
+
+    if (h.dict_id) {
+        ret = check_dict(h.dict_id);
+        if (ret)
+            goto out_close;
+    }
+
+    covered = load_index(sb.st_size);
+
+    ret = scan_records(covered, sb.st_size);
+    if (ret)
+        goto out_close;
+
+    ret = pack_remap();
+    if (ret)
+        goto out_close;
+
+    return 0;
+
+out_close:
+    fprintf(stderr, "failed to open the pack %s: %s\n",
+                    filename, strerror(ret));
+    pack_release();
+    return ret;
+}
+
+int scrap500_pack_open(int mode)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&pack_lock);
+
+    pack_tried = 1;
+    if (pack_fd < 0)
+        ret = pack_open(mode);
+
+    pthread_mutex_unlock(&pack_lock);
+
+    return ret;
+}
+
+static int compare_entry(const void *a, const void *b)
+{
+    const pack_entry_t *x = (const pack_entry_t *) a;
+    const pack_entry_t *y = (const pack_entry_t *) b;
+
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/*
+ * writes the index of n entries, sorted by the key, to <packname>.idx. the
+ * pack should be on disk up to covered.
+ */
+static int write_index_file(const char *packname, int fd, pack_entry_t *e,
+                            uint64_t n, uint64_t covered)
+{
+    int ret = 0;
+    FILE *fp = NULL;
+    pack_index_header_t h = { PACK_INDEX_MAGIC, PACK_VERSION, 0, 0 };
+    char filename[PATH_MAX] = { 0, };
+    char tmpname[PATH_MAX] = { 0, };
+
+    sprintf(filename, "%s.idx", packname);
+    sprintf(tmpname, "%s.idx.tmp", packname);
+
+    /* the index may only cover records that are on disk */
+    if (fdatasync(fd) < 0)
+        return errno;
+
+    qsort(e, n, sizeof(*e), compare_entry);
+
+    h.covered = covered;
+    h.count = n;
+
+    fp = fopen(tmpname, "w");
+    if (!fp)
+        return errno;
+
+    if (fwrite(&h, sizeof(h), 1, fp) != 1
+        || fwrite(e, sizeof(*e), n, fp) != n
+        || fflush(fp) || fsync(fileno(fp)))
+        ret = errno ? errno : EIO;
+
+    if (fclose(fp) && !ret)
+        ret = errno;
+
+    if (!ret && rename(tmpname, filename) < 0)
+        ret = errno;
+
+    if (ret)
+        unlink(tmpname);
+
+    return ret;
+}
+
+static int write_index(void)
+{
+    char filename[PATH_MAX] = { 0, };
+
+    pack_filename(filename, "");
+
+    return write_index_file(filename, pack_fd, entries, n_entries, pack_len);
+}
+
+void scrap500_pack_close(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&pack_lock);
+
+    if (pack_fd >= 0 && pack_writable && pack_dirty) {
+        ret = write_index();
+        if (ret)
+            fprintf(stderr, "failed to write the pack index: %s\n",
+                            strerror(ret));
+    }
+
+    pack_release();
+
+    /* the readers may open it again */
+    pack_tried = 0;
+
+    pthread_mutex_unlock(&pack_lock);
+}
+
+int scrap500_pack_active(void)
+{
+    return pack_fd >= 0 && pack_writable;
+}
+
+/*
+ * writes the record of the page at offset of fd, and returns its key.
+ */
+static int write_record(int fd, uint64_t offset, int type, uint64_t id,
+                        const void *buf, size_t len, uint64_t *key)
+{
+    ssize_t n = 0;
+    pack_record_t r = { 0, };
+    struct iovec iov[2];
+
+    r.magic = PACK_RECORD_MAGIC;
+    r.len = (uint32_t) len;
+    r.key = pack_key(type, id);
+    r.crc = crc32(0, (const Bytef *) buf, len);
+
+    iov[0].iov_base = (void *) &r;
+    iov[0].iov_len = sizeof(r);
+    iov[1].iov_base = (void *) buf;
+    iov[1].iov_len = len;
+
+    n = pwritev(fd, iov, 2, offset);
+    if (n != (ssize_t) (sizeof(r) + len))
+        return n < 0 ? errno : EIO;
+
+    *key = r.key;
+
+    return 0;
+}
+
+int scrap500_pack_append(int type, uint64_t id, const void *buf, size_t len)
+{
+    int ret = 0;
+    uint64_t key = 0;
+
+    pthread_mutex_lock(&pack_lock);
+
+    if (pack_fd < 0 || !pack_writable) {
+        ret = EBADF;
+        goto out;
+    }
+
+    /* a torn record is cut off by the next open */
+    ret = write_record(pack_fd, pack_len, type, id, buf, len, &key);
+    if (ret)
+        goto out;
+
+    ret = put_entry(key, pack_len + sizeof(pack_record_t), (uint32_t) len);
+    pack_len += sizeof(pack_record_t) + len;
+    pack_dirty = 1;
+
+out:
+    pthread_mutex_unlock(&pack_lock);
+
+    return ret;
+}
+
+/*
+ * readers open the pack of the data directory (if any) on their first access.
+ */
+static inline void pack_autoload(void)
+{
+    if (pack_fd < 0 && !pack_tried) {
+        pack_tried = 1;
+        if (pack_open(SCRAP500_PACK_READ) == ENOENT)
+            return;
+    }
+}
+
+int scrap500_pack_get(int type, uint64_t id, const char **buf, size_t *len)
+{
+    int ret = 0;
+    pack_entry_t *e = NULL;
+
+    pthread_mutex_lock(&pack_lock);
+
+    pack_autoload();
+
+    e = find_entry(pack_key(type, id));
+    if (!e) {
+        ret = ENOENT;
+        goto out;
+    }
+
+    if (e->offset + e->len > pack_map_len) {
+        ret = pack_remap();
+        if (ret)
+            goto out;
+    }
+
+    *buf = &pack_map[e->offset];
+    *len = e->len;
+
+out:
+    pthread_mutex_unlock(&pack_lock);
+
+    return ret;
+}
+
+int scrap500_pack_has(int type, uint64_t id)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&pack_lock);
+
+    pack_autoload();
+    ret = find_entry(pack_key(type, id)) != NULL;
+
+    pthread_mutex_unlock(&pack_lock);
+
+    return ret;
+}
+
+int scrap500_pack_ids(int type, scrap500_idset_t *set)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    uint64_t key = 0;
+
+    pthread_mutex_lock(&pack_lock);
+
+    pack_autoload();
+
+    for (i = 0; i < n_entries; i++) {
+        key = entries[i].key;
+        if ((int) (key >> 56) != type)
+            continue;
+
+        ret = scrap500_idset_add(set, key & ((1ULL << 56) - 1));
+        if (ret == ENOMEM)
+            break;
+
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&pack_lock);
+
+    return ret;
+}
+
+/*
+ * a pack written from scratch to a file of its own, aside from the pack of
+ * the data directory, which can be read meanwhile. scrap500-repack writes the
+ * new pack with it, and renames the pack and its index into place.
+ */
+struct _scrap500_pack_writer {
+    int fd;
+    uint64_t len;
+    pack_entry_t *entries;
+    uint64_t n_entries;
+    uint64_t entries_size;
+    char filename[PATH_MAX];
+};
+
+scrap500_pack_writer_t *scrap500_pack_create(const char *filename,
+                                             uint32_t dict_id)
+{
+    scrap500_pack_writer_t *w = NULL;
+    pack_header_t h = { PACK_MAGIC, PACK_VERSION, dict_id, 0 };
+
+    w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+
+    sprintf(w->filename, "%s", filename);
+
+    w->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        free(w);
+        return NULL;
+    }
+
+    if (pwrite(w->fd, &h, sizeof(h), 0) != sizeof(h)) {
+        scrap500_pack_abort(w);
+        return NULL;
+    }
+
+    w->len = sizeof(h);
+
+    return w;
+}
+
+int scrap500_pack_write(scrap500_pack_writer_t *w, int type, uint64_t id,
+                        const void *buf, size_t len)
+{
+    int ret = 0;
+    uint64_t key = 0;
+    pack_entry_t *e = NULL;
+
+    if (w->n_entries == w->entries_size) {
+        uint64_t size = w->entries_size ? 2*w->entries_size : 4096;
+
+        e = realloc(w->entries, size*sizeof(*e));
+        if (!e)
+            return ENOMEM;
+
+        w->entries = e;
+        w->entries_size = size;
+    }
+
+    ret = write_record(w->fd, w->len, type, id, buf, len, &key);
+    if (ret)
+        return ret;
+
+    e = &w->entries[w->n_entries++];
+    e->key = key;
+    e->offset = w->len + sizeof(pack_record_t);
+    e->len = (uint32_t) len;
+    e->reserved = 0;
+
+    w->len += sizeof(pack_record_t) + len;
+
+    return 0;
+}
+
+int scrap500_pack_finish(scrap500_pack_writer_t *w)
+{
+    int ret = 0;
+
+    ret = write_index_file(w->filename, w->fd, w->entries, w->n_entries,
+                           w->len);
+    if (ret) {
+        scrap500_pack_abort(w);
+        return ret;
+    }
+
+    if (close(w->fd) < 0)
+        ret = errno;
+
+    free(w->entries);
+    free(w);
+
+    return ret;
+}
+
+void scrap500_pack_abort(scrap500_pack_writer_t *w)
+{
+    char filename[PATH_MAX + 8] = { 0, };
+
+    if (!w)
+        return;
+
+    close(w->fd);
+    unlink(w->filename);
+
+    sprintf(filename, "%s.idx", w->filename);
+    unlink(filename);
+
+    free(w->entries);
+    free(w);
+}
@@ -0,0 +1,307 @@
+/* Copyright (C) 2019 Hyogi Sim <simh@ornl.gov>
+ * ---------------------------------------------------------------------------
+ * See COPYING for the license.
+ *
+ * scrap500-parsebench measures the parser over the pages cached in a data
+ * directory (see 'make bench-parse'). the pages of each type are parsed, once
+ * with a new parser context for every page and once in a batch that keeps the
+ * context of the thread. the pages parsed per second, the allocations libxml2
+ * makes for each page and the most memory it holds while parsing a page are
+ * reported. all pages are parsed once before the measurement, so that they
+ * are in the page cache.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <libxml/xmlmemory.h>
+
+#include "scrap500.h"
+
+char *scrap500_datadir = "__run/scrap500";
+
+static int rounds = 3;
+
+static const char *page_names[] = {
+    "list",
+    "site",
+    "system",
+};
+
+/* the ids of lists, sites and systems to parse, in ascending order */
+static uint64_t *ids[3];
+static uint64_t n_ids[3];
+
+static scrap500_list_t list;
+
+/*
+ * the allocations libxml2 made, and the bytes it held at most while parsing a
+ * page, counted through xmlMemSetup()
+ */
+static uint64_t n_allocs;
+static size_t mem_live;
+static size_t mem_peak;
+
+static inline void *count_alloc(void *ptr)
+{
+    n_allocs++;
+
+    if (ptr) {
+        mem_live += malloc_usable_size(ptr);
+        if (mem_live > mem_peak)
+            mem_peak = mem_live;
+    }
+
+    return ptr;
+}
+
+static void count_free(void *ptr)
+{
+    if (ptr)
+        mem_live -= malloc_usable_size(ptr);
+    free(ptr);
+}
+
+static void *count_malloc(size_t size)
+{
+    return count_alloc(malloc(size));
+}
+
+static void *count_realloc(void *ptr, size_t size)
+{
+    if (ptr)
+        mem_live -= malloc_usable_size(ptr);
+
+    return count_alloc(realloc(ptr, size));
+}
+
+static char *count_strdup(const char *str)
+{
+    return count_alloc(strdup(str));
+}
+
+static inline double cpu_sec(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int parse_page(int type, uint64_t id)
+{
+    int ret = 0;
+    scrap500_site_t site = { 0, };
+    scrap500_system_t system = { 0, };
+
+    switch (type) {
+    case SCRAP500_PAGE_LIST:
+        list.id = (uint32_t) id;
+        ret = scrap500_parser_parse_list(&list);
+        break;
+    case SCRAP500_PAGE_SITE:
+        ret = scrap500_parser_parse_site(id, &site);
+        scrap500_site_reset(&site);
+        break;
+    default:
+        ret = scrap500_parser_parse_system(id, &system);
+        scrap500_system_reset(&system);
+        break;
+    }
+
+    return ret;
+}
+
+/*
+ * parses all pages of the type once, and adds the cpu time and the
+ * allocations to the totals.
+ */
+static int run_round(int type, int batch, double *cpu, uint64_t *allocs,
+                     size_t *peak)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    size_t live = 0;
+    double start = 0;
+
+    if (batch) {
+        ret = scrap500_cache_batch_begin();
+        if (ret)
+            return ret;
+    }
+
+    n_allocs = 0;
+    start = cpu_sec();
+
+    for (i = 0; i < n_ids[type]; i++) {
+        live = mem_live;
+        mem_peak = live;
+
+        ret = parse_page(type, ids[type][i]);
+
+        if (mem_peak - live > *peak)
+            *peak = mem_peak - live;
+
+        if (ret) {
+            fprintf(stderr, "failed to parse %s %llu\n",
+                            page_names[type], _llu(ids[type][i]));
+            break;
+        }
+    }
+
+    *cpu += cpu_sec() - start;
+    *allocs += n_allocs;
+
+    if (batch)
+        scrap500_cache_batch_end();
+
+    return ret;
+}
+
+static int run_bench(int type)
+{
+    int ret = 0;
+    int i = 0;
+    int batch = 0;
+    uint64_t pages = 0;
+    int mode = 0;
+    uint64_t allocs[2] = { 0, };
+    size_t peak[2] = { 0, };
+    double cpu[2] = { 0, };
+
+    /* the two take turns going first, as the host drifts during a run */
+    for (i = 0; i < rounds; i++) {
+        for (batch = 0; batch < 2; batch++) {
+            mode = batch ^ (i & 1);
+            ret = run_round(type, mode, &cpu[mode], &allocs[mode],
+                            &peak[mode]);
+            if (ret)
+                return ret;
+        }
+    }
+
+    /* a list is parsed from its five pages */
+    pages = n_ids[type] * (type == SCRAP500_PAGE_LIST ? 5 : 1);
+
+    for (batch = 0; batch < 2; batch++)
+        printf("%-6s %-6s %8llu %10.3f %10.1f %12.1f %10.1f\n",
+               page_names[type], batch ? "batch" : "single", _llu(pages),
+               cpu[batch]/rounds, pages*rounds/cpu[batch],
+               (double) allocs[batch]/(pages*rounds), peak[batch]/1024.0);
+
+    return 0;
+}
+
+static char program[PATH_MAX];
+
+static struct option const long_opts[] = {
+    { "backend", 1, 0, 'b' },
+    { "datadir", 1, 0, 'd' },
+    { "help", 0, 0, 'h' },
+    { "rounds", 1, 0, 'r' },
+    { 0, 0, 0, 0},
+};
+
+static const char *short_opts = "b:d:hr:";
+
+static const char *usage_str =
+"Usage: %s [options..]\n"
+"\n"
+"  available options:\n"
+"  -b, --backend=<name>   parse pages with <name>: dom (default),\n"
+"                         sax or scan\n"
+"  -d, --datadir=<path>   parse the pages in <path>\n"
+"                         (default: __run/scrap500)\n"
+"  -h, --help             print help message\n"
+"  -r, --rounds=<N>       repeat each test <N> times (default: 3)\n"
+"\n";
+
+static inline void usage(int ec)
+{
+    fprintf(stdout, usage_str, program);
+    exit(ec);
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int optidx = 0;
+    int ch = 0;
+    int type = 0;
+    uint64_t i = 0;
+
+    read_program_name(argv[0], program);
+
+    while ((ch = getopt_long(argc, argv,
+                             short_opts, long_opts, &optidx)) >= 0) {
+        switch (ch) {
+        case 'b':
+            if (scrap500_parser_set_backend(optarg)) {
+                fprintf(stderr, "unknown parser backend: %s\n", optarg);
+                usage(EINVAL);
+            }
+            break;
+
+        case 'd':
+            scrap500_datadir = optarg;
+            break;
+
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+
+        case 'h':
+        default:
+            usage(0);
+            break;
+        }
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+
+    xmlMemSetup(count_free, count_malloc, count_realloc, count_strdup);
+    xmlInitParser();
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        ret = scrap500_cache_page_ids(type, &ids[type], &n_ids[type]);
+        if (ret)
+            goto out;
+
+        for (i = 0; i < n_ids[type]; i++)
+            parse_page(type, ids[type][i]);
+    }
+
+    printf("## %llu lists, %llu sites and %llu systems in %s, "
+           "%d rounds each, %s parser\n",
+           _llu(n_ids[SCRAP500_PAGE_LIST]), _llu(n_ids[SCRAP500_PAGE_SITE]),
+           _llu(n_ids[SCRAP500_PAGE_SYSTEM]), scrap500_datadir, rounds,
+           scrap500_parser_backend_names[scrap500_parser_backend]);
+    printf("%-6s %-6s %8s %10s %10s %12s %10s\n",
+           "type", "ctxt", "pages", "cpu(s)", "pages/s", "allocs/page",
+           "peak(KB)");
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        if (!n_ids[type])
+            continue;
+
+        ret = run_bench(type);
+        if (ret)
+            break;
+    }
+
+out:
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++)
+        free(ids[type]);
+
+    xmlCleanupParser();
+
+    return ret;
+}
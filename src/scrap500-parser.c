@@ -9,12 +9,60 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <libxml/HTMLtree.h>
 
 #include "scrap500.h"
 
+int scrap500_parser_backend = SCRAP500_PARSER_DOM;
+
+const char *scrap500_parser_backend_names[] = {
+    "dom",
+    "sax",
+    "scan",
+};
+
+int scrap500_parser_set_backend(const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < N_SCRAP500_PARSERS; i++) {
+        if (0 == strcmp(name, scrap500_parser_backend_names[i])) {
+            scrap500_parser_backend = i;
+            return 0;
+        }
+    }
+
+    return EINVAL;
+}
+
+/* the elements which keep the blanks after a child element of the same,
+ * from allowPCData[] of libxml2 */
+static const char *text_elements[] = {
+    "a", "abbr", "acronym", "address", "applet", "b", "bdo", "big",
+    "blockquote", "body", "button", "caption", "center", "cite", "code",
+    "dd", "del", "dfn", "div", "dt", "em", "font", "form", "h1", "h2",
+    "h3", "h4", "h5", "h6", "i", "iframe", "ins", "kbd", "label", "legend",
+    "li", "map", "menu", "object", "ol", "p", "pre", "q", "s", "samp",
+    "small", "span", "strike", "strong", "td", "th", "tt", "u", "ul", "var",
+};
+
+static int compare_name(const void *a, const void *b)
+{
+    return strcmp((const char *) a, *(const char **) b);
+}
+
+int scrap500_parser_text_element(const char *name)
+{
+    return NULL != bsearch(name, text_elements,
+                           sizeof(text_elements)/sizeof(text_elements[0]),
+                           sizeof(text_elements[0]), compare_name);
+}
+
 static char *strtrim_dup(char *str)
 {
     char *pos = NULL;
@@ -36,39 +84,269 @@ static char *strtrim_dup(char *str)
     return strdup(pos);
 }
 
-static char *strtolower(char *str)
+static inline int is_digit(int c)
 {
-    char *pos = str;
+    return c >= '0' && c <= '9';
+}
 
-    if (!pos)
-        return NULL;
+/* isspace() in the c locale */
+static inline int is_space(int c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
 
-    while (pos[0] != '\0') {
-        pos[0] = tolower(pos[0]);
+static inline int is_unit_char(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '/';
+}
+
+/* thousands separators are skipped anywhere in a number */
+static inline const char *next_char(const char *pos)
+{
+    do {
         pos++;
+    } while (*pos == ',');
+
+    return pos;
+}
+
+/* the powers of ten that a double holds exactly */
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const struct {
+    const char *name;
+    int base;
+} unit_bases[] = {
+    { "flop/s", SCRAP500_UNIT_FLOPS },
+    { "flops", SCRAP500_UNIT_FLOPS },
+    { "b", SCRAP500_UNIT_BYTE },
+    { "w", SCRAP500_UNIT_WATT },
+};
+
+/* a unit has only letters and '/', which are in lowercase with 0x20 set */
+static inline int unit_base(const char *str, size_t len)
+{
+    size_t i = 0;
+    size_t j = 0;
+    const char *name = NULL;
+
+    for (i = 0; i < sizeof(unit_bases)/sizeof(unit_bases[0]); i++) {
+        name = unit_bases[i].name;
+
+        for (j = 0; j < len && (str[j] | 0x20) == name[j]; j++)
+            ;
+
+        if (j == len && name[len] == '\0')
+            return unit_bases[i].base;
     }
 
-    return str;
+    return SCRAP500_UNIT_NONE;
+}
+
+static inline int unit_prefix(int c)
+{
+    switch (c) {
+    case 'k':
+    case 'K':
+        return 3;
+    case 'M':
+        return 6;
+    case 'G':
+        return 9;
+    case 'T':
+        return 12;
+    case 'P':
+        return 15;
+    case 'E':
+        return 18;
+    default:
+        return 0;
+    }
 }
 
-static int parse_number(const char *str, double *val)
+int scrap500_parser_unit(const char *str, scrap500_unit_t *unit)
+{
+    size_t len = 0;
+    const char *pos = str;
+
+    unit->base = SCRAP500_UNIT_NONE;
+    unit->exp = 0;
+
+    while (is_space(*pos))
+        pos++;
+
+    while (is_unit_char(pos[len]))
+        len++;
+
+    if (len == 0)
+        return ENOENT;
+
+    unit->base = unit_base(pos, len);
+    if (unit->base != SCRAP500_UNIT_NONE)
+        return 0;
+
+    unit->exp = unit_prefix(pos[0]);
+    if (unit->exp)
+        unit->base = unit_base(&pos[1], len - 1);
+
+    if (unit->base == SCRAP500_UNIT_NONE) {
+        unit->base = SCRAP500_UNIT_UNKNOWN;
+        unit->exp = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * converts the number at pos with strtod(), after taking out the separators,
+ * for what the fast path does not take: more digits than a double holds
+ * exactly, large exponents, inf, nan and hexadecimal numbers. returns the end
+ * of the number in str, or NULL if there is none.
+ */
+static const char *slow_number(const char *pos, double *val)
 {
     int i = 0;
+    int n = 0;
+    char *end = NULL;
     char buf[512] = { 0, };
-    const char *pos = NULL;
 
-    errno = 0;
+    for (i = 0; pos[i] != '\0' && n < (int) sizeof(buf) - 1; i++)
+        if (pos[i] != ',')
+            buf[n++] = pos[i];
+
+    *val = strtod(buf, &end);
+
+    n = end - buf;
+    if (n == 0)
+        return NULL;
+
+    /* the end of what strtod() took, in str */
+    for (i = 0; n > 0; i++)
+        if (pos[i] != ',')
+            n--;
+
+    return &pos[i];
+}
+
+int scrap500_parser_number(const char *str, double *val,
+                           scrap500_unit_t *unit)
+{
+    int neg = 0;
+    int exp_neg = 0;
+    int any = 0;
+    int n_digits = 0;
+    int exp10 = 0;
+    int exp = 0;
+    uint64_t mant = 0;
+    const char *start = NULL;
+    const char *end = NULL;
+    const char *pos = str;
+
+    unit->base = SCRAP500_UNIT_NONE;
+    unit->exp = 0;
+
+    while (*pos == ',' || is_space(*pos))
+        pos++;
 
-    for (pos = str; *pos != '\0'; pos++) {
-        if (pos[0] == ',')
+    start = pos;
+
+    if (*pos == '-' || *pos == '+') {
+        neg = *pos == '-';
+        pos = next_char(pos);
+    }
+
+    if (*pos == '0' && (next_char(pos)[0] | 0x20) == 'x')
+        goto slow;
+    if (!is_digit(*pos) && *pos != '.')
+        goto slow;
+
+    for ( ; is_digit(*pos); pos = next_char(pos)) {
+        any = 1;
+        if (mant == 0 && *pos == '0')
             continue;
 
-        buf[i++] = pos[0];
+        if (n_digits++ < 19)
+            mant = mant*10 + (*pos - '0');
+        else
+            exp10++;
+    }
+
+    if (*pos == '.') {
+        for (pos = next_char(pos); is_digit(*pos); pos = next_char(pos)) {
+            any = 1;
+            if (mant == 0 && *pos == '0') {
+                exp10--;
+                continue;
+            }
+
+            if (n_digits++ < 19) {
+                mant = mant*10 + (*pos - '0');
+                exp10--;
+            }
+        }
+    }
+
+    if (!any)
+        return ENOENT;
+
+    end = pos;
+
+    if ((*pos | 0x20) == 'e') {
+        pos = next_char(pos);
+        if (*pos == '-' || *pos == '+') {
+            exp_neg = *pos == '-';
+            pos = next_char(pos);
+        }
+
+        if (is_digit(*pos)) {
+            for ( ; is_digit(*pos); pos = next_char(pos))
+                if (exp < 100000)
+                    exp = exp*10 + (*pos - '0');
+
+            exp10 += exp_neg ? -exp : exp;
+            end = pos;
+        }
     }
 
-    i = sscanf(buf, "%lf", val);
+    /* one rounding of exact operands is rounded correctly */
+    if (n_digits > 19 || mant > (1ULL << 53) || exp10 < -22 || exp10 > 22)
+        goto slow;
+
+    if (exp10 < 0)
+        *val = (double) mant / exact_pow10[-exp10];
+    else
+        *val = (double) mant * exact_pow10[exp10];
+
+    if (neg)
+        *val = -*val;
 
-    return i == 1 ? 0 : errno;
+    goto out;
+
+slow:
+    end = slow_number(start, val);
+    if (!end)
+        return ENOENT;
+
+out:
+    scrap500_parser_unit(end, unit);
+
+    return 0;
+}
+
+/* the number in the unit of want, scaled from its unit if the two differ */
+static inline double scale_number(double val, scrap500_unit_t *unit,
+                                  scrap500_unit_t *want)
+{
+    int exp = unit->exp - want->exp;
+
+    if (unit->base != want->base || exp == 0
+        || exp > 22 || exp < -22)
+        return val;
+
+    return exp > 0 ? val*exact_pow10[exp] : val/exact_pow10[-exp];
 }
 
 static xmlNode *get_child_element(xmlNode *node, const char *name, int nth)
@@ -76,6 +354,9 @@ static xmlNode *get_child_element(xmlNode *node, const char *name, int nth)
     int count = 0;
     xmlNode *current = NULL;
 
+    if (!node)
+        return NULL;    /* e.g., the table of a truncated page */
+
     for (current = node->children; current; current = current->next) {
         if (strcmp((char *) current->name, name))
             continue;
@@ -93,6 +374,9 @@ static char *get_child_text(xmlNode *node, const char *name, int nth)
     int count = 0;
     xmlNode *current = NULL;
 
+    if (!node)
+        return NULL;
+
     for (current = node->children; current; current = current->next) {
         if (strcmp((char *) current->name, name))
             continue;
@@ -144,7 +428,7 @@ static int parse_site_record(xmlNode *node, scrap500_site_t *site)
     return 0;
 }
 
-static inline int parse_system_name(scrap500_system_t *system, const char *str)
+int scrap500_parser_system_name(scrap500_system_t *system, const char *str)
 {
     char *pos = NULL;
     char buf[512] = { 0, };
@@ -171,398 +455,192 @@ out:
     return 0;
 }
 
-enum {
-    SYSATTR_SITE = 1,
-    SYSATTR_URL,
-    SYSATTR_MANUFACTURER,
-    SYSATTR_CORES,
-    SYSATTR_MEMORY,
-    SYSATTR_PROCESSOR,
-    SYSATTR_INTERCONNECT,
-    SYSATTR_LINPACK,
-    SYSATTR_TPEAK,
-    SYSATTR_NMAX,
-    SYSATTR_NHALF,
-    SYSATTR_HPCG,
-    SYSATTR_POWER,
-    SYSATTR_PML,
-    SYSATTR_MCORES,
-    SYSATTR_OS,
-    SYSATTR_COMPILER,
-    SYSATTR_MATHLIB,
-    SYSATTR_MPI,
-    N_SYSATTR,
-};
+#define SYSATTR_ENTRY(field, type, label, first, last, unit)             \
+        [SCRAP500_SYSATTR_##field] = {                                  \
+            #field, label, SCRAP500_ATTR_##type,                        \
+            offsetof(scrap500_system_t, field), unit,                   \
+        },
 
-static const char *attr_names[] = {
-    NULL,
-    "site",
-    "system url",
-    "manufacturer",
-    "cores",
-    "memory",
-    "processor",
-    "interconnect",
-    "linpack performance (rmax)",
-    "theoretical peak (rpeak)",
-    "nmax",
-    "nhalf",
-    "hpcg [tflop/s]",
-    "power",
-    "power measurement level",
-    "measured cores",
-    "operating system",
-    "compiler",
-    "math library",
-    "mpi",
+const scrap500_sysattr_t scrap500_sysattrs[N_SCRAP500_SYSATTRS] = {
+    SCRAP500_SYSTEM_ATTRS(SYSATTR_ENTRY)
 };
 
-static int parse_sysattr_site(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *pos = NULL;
-    char *str = (char *) td->children->properties->children->content;
+/*
+ * a label hashes by its length and its first and last characters, ignoring
+ * case, into a slot of its own, which the compiler fills in with the index of
+ * the attribute plus one. the assertion fails when two labels share a slot,
+ * then the multipliers have to be chosen again.
+ */
+#define SYSATTR_SLOTS   64
 
-    if (!str) {
-        ret = EINVAL;
-        goto out;
-    }
+#define SYSATTR_HASH(len, first, last)                                  \
+        (((len)*2 + ((first) | 0x20) + ((last) | 0x20)*4)               \
+         & (SYSATTR_SLOTS - 1))
 
-    pos = strrchr(str, '/');
-    pos++;
+#define SYSATTR_SLOT(field, type, label, first, last, unit)             \
+        [SYSATTR_HASH(sizeof(label) - 1, first, last)] =                \
+            SCRAP500_SYSATTR_##field + 1,
 
-    system->site_id = strtoull(pos, NULL, 0);
+#define SYSATTR_BIT(field, type, label, first, last, unit)              \
+        | (1ULL << SYSATTR_HASH(sizeof(label) - 1, first, last))
 
-out:
-    return ret;
-}
-
-static int parse_sysattr_url(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->properties->children->content;
-
-    if (str)
-        system->url = strdup(str);
+static const unsigned char attr_slots[SYSATTR_SLOTS] = {
+    SCRAP500_SYSTEM_ATTRS(SYSATTR_SLOT)
+};
 
-    return ret;
-}
+_Static_assert(__builtin_popcountll(0 SCRAP500_SYSTEM_ATTRS(SYSATTR_BIT))
+               == N_SCRAP500_SYSATTRS, "system attribute labels share a slot");
 
-static int parse_sysattr_manufacturer(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
+/*
+ * the compiler cannot read the characters of a label, so the first and last
+ * ones are typed along with it. they are checked against the label before
+ * the first lookup, as a wrong one would have the label never found.
+ */
+#define SYSATTR_KEYS(field, type, label, first, last, unit)             \
+        [SCRAP500_SYSATTR_##field] = { first, last },
 
-    if (str)
-        system->manufacturer = strdup(str);
+static const char attr_keys[N_SCRAP500_SYSATTRS][2] = {
+    SCRAP500_SYSTEM_ATTRS(SYSATTR_KEYS)
+};
 
-    return ret;
-}
+static pthread_once_t attr_keys_once = PTHREAD_ONCE_INIT;
 
-static int parse_sysattr_cores(scrap500_system_t *system, xmlNode *td)
+static void check_attr_keys(void)
 {
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
-
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->cores = val;
-    }
+    int i = 0;
+    size_t len = 0;
+    const char *label = NULL;
 
-    return ret;
-}
+    for (i = 0; i < N_SCRAP500_SYSATTRS; i++) {
+        label = scrap500_sysattrs[i].label;
+        len = strlen(label);
 
-static int parse_sysattr_memory(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
+        if (attr_keys[i][0] == label[0] && attr_keys[i][1] == label[len - 1])
+            continue;
 
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->memory = val;
+        fprintf(stderr, "SCRAP500_SYSTEM_ATTRS: the label \"%s\" should be "
+                        "given '%c' and '%c', not '%c' and '%c'\n",
+                        label, label[0], label[len - 1],
+                        attr_keys[i][0], attr_keys[i][1]);
+        abort();
     }
-
-    return ret;
 }
 
-static int parse_sysattr_processor(scrap500_system_t *system, xmlNode *td)
+/* the attribute of the label of len characters in str, NULL if unknown */
+static inline const scrap500_sysattr_t *system_attr(const char *str,
+                                                    size_t len)
 {
-    int ret = 0;
-    char *str = (char *) td->children->content;
+    int slot = 0;
+    const scrap500_sysattr_t *attr = NULL;
 
-    if (str)
-        system->processor = strdup(str);
-
-    return ret;
-}
-
-static int parse_sysattr_interconnect(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-
-    if (str)
-        system->interconnect = strdup(str);
-
-    return ret;
-}
-
-static int parse_sysattr_linpack(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
-
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->linpack = val;
-    }
-
-    return ret;
-}
+    if (len == 0)
+        return NULL;
 
-static int parse_sysattr_tpeak(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
+    slot = attr_slots[SYSATTR_HASH(len, (unsigned char) str[0],
+                                    (unsigned char) str[len - 1])];
+    if (!slot)
+        return NULL;
 
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->tpeak = val;
-    }
+    attr = &scrap500_sysattrs[slot - 1];
+    if (0 == strncasecmp(str, attr->label, len) && attr->label[len] == '\0')
+        return attr;
 
-    return ret;
+    return NULL;
 }
 
-static int parse_sysattr_nmax(scrap500_system_t *system, xmlNode *td)
+/*
+ * sets the field of the attribute from the row: an id or a link from href,
+ * or the text or the number from content.
+ */
+static int set_system_attr(scrap500_system_t *system,
+                           const scrap500_sysattr_t *attr,
+                           const char *content, const char *href)
 {
     int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
+    double num = .0f;
+    void *val = scrap500_sysattr_field(system, attr);
+    scrap500_unit_t unit = { 0, };
+    scrap500_unit_t want = { 0, };
+
+    switch (attr->type) {
+    case SCRAP500_ATTR_ID:
+        if (!href) {
+            ret = EINVAL;
+            break;
+        }
 
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->nmax = val;
-    }
+        *(uint64_t *) val = scrap500_parser_link_id(href);
+        if (*(uint64_t *) val == 0)
+            ret = EIO;
+        break;
 
-    return ret;
-}
+    case SCRAP500_ATTR_LINK:
+        if (href)
+            *(char **) val = strdup(href);
+        break;
 
-static int parse_sysattr_nhalf(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
+    case SCRAP500_ATTR_STR:
+        if (content)
+            *(char **) val = strdup(content);
+        break;
 
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->nhalf = val;
-    }
+    default:
+        if (!content)
+            break;
 
-    return ret;
-}
+        /* a cell without a number is left 0 */
+        if (scrap500_parser_number(content, &num, &unit))
+            break;
 
-static int parse_sysattr_hpcg(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
+        /* and a number in another unit is kept in that of the attribute */
+        if (unit.base != SCRAP500_UNIT_NONE
+            && 0 == scrap500_parser_unit(attr->unit, &want))
+            num = scale_number(num, &unit, &want);
 
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->hpcg = val;
+        *(double *) val = num;
+        break;
     }
 
     return ret;
 }
 
-static int parse_sysattr_power(scrap500_system_t *system, xmlNode *td)
+int scrap500_parser_system_attr(scrap500_system_t *system, const char *attr_str,
+                                const char *content, const char *href)
 {
     int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
-
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->power = val;
-    }
+    size_t len = 0;
+    const char *pos = NULL;
+    const scrap500_sysattr_t *attr = NULL;
 
-    return ret;
-}
+    pthread_once(&attr_keys_once, check_attr_keys);
 
-static int parse_sysattr_pml(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
-
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->pml = val;
+    /* the label is matched in place, up to the colon */
+    if (attr_str) {
+        pos = strrchr(attr_str, ':');
+        len = pos ? (size_t) (pos - attr_str) : strlen(attr_str);
     }
 
-    return ret;
-}
-
-static int parse_sysattr_mcores(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-    char *unit = NULL;
-    double val = .0f;
-
-    if (str) {
-        ret = parse_number(str, &val);
-        if (ret)
-            fprintf(stderr, "cannot parse %s: %s\n", str, strerror(ret));
-        else
-            system->mcores = val;
+    attr = system_attr(attr_str, len);
+    if (!attr) {
+        fprintf(stderr, "unknown attribute: %.*s\n",
+                        (int) len, __strprint(attr_str));
+        ret = EINVAL;
+        goto out;
     }
 
-    return ret;
-}
-
-static int parse_sysattr_os(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-
-    if (str)
-        system->os = strdup(str);
-
-    return ret;
-}
-
-static int parse_sysattr_compiler(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-
-    if (str)
-        system->compiler = strdup(str);
-
-    return ret;
-}
-
-static int parse_sysattr_mathlib(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-
-    if (str)
-        system->mathlib = strdup(str);
-
-    return ret;
-}
-
-static int parse_sysattr_mpi(scrap500_system_t *system, xmlNode *td)
-{
-    int ret = 0;
-    char *str = (char *) td->children->content;
-
-    if (str)
-        system->mpi = strdup(str);
+    ret = set_system_attr(system, attr, content, href);
 
+out:
     return ret;
 }
 
-static int (*parse_sysattr_funcs[])(scrap500_system_t *, xmlNode *) = {
-    NULL,
-    parse_sysattr_site,
-    parse_sysattr_url,
-    parse_sysattr_manufacturer,
-    parse_sysattr_cores,
-    parse_sysattr_memory,
-    parse_sysattr_processor,
-    parse_sysattr_interconnect,
-    parse_sysattr_linpack,
-    parse_sysattr_tpeak,
-    parse_sysattr_nmax,
-    parse_sysattr_nhalf,
-    parse_sysattr_hpcg,
-    parse_sysattr_power,
-    parse_sysattr_pml,
-    parse_sysattr_mcores,
-    parse_sysattr_os,
-    parse_sysattr_compiler,
-    parse_sysattr_mathlib,
-    parse_sysattr_mpi,
-};
-
-static inline int system_attr(const char *str)
-{
-    int i = 0;
-
-    for (i = 1; i < N_SYSATTR; i++)
-        if (0 == strcmp(str, attr_names[i]))
-            return i;
-
-    return 0;
-}
-
-static int parse_system_attribute(scrap500_system_t *system,
-                                  const char *attr_str, xmlNode *td)
+/* the value of the first attribute of the node, e.g., href of an anchor */
+static char *get_first_attr(xmlNode *node)
 {
-    int ret = 0;
-    int attr = 0;
-    char *pos = NULL;
-    char buf[1024] = { 0, };
+    if (node->properties && node->properties->children)
+        return (char *) node->properties->children->content;
 
-    sprintf(buf, "%s", attr_str);
-    pos = strrchr(buf, ':');
-    if (pos)
-        pos[0] = '\0';
-
-    attr = system_attr(strtolower(buf));
-    if (0 == attr || attr >= N_SYSATTR) {
-        fprintf(stderr, "unknown attribute: %s\n", buf);
-        ret = EINVAL;
-        goto out;
-    }
-
-    ret = parse_sysattr_funcs[attr](system, td);
-
-out:
-    return ret;
+    return NULL;
 }
 
 static int parse_system_table(scrap500_system_t *system, xmlNode *table)
@@ -593,7 +671,9 @@ static int parse_system_table(scrap500_system_t *system, xmlNode *table)
 
         attr_str = get_child_text(tr, "th", 1);
 
-        ret = parse_system_attribute(system, attr_str, td);
+        ret = scrap500_parser_system_attr(system, attr_str,
+                                          (char *) td->children->content,
+                                          get_first_attr(td->children));
         if (ret) {
             fprintf(stderr, "failed to parse attribute %s\n", attr_str);
             goto out;
@@ -612,7 +692,7 @@ static int parse_system_record(xmlNode *node, scrap500_system_t *system)
 
     str = get_child_text(node, "h1", 1);
     if (str) {
-        ret = parse_system_name(system, str);
+        ret = scrap500_parser_system_name(system, str);
         if (ret) {
             fprintf(stderr, "failed to parse system name: %s\n", str);
             goto out;
@@ -642,26 +722,22 @@ static int parse_list_td_rank(xmlNode *td)
 
 static uint64_t parse_list_td_site(xmlNode *td)
 {
-    char *pos = NULL;
     char *str = NULL;
     xmlNode *a = get_child_element(td, "a", 1);
 
     str = (char *) a->properties->children->content;
-    pos = strrchr(str, '/');
 
-    return atol(&pos[1]);
+    return scrap500_parser_link_id(str);
 }
 
 static uint64_t parse_list_td_system(xmlNode *td)
 {
-    char *pos = NULL;
     char *str = NULL;
     xmlNode *a = get_child_element(td, "a", 1);
 
     str = (char *) a->properties->children->content;
-    pos = strrchr(str, '/');
 
-    return atol(&pos[1]);
+    return scrap500_parser_link_id(str);
 }
 
 static int parse_list_table(scrap500_list_t *list, xmlNode *table)
@@ -679,6 +755,11 @@ static int parse_list_table(scrap500_list_t *list, xmlNode *table)
     do {
         td = get_child_element(tr, "td", 1);    /* col1: rank pos */
         pos = parse_list_td_rank(td);
+        if (pos < 1 || pos > 500) {
+            ret = EIO;
+            break;
+        }
+
         rank = &list->rank[pos-1];
         rank->rank = pos;
 
@@ -688,59 +769,106 @@ static int parse_list_table(scrap500_list_t *list, xmlNode *table)
         td = get_child_element(tr, "td", 3);    /* col3: system */
         rank->system_id = parse_list_td_system(td);
 
+        if (!rank->site_id || !rank->system_id) {
+            ret = EIO;
+            break;
+        }
+
         tr = tr->next;
         count++;
     } while (count < 100);
 
+    if (ret)
+        fprintf(stderr, "malformed row %d (list=%d)\n", count + 1, list->id);
+
     return ret;
 }
 
+/*
+ * all pages share the same layout: the record is in the first div of the
+ * first div of the second div in the body.
+ */
+static xmlNode *get_content_div(htmlDocPtr doc)
+{
+    xmlNode *current = xmlDocGetRootElement(doc);
+
+    if (current)
+        current = get_child_element(current, "body", 1);
+    if (current)
+        current = get_child_element(current, "div", 2);
+    if (current)
+        current = get_child_element(current, "div", 1);
+    if (current)
+        current = get_child_element(current, "div", 1);
+
+    return current;
+}
+
+int scrap500_parser_parse_list_doc(scrap500_list_t *list, htmlDocPtr doc)
+{
+    xmlNode *current = NULL;
+
+    current = get_content_div(doc);
+    if (current)
+        current = get_child_element(current, "table", 1);
+
+    if (!current) {
+        fprintf(stderr, "cannot parse the document (list=%d)\n", list->id);
+        return EIO;
+    }
+
+    return parse_list_table(list, current);
+}
+
 int scrap500_parser_parse_list(scrap500_list_t *list)
 {
     int ret = 0;
     int page = 0;
-    int opts = 0;
-    char *str = NULL;
-    char filename[PATH_MAX] = { 0, };
     htmlDocPtr doc = NULL;
-    xmlNode *root = NULL;
-    xmlNode *current = NULL;
 
     if (!list)
         return EINVAL;
 
-    opts = HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR
-           | HTML_PARSE_NOWARNING | HTML_PARSE_NONET;
+    if (scrap500_parser_backend == SCRAP500_PARSER_SAX)
+        return scrap500_sax_parse_list(list);
+    else if (scrap500_parser_backend == SCRAP500_PARSER_SCAN)
+        return scrap500_scan_parse_list(list);
 
     for (page = 1; page <= 5; page++) {
-        scrap500_list_html_filename(list, page, filename);
-
-        doc = htmlReadFile(filename, NULL, opts);
+        doc = scrap500_cache_read_page(SCRAP500_PAGE_LIST,
+                                       scrap500_list_page_id(list->id, page));
         if (!doc) {
             fprintf(stderr, "cannot parse the document (list=%d)\n", list->id);
-            ret = EIO;
-            goto out;
+            return EIO;
         }
 
-        root = xmlDocGetRootElement(doc);
-        if (!root) {
-            fprintf(stderr, "cannot parse the document (list=%d)\n", list->id);
-            ret = EIO;
-            goto out;
-        }
+        ret = scrap500_parser_parse_list_doc(list, doc);
+        xmlFreeDoc(doc);
 
-        current = get_child_element(root, "body", 1);
-        current = get_child_element(current, "div", 2);
-        current = get_child_element(current, "div", 1);
-        current = get_child_element(current, "div", 1);
-        current = get_child_element(current, "table", 1);
+        if (ret)
+            break;
+    }
+
+    return ret;
+}
+
+int scrap500_parser_parse_site_doc(uint64_t site_id, htmlDocPtr doc,
+                                   scrap500_site_t *site)
+{
+    int ret = 0;
+    xmlNode *current = NULL;
 
-        ret = parse_list_table(list, current);
+    current = get_content_div(doc);
+    if (!current) {
+        fprintf(stderr, "cannot parse the document (site=%llu)\n",
+                        _llu(site_id));
+        return EIO;
     }
 
-out:
-    if (doc)
-        xmlFreeDoc(doc);
+    site->id = site_id;
+    ret = parse_site_record(current, site);
+    if (ret)
+        fprintf(stderr, "failed to parse the site record.\n");
 
     return ret;
 }
@@ -748,44 +876,43 @@ out:
 int scrap500_parser_parse_site(uint64_t site_id, scrap500_site_t *site)
 {
     int ret = 0;
-    int opts = 0;
-    char filename[PATH_MAX] = { 0, };
     htmlDocPtr doc = NULL;
-    xmlNode *root = NULL;
-    xmlNode *current = NULL;
-
-    scrap500_site_html_filename(site_id, filename);
 
-    opts = HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR
-           | HTML_PARSE_NOWARNING | HTML_PARSE_NONET;
+    if (scrap500_parser_backend == SCRAP500_PARSER_SAX)
+        return scrap500_sax_parse_site(site_id, site);
+    else if (scrap500_parser_backend == SCRAP500_PARSER_SCAN)
+        return scrap500_scan_parse_site(site_id, site);
 
-    doc = htmlReadFile(filename, NULL, opts);
+    doc = scrap500_cache_read_page(SCRAP500_PAGE_SITE, site_id);
     if (!doc) {
-        fprintf(stderr, "cannot parse the document %s\n", filename);
-        ret = EIO;
-        goto out;
+        fprintf(stderr, "cannot parse the document (site=%llu)\n",
+                        _llu(site_id));
+        return EIO;
     }
 
-    root = xmlDocGetRootElement(doc);
-    if (!root) {
-        fprintf(stderr, "cannot parse the document %s\n", filename);
-        ret = EIO;
-        goto out;
-    }
+    ret = scrap500_parser_parse_site_doc(site_id, doc, site);
+    xmlFreeDoc(doc);
 
-    current = get_child_element(root, "body", 1);
-    current = get_child_element(current, "div", 2);
-    current = get_child_element(current, "div", 1);
-    current = get_child_element(current, "div", 1);
+    return ret;
+}
 
-    site->id = site_id;
-    ret = parse_site_record(current, site);
-    if (ret)
-        fprintf(stderr, "failed to parse the site record.\n");
+int scrap500_parser_parse_system_doc(uint64_t system_id, htmlDocPtr doc,
+                                     scrap500_system_t *system)
+{
+    int ret = 0;
+    xmlNode *current = NULL;
 
-out:
-    if (doc)
-        xmlFreeDoc(doc);
+    current = get_content_div(doc);
+    if (!current) {
+        fprintf(stderr, "cannot parse the document (system=%llu)\n",
+                        _llu(system_id));
+        return EIO;
+    }
+
+    system->id = system_id;
+    ret = parse_system_record(current, system);
+    if (ret)
+        fprintf(stderr, "failed to parse the system record.\n");
 
     return ret;
 }
@@ -793,48 +920,90 @@ out:
 int scrap500_parser_parse_system(uint64_t system_id, scrap500_system_t *system)
 {
     int ret = 0;
-    int opts = 0;
-    char filename[PATH_MAX] = { 0, };
     htmlDocPtr doc = NULL;
-    xmlNode *root = NULL;
+
+    if (scrap500_parser_backend == SCRAP500_PARSER_SAX)
+        return scrap500_sax_parse_system(system_id, system);
+    else if (scrap500_parser_backend == SCRAP500_PARSER_SCAN)
+        return scrap500_scan_parse_system(system_id, system);
+
+    doc = scrap500_cache_read_page(SCRAP500_PAGE_SYSTEM, system_id);
+    if (!doc) {
+        fprintf(stderr, "cannot parse the document (system=%llu)\n",
+                        _llu(system_id));
+        return EIO;
+    }
+
+    ret = scrap500_parser_parse_system_doc(system_id, doc, system);
+    xmlFreeDoc(doc);
+
+    return ret;
+}
+
+
+/*
+ * the trimmed page keeps the h1s and the table of the content div, at the
+ * same place in an otherwise empty page, so that it is parsed just like the
+ * original. a page without the content div is kept whole.
+ */
+int scrap500_parser_trim_doc(htmlDocPtr doc, uint64_t length, uint32_t crc,
+                             char **_buf, size_t *_len)
+{
+    int ret = 0;
+    char *str = NULL;
+    xmlNode *div = NULL;
     xmlNode *current = NULL;
+    xmlBufferPtr buf = NULL;
+    char marker[128] = { 0, };
 
-    scrap500_system_html_filename(system_id, filename);
+    buf = xmlBufferCreate();
+    if (!buf)
+        return ENOMEM;
 
-    opts = HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR
-           | HTML_PARSE_NOWARNING | HTML_PARSE_NONET;
+    sprintf(marker, SCRAP500_TRIM_MARKER " length=%llu crc32=%08x -->\n",
+                    _llu(length), crc);
+    xmlBufferCat(buf, (xmlChar *) marker);
 
-    doc = htmlReadFile(filename, NULL, opts);
-    if (!doc) {
-        fprintf(stderr, "cannot parse the document %s\n", filename);
-        ret = EIO;
-        goto out;
+    if (doc)
+        div = get_content_div(doc);
+
+    if (div) {
+        xmlBufferCat(buf, (xmlChar *) "<html><body>"
+                                      "<div></div><div><div><div>\n");
+
+        for (current = div->children; current; current = current->next) {
+            if (current->type != XML_ELEMENT_NODE
+                || (strcmp((char *) current->name, "h1")
+                    && strcmp((char *) current->name, "table")))
+                continue;
+
+            htmlNodeDump(buf, doc, current);
+            xmlBufferCat(buf, (xmlChar *) "\n");
+        }
+
+        xmlBufferCat(buf, (xmlChar *) "</div></div></div>"
+                                      "</body></html>\n");
     }
+    else if (doc && xmlDocGetRootElement(doc))
+        htmlNodeDump(buf, doc, xmlDocGetRootElement(doc));
 
-    root = xmlDocGetRootElement(doc);
-    if (!root) {
-        fprintf(stderr, "cannot parse the document %s\n", filename);
-        ret = EIO;
+    str = malloc(xmlBufferLength(buf) + 1);
+    if (!str) {
+        ret = ENOMEM;
         goto out;
     }
 
-    current = get_child_element(root, "body", 1);
-    current = get_child_element(current, "div", 2);
-    current = get_child_element(current, "div", 1);
-    current = get_child_element(current, "div", 1);
+    memcpy(str, xmlBufferContent(buf), xmlBufferLength(buf) + 1);
 
-    system->id = system_id;
-    ret = parse_system_record(current, system);
-    if (ret)
-        fprintf(stderr, "failed to parse the system record.\n");
+    *_buf = str;
+    *_len = xmlBufferLength(buf);
 
 out:
-    if (doc)
-        xmlFreeDoc(doc);
+    xmlBufferFree(buf);
+
     return ret;
 }
 
-
 int scrap500_parser_parse_specs(scrap500_list_t *list)
 {
     int ret = 0;
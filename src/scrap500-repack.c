@@ -0,0 +1,793 @@
+/* Copyright (C) 2019 Hyogi Sim <simh@ornl.gov>
+ * ---------------------------------------------------------------------------
+ * See COPYING for the license.
+ *
+ * scrap500-repack moves the cached pages of a data directory, in their own
+ * files or in the pack, into a new pack compressed against a zstd dictionary.
+ * the pages share most of their markup (header, navigation, footer), which
+ * per-page compression cannot exploit. a dictionary is trained on a sample of
+ * each type of pages, then the pages are read one at a time and written to
+ * <outdir>/pages.pack.new, along with the dictionary in pages.dict.new. the
+ * two replace pages.pack and pages.dict together, where the readers find
+ * them, as the records of the old pack may be compressed against the old
+ * dictionary. every page is then read back from the pack in random order, to
+ * report the decode throughput, and the files of the pages are removed if
+ * the pack is written to the data directory itself.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <zstd.h>
+#include <zdict.h>
+
+#include "scrap500.h"
+
+char *scrap500_datadir = "/tmp/scrap500";
+
+static char *outdir;
+static uint32_t n_samples = 300;        /* per type */
+static size_t dict_size = 112640;
+static int level = 3;
+
+struct _page {
+    int type;
+    uint64_t id;
+    uint64_t len;       /* and crc32 of the page, to check it when read back */
+    uint32_t crc;
+};
+
+typedef struct _page page_t;
+
+static page_t *pages;
+static uint64_t n_pages;
+static uint64_t pages_size;
+
+static const char *page_names[] = {
+    "list",
+    "site",
+    "system",
+};
+
+static inline double now_sec(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static inline double mb(uint64_t bytes)
+{
+    return bytes/(1024.0*1024.0);
+}
+
+static inline void out_filename(char *buf, const char *name)
+{
+    sprintf(buf, "%s/%s", outdir, name);
+}
+
+static int add_page(int type, uint64_t id)
+{
+    page_t *p = NULL;
+
+    if (n_pages == pages_size) {
+        pages_size = pages_size ? 2*pages_size : 4096;
+        p = realloc(pages, pages_size*sizeof(*p));
+        if (!p)
+            return ENOMEM;
+        pages = p;
+    }
+
+    p = &pages[n_pages++];
+    p->type = type;
+    p->id = id;
+    p->len = 0;
+    p->crc = 0;
+
+    return 0;
+}
+
+/*
+ * collects the ids of the cached pages of the type, in their own files or in
+ * the pack. the pages themselves are read as they are packed.
+ */
+static int collect_pages(int type)
+{
+    int ret = 0;
+    int page = 0;
+    uint64_t i = 0;
+    uint64_t id = 0;
+    uint64_t count = 0;
+    uint64_t *ids = NULL;
+
+    ret = scrap500_cache_page_ids(type, &ids, &count);
+    if (ret) {
+        fprintf(stderr, "failed to collect the %s pages: %s\n",
+                        page_names[type], strerror(ret));
+        return ret;
+    }
+
+    for (i = 0; i < count && !ret; i++) {
+        if (type != SCRAP500_PAGE_LIST) {
+            ret = add_page(type, ids[i]);
+            continue;
+        }
+
+        /* the ids of lists are those of their first pages */
+        for (page = 1; page <= 5 && !ret; page++) {
+            id = scrap500_list_page_id((uint32_t) ids[i], page);
+            if (scrap500_cache_has_page(type, id))
+                ret = add_page(type, id);
+        }
+    }
+
+    free(ids);
+
+    return ret;
+}
+
+static int read_page(page_t *p, char **buf, size_t *len)
+{
+    int ret = 0;
+
+    ret = scrap500_cache_read_page_data(p->type, p->id, buf, len);
+    if (ret)
+        fprintf(stderr, "failed to read %s %llu: %s\n",
+                        page_names[p->type], _llu(p->id), strerror(ret));
+
+    return ret;
+}
+
+/*
+ * trains the dictionary on up to n_samples pages of each type, spread over
+ * the whole range of each.
+ */
+static int train_dict(void **_dict, size_t *_len)
+{
+    int ret = 0;
+    int type = 0;
+    uint64_t i = 0;
+    uint64_t n = 0;
+    uint64_t count = 0;
+    uint64_t n_type = 0;
+    uint64_t step = 0;
+    size_t total = 0;
+    size_t len = 0;
+    size_t *sizes = NULL;
+    char *samples = NULL;
+    char *buf = NULL;
+    char *tmp = NULL;
+    void *dict = NULL;
+
+    sizes = calloc(n_pages, sizeof(*sizes));
+    dict = malloc(dict_size);
+    if (!sizes || !dict) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        for (n_type = 0, i = 0; i < n_pages; i++)
+            n_type += pages[i].type == type;
+
+        step = n_type > n_samples ? n_type/n_samples : 1;
+
+        for (n = 0, i = 0; i < n_pages; i++) {
+            if (pages[i].type != type || n++ % step)
+                continue;
+
+            ret = read_page(&pages[i], &buf, &len);
+            if (ret)
+                goto out;
+
+            tmp = realloc(samples, total + len);
+            if (!tmp) {
+                ret = ENOMEM;
+                goto out;
+            }
+
+            samples = tmp;
+            memcpy(&samples[total], buf, len);
+            total += len;
+            sizes[count++] = len;
+
+            free(buf);
+            buf = NULL;
+        }
+    }
+
+    len = ZDICT_trainFromBuffer(dict, dict_size, samples, sizes,
+                                (unsigned) count);
+    if (ZDICT_isError(len)) {
+        fprintf(stderr, "failed to train the dictionary: %s\n",
+                        ZDICT_getErrorName(len));
+        ret = EINVAL;
+        goto out;
+    }
+
+    printf("## trained a %zu byte dictionary on %llu pages (%.1f MB)\n",
+           len, _llu(count), mb(total));
+
+    *_dict = dict;
+    *_len = len;
+    dict = NULL;
+
+out:
+    free(buf);
+    free(sizes);
+    free(samples);
+    free(dict);
+
+    return ret;
+}
+
+static int write_dict(const void *dict, size_t len)
+{
+    int ret = 0;
+    FILE *fp = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    out_filename(filename, "pages.dict.new");
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        ret = errno;
+        goto out;
+    }
+
+    if (fwrite(dict, 1, len, fp) != len || fflush(fp) || fsync(fileno(fp)))
+        ret = errno ? errno : EIO;
+
+    if (fclose(fp) && !ret)
+        ret = errno;
+
+out:
+    if (ret) {
+        fprintf(stderr, "failed to write %s: %s\n", filename, strerror(ret));
+        unlink(filename);
+    }
+
+    return ret;
+}
+
+/*
+ * compresses every page against the dictionary into the new pack, and
+ * reports the sizes by type, along with those without the dictionary.
+ */
+static int write_pack(const void *dict, size_t dict_len)
+{
+    int ret = 0;
+    int type = 0;
+    uint64_t i = 0;
+    size_t n = 0;
+    size_t len = 0;
+    size_t bound = 0;
+    char *page = NULL;
+    char *buf = NULL;
+    double start = 0;
+    double elapsed = 0;
+    uint64_t raw[3] = { 0, };
+    uint64_t plain[3] = { 0, };
+    uint64_t packed[3] = { 0, };
+    uint64_t count[3] = { 0, };
+    ZSTD_CCtx *zc = NULL;
+    ZSTD_CDict *cdict = NULL;
+    scrap500_pack_writer_t *w = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    zc = ZSTD_createCCtx();
+    cdict = ZSTD_createCDict(dict, dict_len, level);
+    if (!zc || !cdict) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    out_filename(filename, "pages.pack.new");
+
+    w = scrap500_pack_create(filename, ZSTD_getDictID_fromDict(dict, dict_len));
+    if (!w) {
+        ret = errno ? errno : EIO;
+        fprintf(stderr, "failed to create %s: %s\n", filename, strerror(ret));
+        goto out;
+    }
+
+    start = now_sec();
+
+    for (i = 0; i < n_pages; i++) {
+        type = pages[i].type;
+
+        ret = read_page(&pages[i], &page, &n);
+        if (ret)
+            goto out;
+
+        pages[i].len = n;
+        pages[i].crc = crc32(0, (const Bytef *) page, (uInt) n);
+
+        if (ZSTD_compressBound(n) > bound) {
+            bound = ZSTD_compressBound(n);
+            free(buf);
+            buf = malloc(bound);
+            if (!buf) {
+                ret = ENOMEM;
+                goto out;
+            }
+        }
+
+        len = ZSTD_compressCCtx(zc, buf, bound, page, n, level);
+        if (!ZSTD_isError(len))
+            plain[type] += len;
+
+        len = ZSTD_compress_usingCDict(zc, buf, bound, page, n, cdict);
+        if (ZSTD_isError(len)) {
+            fprintf(stderr, "failed to compress page %llu: %s\n",
+                            _llu(pages[i].id), ZSTD_getErrorName(len));
+            ret = EIO;
+            goto out;
+        }
+
+        ret = scrap500_pack_write(w, type, pages[i].id, buf, len);
+        if (ret) {
+            fprintf(stderr, "failed to write %s: %s\n",
+                            filename, strerror(ret));
+            goto out;
+        }
+
+        raw[type] += n;
+        packed[type] += len;
+        count[type]++;
+
+        free(page);
+        page = NULL;
+    }
+
+    ret = scrap500_pack_finish(w);
+    w = NULL;
+    if (ret) {
+        fprintf(stderr, "failed to finish %s: %s\n", filename, strerror(ret));
+        goto out;
+    }
+
+    elapsed = now_sec() - start;
+
+    printf("## %llu pages packed in %.3f sec (level %d)\n",
+           _llu(n_pages), elapsed, level);
+    printf("%-8s %8s %10s %10s %8s %10s %8s\n",
+           "type", "pages", "raw(MB)", "zstd(MB)", "ratio",
+           "dict(MB)", "ratio");
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        if (!count[type])
+            continue;
+
+        printf("%-8s %8llu %10.2f %10.2f %8.2f %10.2f %8.2f\n",
+               page_names[type], _llu(count[type]), mb(raw[type]),
+               mb(plain[type]), (double) raw[type]/plain[type],
+               mb(packed[type]), (double) raw[type]/packed[type]);
+
+        if (type) {
+            raw[0] += raw[type];
+            plain[0] += plain[type];
+            packed[0] += packed[type];
+        }
+    }
+
+    /* the dictionary is part of the cost */
+    packed[0] += dict_len;
+
+    printf("%-8s %8llu %10.2f %10.2f %8.2f %10.2f %8.2f\n",
+           "total", _llu(n_pages), mb(raw[0]), mb(plain[0]),
+           (double) raw[0]/plain[0], mb(packed[0]),
+           (double) raw[0]/packed[0]);
+
+out:
+    scrap500_pack_abort(w);
+    free(page);
+    free(buf);
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeCCtx(zc);
+
+    return ret;
+}
+
+static int rename_out(const char *from, const char *to)
+{
+    char src[PATH_MAX] = { 0, };
+    char dst[PATH_MAX] = { 0, };
+
+    out_filename(src, from);
+    out_filename(dst, to);
+
+    if (rename(src, dst) < 0) {
+        fprintf(stderr, "failed to rename %s: %s\n", src, strerror(errno));
+        return errno;
+    }
+
+    return 0;
+}
+
+/*
+ * puts the new pack and dictionary in place of the old ones. the old index
+ * goes first, as it would otherwise be taken for that of the new pack. the
+ * new pack names its dictionary, so if this is cut short after the pack, the
+ * rename of the dictionary is finished when the pack is opened.
+ */
+static int commit_pack(void)
+{
+    int ret = 0;
+    char filename[PATH_MAX] = { 0, };
+
+    out_filename(filename, "pages.pack.idx");
+
+    if (unlink(filename) < 0 && errno != ENOENT) {
+        fprintf(stderr, "failed to remove %s: %s\n",
+                        filename, strerror(errno));
+        return errno;
+    }
+
+    ret = rename_out("pages.pack.new", "pages.pack");
+    if (!ret)
+        ret = rename_out("pages.dict.new", "pages.dict");
+    if (!ret)
+        ret = rename_out("pages.pack.new.idx", "pages.pack.idx");
+
+    return ret;
+}
+
+/*
+ * the pages are stored anew, so their sizes and checksums in the manifest of
+ * the data directory are updated, for 'scrap500-build --verify'.
+ */
+static int update_index(void)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    scrap500_page_meta_t meta = { 0, };
+    char filename[PATH_MAX] = { 0, };
+
+    out_filename(filename, "index.db");
+    if (access(filename, F_OK))
+        return 0;
+
+    ret = scrap500_index_open();
+    if (ret)
+        return ret;
+
+    for (i = 0; i < n_pages && !ret; i++) {
+        if (scrap500_index_lookup(pages[i].type, pages[i].id, &meta))
+            continue;
+
+        ret = scrap500_cache_checksum(pages[i].type, pages[i].id, &meta);
+        if (!ret)
+            ret = scrap500_index_update(&meta);
+    }
+
+    scrap500_index_close();
+
+    if (ret)
+        fprintf(stderr, "failed to update the manifest: %s\n",
+                        strerror(ret));
+
+    return ret;
+}
+
+/*
+ * reads every page back by its id, in random order, and checks it against
+ * the original.
+ */
+static int verify_pack(void)
+{
+    int ret = 0;
+    uint64_t i = 0;
+    uint64_t j = 0;
+    uint64_t bytes = 0;
+    uint64_t n_bad = 0;
+    uint64_t *order = NULL;
+    uint64_t tmp = 0;
+    size_t len = 0;
+    char *buf = NULL;
+    double start = 0;
+    double elapsed = 0;
+
+    order = calloc(n_pages, sizeof(*order));
+    if (!order)
+        return ENOMEM;
+
+    for (i = 0; i < n_pages; i++)
+        order[i] = i;
+
+    srand48(time(NULL));
+    for (i = n_pages - 1; i > 0; i--) {
+        j = (uint64_t) (drand48()*(i + 1));
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    /* maps the pack and loads the dictionary */
+    if (n_pages) {
+        ret = scrap500_cache_read_page_data(pages[0].type, pages[0].id,
+                                            &buf, &len);
+        free(buf);
+        if (ret)
+            goto out;
+    }
+
+    start = now_sec();
+
+    for (i = 0; i < n_pages; i++) {
+        page_t *p = &pages[order[i]];
+
+        ret = scrap500_cache_read_page_data(p->type, p->id, &buf, &len);
+        if (ret) {
+            fprintf(stderr, "failed to read %s %llu back: %s\n",
+                            page_names[p->type], _llu(p->id), strerror(ret));
+            goto out;
+        }
+
+        if (len != p->len
+            || crc32(0, (const Bytef *) buf, (uInt) len) != p->crc)
+            n_bad++;
+
+        bytes += len;
+        free(buf);
+    }
+
+    elapsed = now_sec() - start;
+
+    printf("## decoded %llu pages by id in %.3f sec: %.1f MB/s, "
+           "%.0f pages/s\n",
+           _llu(n_pages), elapsed, mb(bytes)/elapsed, n_pages/elapsed);
+
+    if (n_bad) {
+        fprintf(stderr, "%llu pages do not match the originals\n",
+                        _llu(n_bad));
+        ret = EIO;
+    }
+
+out:
+    free(order);
+
+    return ret;
+}
+
+/*
+ * removes the files of the pages, which are all in the pack now.
+ */
+static void remove_files(void)
+{
+    uint64_t i = 0;
+    uint64_t count = 0;
+    page_t *p = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    for (i = 0; i < n_pages; i++) {
+        p = &pages[i];
+
+        switch (p->type) {
+        case SCRAP500_PAGE_LIST:
+            scrap500_list_page_html_filename((uint32_t) (p->id/10), p->id%10,
+                                             filename);
+            break;
+        case SCRAP500_PAGE_SITE:
+            scrap500_site_html_filename(p->id, filename);
+            break;
+        default:
+            scrap500_system_html_filename(p->id, filename);
+            break;
+        }
+
+        if (0 == unlink(filename))
+            count++;
+        else if (errno != ENOENT)
+            fprintf(stderr, "failed to remove %s: %s\n",
+                            filename, strerror(errno));
+    }
+
+    printf("## removed %llu page files from %s\n", _llu(count), outdir);
+}
+
+static int same_dir(const char *a, const char *b)
+{
+    struct stat sa = { 0, };
+    struct stat sb = { 0, };
+
+    if (stat(a, &sa) < 0 || stat(b, &sb) < 0)
+        return 0;
+
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/*
+ * prints a page of the pack, e.g., system:179384.
+ */
+static int print_page(const char *str)
+{
+    int ret = 0;
+    int type = 0;
+    uint64_t id = 0;
+    size_t len = 0;
+    char *buf = NULL;
+    const char *pos = strchr(str, ':');
+
+    if (!pos)
+        return EINVAL;
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++)
+        if (strlen(page_names[type]) == (size_t) (pos - str)
+            && !strncmp(str, page_names[type], pos - str))
+            break;
+
+    id = strtoull(&pos[1], NULL, 10);
+    if (type > SCRAP500_PAGE_SYSTEM || !id)
+        return EINVAL;
+
+    ret = scrap500_cache_read_page_data(type, id, &buf, &len);
+    if (ret) {
+        fprintf(stderr, "cannot read %s: %s\n", str, strerror(ret));
+        return ret;
+    }
+
+    fwrite(buf, 1, len, stdout);
+    free(buf);
+
+    return 0;
+}
+
+static char program[PATH_MAX];
+
+static struct option const long_opts[] = {
+    { "datadir", 1, 0, 'd' },
+    { "get", 1, 0, 'g' },
+    { "help", 0, 0, 'h' },
+    { "level", 1, 0, 'L' },
+    { "output", 1, 0, 'o' },
+    { "samples", 1, 0, 's' },
+    { "dict-size", 1, 0, 'S' },
+    { 0, 0, 0, 0},
+};
+
+static const char *short_opts = "d:g:hL:o:s:S:";
+
+static const char *usage_str =
+"Usage: %s [options..]\n"
+"\n"
+"  available options:\n"
+"  -d, --datadir=<path>   pack the pages in <path> (default: /tmp/scrap500)\n"
+"  -g, --get=<type:id>    print a page of the pack in <path>, e.g., site:47\n"
+"  -h, --help             print help message\n"
+"  -L, --level=<N>        zstd compression level (default: 3)\n"
+"  -o, --output=<path>    write the pack to <path> (default: the datadir)\n"
+"  -s, --samples=<N>      train on <N> pages of each type (default: 300)\n"
+"  -S, --dict-size=<KB>   size of the dictionary (default: 110)\n"
+"\n";
+
+static inline void usage(int ec)
+{
+    fprintf(stdout, usage_str, program);
+    exit(ec);
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int optidx = 0;
+    int ch = 0;
+    int type = 0;
+    int in_place = 0;
+    size_t dict_len = 0;
+    void *dict = NULL;
+    char *get = NULL;
+    char filename[PATH_MAX] = { 0, };
+
+    read_program_name(argv[0], program);
+
+    while ((ch = getopt_long(argc, argv,
+                             short_opts, long_opts, &optidx)) >= 0) {
+        switch (ch) {
+        case 'd':
+            scrap500_datadir = optarg;
+            break;
+
+        case 'g':
+            get = optarg;
+            break;
+
+        case 'L':
+            level = atoi(optarg);
+            break;
+
+        case 'o':
+            outdir = optarg;
+            break;
+
+        case 's':
+            n_samples = (uint32_t) atoi(optarg);
+            break;
+
+        case 'S':
+            dict_size = (size_t) atol(optarg)*1024;
+            break;
+
+        case 'h':
+        default:
+            usage(0);
+            break;
+        }
+    }
+
+    if (get)
+        return print_page(get);
+
+    if (!outdir)
+        outdir = scrap500_datadir;
+    if (n_samples < 1)
+        n_samples = 1;
+
+    for (type = SCRAP500_PAGE_LIST; type <= SCRAP500_PAGE_SYSTEM; type++) {
+        ret = collect_pages(type);
+        if (ret)
+            goto out;
+    }
+
+    if (!n_pages) {
+        fprintf(stderr, "no page found in %s\n", scrap500_datadir);
+        ret = ENOENT;
+        goto out;
+    }
+
+    mkdir(outdir, 0755);
+    in_place = same_dir(outdir, scrap500_datadir);
+
+    ret = train_dict(&dict, &dict_len);
+    if (ret)
+        goto out;
+
+    ret = write_dict(dict, dict_len);
+    if (ret)
+        goto out;
+
+    ret = write_pack(dict, dict_len);
+    if (ret)
+        goto out;
+
+    ret = commit_pack();
+    if (ret)
+        goto out;
+
+    /* from here on, the pack and the dictionary are those in outdir */
+    scrap500_pack_close();
+    scrap500_cache_drop_dict();
+    scrap500_datadir = outdir;
+
+    ret = verify_pack();
+    if (ret)
+        goto out;
+
+    ret = update_index();
+    if (ret)
+        goto out;
+
+    if (in_place)
+        remove_files();
+
+out:
+    if (ret) {
+        out_filename(filename, "pages.dict.new");
+        unlink(filename);
+    }
+
+    free(pages);
+    free(dict);
+
+    return ret;
+}
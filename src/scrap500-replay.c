@@ -0,0 +1,772 @@
+/* Copyright (C) 2019 Hyogi Sim <simh@ornl.gov>
+ * ---------------------------------------------------------------------------
+ * See COPYING for the license.
+ *
+ * scrap500-replay serves the cached pages of a data directory over a loopback
+ * http server, mimicking the url layout of top500.org:
+ *
+ *   /list/<YYYY>/<MM>/?page=<N>  ->  <datadir>/list/<YYYYMM>.<N>.html
+ *   /site/<id>                   ->  <datadir>/site/<id>.html
+ *   /system/<id>                 ->  <datadir>/system/<id>.html
+ *
+ * every response carries an etag and a last-modified date derived from the
+ * file, and conditional requests (If-None-Match) are answered with 304.
+ *
+ * to look more like the real server, each response can be held back for a
+ * fixed latency (plus a random jitter), sent at a limited bandwidth per
+ * connection, and replaced by a 503 (Retry-After: 1) at a given error rate.
+ * compressed pages of the cache are sent as they are with the matching
+ * Content-Encoding, and raw pages can be compressed with gzip on the fly.
+ *
+ * it is used as a stand-in for top500.org when benchmarking the fetcher, e.g.,
+ * scrap500-fetch -u http://127.0.0.1:8500.
+ */
+#include <config.h>
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "scrap500.h"
+
+char *scrap500_datadir = "/tmp/scrap500";
+
+static int port = 8500;
+static int quiet;
+static volatile sig_atomic_t terminate;
+
+static int latency;             /* ms */
+static int jitter;              /* ms */
+static size_t bandwidth;        /* bytes/sec per connection */
+static double error_rate;
+static int gzip_raw;            /* compress raw pages if the client accepts */
+
+static uint64_t n_requests;
+static uint64_t n_notfound;
+static uint64_t n_not_modified;
+static uint64_t n_errors;
+static uint64_t n_bytes;        /* of the response bodies */
+
+#define REPLAY_MAX_EVENTS   256
+#define REPLAY_INBUF_SIZE   8192
+#define REPLAY_TICK_MS      10      /* of the bandwidth limit */
+
+struct _replay_conn {
+    int fd;
+    char inbuf[REPLAY_INBUF_SIZE];
+    size_t inlen;
+    char *outbuf;
+    size_t outlen;
+    size_t outpos;
+    uint64_t due;       /* ms, output is held back until then */
+    struct _replay_conn *prev;
+    struct _replay_conn *next;
+};
+
+typedef struct _replay_conn replay_conn_t;
+
+static replay_conn_t *conns;    /* all open connections */
+
+static inline uint64_t now_ms(void)
+{
+    struct timespec ts = { 0, };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static void handle_signal(int sig)
+{
+    terminate = 1;
+}
+
+static int map_path(const char *path, char *filename)
+{
+    unsigned int year = 0;
+    unsigned int month = 0;
+    unsigned int page = 0;
+    unsigned long long id = 0;
+
+    if (3 == sscanf(path, "/list/%u/%u/?page=%u", &year, &month, &page)) {
+        sprintf(filename, "%s/list/%u%02u.%u.html",
+                          scrap500_datadir, year, month, page);
+        return 0;
+    }
+
+    if (1 == sscanf(path, "/site/%llu", &id)) {
+        scrap500_site_html_filename(id, filename);
+        return 0;
+    }
+
+    if (1 == sscanf(path, "/system/%llu", &id)) {
+        scrap500_system_html_filename(id, filename);
+        return 0;
+    }
+
+    return ENOENT;
+}
+
+static char *read_whole_file(const char *filename, size_t *len)
+{
+    int fd = 0;
+    ssize_t n = 0;
+    size_t pos = 0;
+    char *buf = NULL;
+    struct stat sb = { 0, };
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &sb) < 0)
+        goto out;
+
+    buf = malloc(sb.st_size + 1);
+    if (!buf)
+        goto out;
+
+    while (pos < (size_t) sb.st_size) {
+        n = read(fd, &buf[pos], sb.st_size - pos);
+        if (n <= 0)
+            break;
+        pos += n;
+    }
+
+    *len = pos;
+
+out:
+    close(fd);
+    return buf;
+}
+
+static inline void make_etag(struct stat *sb, char *buf)
+{
+    sprintf(buf, "\"%llx-%llx\"", _llu(sb->st_size), _llu(sb->st_mtime));
+}
+
+/*
+ * copies the value of the request header @name into @val, if present.
+ */
+static int find_header(const char *req, const char *name, char *val, size_t len)
+{
+    size_t n = 0;
+    size_t nlen = strlen(name);
+    const char *pos = strstr(req, "\r\n");
+
+    while (pos && strncmp(pos, "\r\n\r\n", 4)) {
+        pos += 2;
+
+        if (0 == strncasecmp(pos, name, nlen) && pos[nlen] == ':') {
+            pos += nlen + 1;
+            while (*pos == ' ')
+                pos++;
+
+            n = strcspn(pos, "\r\n");
+            if (n >= len)
+                n = len - 1;
+
+            memcpy(val, pos, n);
+            val[n] = '\0';
+            return 1;
+        }
+
+        pos = strstr(pos, "\r\n");
+    }
+
+    return 0;
+}
+
+static int gzip_body(char **body, size_t *len)
+{
+    int ret = 0;
+    uLong size = 0;
+    char *out = NULL;
+    z_stream zs = { 0, };
+
+    /* 15+16: a gzip header instead of zlib's */
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return ENOMEM;
+
+    size = deflateBound(&zs, *len);
+    out = malloc(size);
+    if (!out) {
+        ret = ENOMEM;
+        goto out;
+    }
+
+    zs.next_in = (Bytef *) *body;
+    zs.avail_in = (uInt) *len;
+    zs.next_out = (Bytef *) out;
+    zs.avail_out = (uInt) size;
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        free(out);
+        ret = EIO;
+        goto out;
+    }
+
+    free(*body);
+    *body = out;
+    *len = zs.total_out;
+
+out:
+    deflateEnd(&zs);
+    return ret;
+}
+
+/*
+ * returns the Content-Encoding of the body, NULL for none.
+ */
+static const char *encode_body(const char *req, char **body, size_t *len)
+{
+    char accept[256] = { 0, };
+
+    switch (scrap500_cache_format(*body, *len)) {
+    case SCRAP500_CACHE_GZIP:
+        return "gzip";
+    case SCRAP500_CACHE_ZSTD:
+        return "zstd";
+    default:
+        break;
+    }
+
+    if (gzip_raw && find_header(req, "Accept-Encoding", accept, sizeof(accept))
+        && strstr(accept, "gzip") && 0 == gzip_body(body, len))
+        return "gzip";
+
+    return NULL;
+}
+
+/*
+ * builds the whole response (header and body) in conn->outbuf.
+ */
+static void build_response(replay_conn_t *conn, const char *path,
+                           const char *req)
+{
+    int ret = 0;
+    size_t hlen = 0;
+    size_t blen = 0;
+    char *body = NULL;
+    struct stat sb = { 0, };
+    struct tm tm = { 0, };
+    char etag[64] = { 0, };
+    char lastmod[64] = { 0, };
+    char inm[128] = { 0, };
+    char encoding[64] = { 0, };
+    char header[1024] = { 0, };
+    char filename[PATH_MAX] = { 0, };
+    const char *status = "200 OK";
+    const char *enc = NULL;
+
+    n_requests++;
+
+    if (error_rate > 0 && drand48() < error_rate) {
+        n_errors++;
+        status = "503 Service Unavailable";
+
+        if (!quiet)
+            printf("%s %s\n", status, path);
+
+        hlen = sprintf(header, "HTTP/1.1 %s\r\n"
+                               "Retry-After: 1\r\n"
+                               "Content-Length: 0\r\n"
+                               "\r\n", status);
+        goto out_build;
+    }
+
+    ret = map_path(path, filename);
+    if (!ret)
+        ret = stat(filename, &sb) < 0 ? errno : 0;
+
+    if (!ret) {
+        make_etag(&sb, etag);
+        strftime(lastmod, sizeof(lastmod), "%a, %d %b %Y %H:%M:%S GMT",
+                 gmtime_r(&sb.st_mtime, &tm));
+
+        if (find_header(req, "If-None-Match", inm, sizeof(inm))
+            && 0 == strcmp(inm, etag)) {
+            n_not_modified++;
+            status = "304 Not Modified";
+        }
+        else {
+            body = read_whole_file(filename, &blen);
+            if (!body)
+                ret = EIO;
+            else if ((enc = encode_body(req, &body, &blen)) != NULL)
+                sprintf(encoding, "Content-Encoding: %s\r\n", enc);
+        }
+    }
+
+    if (ret) {
+        n_notfound++;
+        status = "404 Not Found";
+        blen = 0;
+    }
+
+    if (!quiet)
+        printf("%s %s\n", status, path);
+
+    if (ret)
+        hlen = sprintf(header, "HTTP/1.1 %s\r\n"
+                               "Content-Length: 0\r\n"
+                               "\r\n", status);
+    else
+        hlen = sprintf(header, "HTTP/1.1 %s\r\n"
+                               "Content-Type: text/html; charset=utf-8\r\n"
+                               "%s"
+                               "ETag: %s\r\n"
+                               "Last-Modified: %s\r\n"
+                               "Content-Length: %zu\r\n"
+                               "\r\n", status, encoding, etag, lastmod, blen);
+
+    n_bytes += blen;
+
+out_build:
+    conn->outbuf = malloc(hlen + blen);
+    if (!conn->outbuf) {
+        free(body);
+        return;
+    }
+
+    memcpy(conn->outbuf, header, hlen);
+    if (body)
+        memcpy(&conn->outbuf[hlen], body, blen);
+
+    conn->outlen = hlen + blen;
+    conn->outpos = 0;
+
+    if (latency || jitter)
+        conn->due = now_ms() + latency + (jitter ? random() % jitter : 0);
+
+    free(body);
+}
+
+static void close_conn(int epfd, replay_conn_t *conn)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        conns = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+
+    if (conn->outbuf)
+        free(conn->outbuf);
+    free(conn);
+}
+
+/*
+ * returns non-zero if the connection should be closed. with the bandwidth
+ * limit, only one tick worth of the response is written at a time and the
+ * rest is due in the next tick.
+ */
+static int flush_conn(int epfd, replay_conn_t *conn)
+{
+    ssize_t n = 0;
+    size_t len = 0;
+    size_t chunk = bandwidth*REPLAY_TICK_MS/1000;
+    uint64_t now = now_ms();
+    struct epoll_event ev = { 0, };
+
+    if (conn->due > now)
+        return 0;
+
+    conn->due = 0;
+
+    if (bandwidth && chunk == 0)
+        chunk = 1;
+
+    while (conn->outpos < conn->outlen) {
+        len = conn->outlen - conn->outpos;
+        if (chunk && len > chunk)
+            len = chunk;
+
+        n = write(conn->fd, &conn->outbuf[conn->outpos], len);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return 1;
+        }
+        conn->outpos += n;
+
+        if (chunk) {
+            if (conn->outpos < conn->outlen)
+                conn->due = now + REPLAY_TICK_MS;
+            break;
+        }
+    }
+
+    ev.data.ptr = conn;
+    ev.events = EPOLLIN;
+
+    if (conn->outpos < conn->outlen) {
+        if (!conn->due)
+            ev.events |= EPOLLOUT;
+    }
+    else {
+        free(conn->outbuf);
+        conn->outbuf = NULL;
+        conn->outlen = conn->outpos = 0;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+
+    return 0;
+}
+
+/*
+ * serves every complete request found in the input buffer. requests are
+ * answered in order, one at a time, so a pipelined request waits until the
+ * previous response has been flushed.
+ */
+static int process_conn(int epfd, replay_conn_t *conn)
+{
+    ssize_t n = 0;
+    char *end = NULL;
+    size_t reqlen = 0;
+    char path[2048] = { 0, };
+
+    while (1) {
+        n = read(conn->fd, &conn->inbuf[conn->inlen],
+                 sizeof(conn->inbuf) - conn->inlen - 1);
+        if (n == 0)
+            return 1;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return 1;
+        }
+
+        conn->inlen += n;
+        conn->inbuf[conn->inlen] = '\0';
+
+        if (conn->inlen == sizeof(conn->inbuf) - 1)
+            return 1;   /* request too large */
+    }
+
+    while (!conn->outbuf) {
+        end = strstr(conn->inbuf, "\r\n\r\n");
+        if (!end)
+            break;
+
+        reqlen = end - conn->inbuf + 4;
+
+        if (1 != sscanf(conn->inbuf, "GET %2047s", path))
+            return 1;
+
+        end[2] = '\0';     /* terminate the headers for find_header() */
+        build_response(conn, path, conn->inbuf);
+
+        memmove(conn->inbuf, &conn->inbuf[reqlen], conn->inlen - reqlen);
+        conn->inlen -= reqlen;
+        conn->inbuf[conn->inlen] = '\0';
+
+        if (flush_conn(epfd, conn))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int open_listener(void)
+{
+    int fd = 0;
+    int on = 1;
+    struct sockaddr_in addr = { 0, };
+
+    fd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("failed to create a socket");
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "failed to bind to port %d: %s\n",
+                        port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, 1024) < 0) {
+        perror("failed to listen");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void accept_conns(int epfd, int lfd)
+{
+    int fd = 0;
+    int on = 1;
+    replay_conn_t *conn = NULL;
+    struct epoll_event ev = { 0, };
+
+    while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0) {
+        conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        conn->fd = fd;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = conns;
+        if (conns)
+            conns->prev = conn;
+        conns = conn;
+    }
+}
+
+/*
+ * returns how long (ms) until the earliest held back output is due.
+ */
+static int next_due(void)
+{
+    uint64_t now = now_ms();
+    uint64_t due = now + 1000;
+    replay_conn_t *conn = NULL;
+
+    for (conn = conns; conn; conn = conn->next) {
+        if (conn->due && conn->due < due)
+            due = conn->due;
+    }
+
+    return due > now ? (int) (due - now) : 0;
+}
+
+static void serve_due(int epfd)
+{
+    uint64_t now = now_ms();
+    replay_conn_t *conn = NULL;
+    replay_conn_t *next = NULL;
+
+    for (conn = conns; conn; conn = next) {
+        next = conn->next;
+
+        if (!conn->due || conn->due > now)
+            continue;
+
+        if (flush_conn(epfd, conn)) {
+            close_conn(epfd, conn);
+            continue;
+        }
+
+        /* serve requests queued behind the flushed response */
+        if (!conn->outbuf && conn->inlen && process_conn(epfd, conn))
+            close_conn(epfd, conn);
+    }
+}
+
+static int serve(void)
+{
+    int i = 0;
+    int n = 0;
+    int epfd = 0;
+    int lfd = 0;
+    replay_conn_t *conn = NULL;
+    struct epoll_event ev = { 0, };
+    struct epoll_event events[REPLAY_MAX_EVENTS];
+
+    lfd = open_listener();
+    if (lfd < 0)
+        return EIO;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("failed to create epoll instance");
+        close(lfd);
+        return errno;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;     /* the listener */
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    printf("## serving %s on http://127.0.0.1:%d\n", scrap500_datadir, port);
+    fflush(stdout);
+
+    while (!terminate) {
+        n = epoll_wait(epfd, events, REPLAY_MAX_EVENTS, next_due());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            conn = (replay_conn_t *) events[i].data.ptr;
+
+            if (!conn) {
+                accept_conns(epfd, lfd);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR|EPOLLHUP)) {
+                close_conn(epfd, conn);
+                continue;
+            }
+
+            if ((events[i].events & EPOLLOUT) && flush_conn(epfd, conn)) {
+                close_conn(epfd, conn);
+                continue;
+            }
+
+            /* also serve requests queued behind a flushed response */
+            if (((events[i].events & EPOLLIN) || conn->inlen)
+                && process_conn(epfd, conn))
+                close_conn(epfd, conn);
+        }
+
+        serve_due(epfd);
+    }
+
+    printf("\n## served %llu requests (%llu not modified, %llu not found, "
+           "%llu injected errors), %llu KB of pages\n",
+           _llu(n_requests), _llu(n_not_modified), _llu(n_notfound),
+           _llu(n_errors), _llu(n_bytes >> 10));
+
+    close(epfd);
+    close(lfd);
+
+    return 0;
+}
+
+static char program[PATH_MAX];
+
+static struct option const long_opts[] = {
+    { "bandwidth", 1, 0, 'b' },
+    { "datadir", 1, 0, 'd' },
+    { "error-rate", 1, 0, 'e' },
+    { "help", 0, 0, 'h' },
+    { "jitter", 1, 0, 'j' },
+    { "latency", 1, 0, 'l' },
+    { "port", 1, 0, 'p' },
+    { "quiet", 0, 0, 'q' },
+    { "gzip", 0, 0, 'z' },
+    { 0, 0, 0, 0},
+};
+
+static const char *short_opts = "b:d:e:hj:l:p:qz";
+
+static const char *usage_str =
+"Usage: %s [options..]\n"
+"\n"
+"  available options:\n"
+"  -b, --bandwidth=<KB/s> send at most <KB/s> per connection\n"
+"  -d, --datadir=<path>   serve files in <path> (default: /tmp/scrap500)\n"
+"  -e, --error-rate=<P>   answer with 503 at probability <P> (0..1)\n"
+"  -h, --help             print help message\n"
+"  -j, --jitter=<ms>      add a random delay of up to <ms> to each response\n"
+"  -l, --latency=<ms>     hold each response for <ms> before sending it\n"
+"  -p, --port=<port>      listen on 127.0.0.1:<port> (default: 8500)\n"
+"  -q, --quiet            do not log each request\n"
+"  -z, --gzip             compress raw pages for clients accepting gzip\n"
+"\n";
+
+static inline void usage(int ec)
+{
+    fprintf(stdout, usage_str, program);
+    exit(ec);
+}
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    int optidx = 0;
+    int ch = 0;
+
+    read_program_name(argv[0], program);
+
+    while ((ch = getopt_long(argc, argv,
+                             short_opts, long_opts, &optidx)) >= 0) {
+        switch (ch) {
+        case 'b':
+            bandwidth = (size_t) atol(optarg)*1024;
+            break;
+
+        case 'd':
+            scrap500_datadir = strdup(optarg);
+            break;
+
+        case 'e':
+            error_rate = atof(optarg);
+            break;
+
+        case 'j':
+            jitter = atoi(optarg);
+            break;
+
+        case 'l':
+            latency = atoi(optarg);
+            break;
+
+        case 'p':
+            port = atoi(optarg);
+            break;
+
+        case 'q':
+            quiet = 1;
+            break;
+
+        case 'z':
+            gzip_raw = 1;
+            break;
+
+        case 'h':
+        default:
+            usage(0);
+            break;
+        }
+    }
+
+    srand48(1);
+    srandom(1);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    ret = serve();
+
+    return ret;
+}
@@ -0,0 +1,663 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * the sax backend reads the same records as the parsers in scrap500-parser.c,
+ * from the sax callbacks of libxml2 instead of a document tree. it follows
+ * the path to the content div and the table in it, as get_content_div() and
+ * friends do, and keeps only the text that the records are made of.
+ *
+ * the tree is built without some runs of blanks that the callbacks still
+ * deliver (see areBlanks() in libxml2). in the elements read here, that is a
+ * run of blanks following a child element that cannot have text in it, and
+ * such runs are dropped here as well.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libxml/HTMLparser.h>
+
+#include "scrap500.h"
+
+/* deeper elements are never on the path to the records */
+#define SAX_MAX_DEPTH   256
+
+enum {
+    TAG_OTHER = 0,
+    TAG_A,
+    TAG_BODY,
+    TAG_DIV,
+    TAG_H1,
+    TAG_SPAN,
+    TAG_TABLE,
+    TAG_TD,
+    TAG_TH,
+    TAG_TR,
+    N_TAGS,
+};
+
+/* where an element is on the path to the records */
+enum {
+    ROLE_NONE = 0,
+    ROLE_DOC,
+    ROLE_ROOT,                  /* html */
+    ROLE_BODY,
+    ROLE_OUTER,                 /* the second div of the body */
+    ROLE_INNER,
+    ROLE_CONTENT,               /* the content div */
+    ROLE_H1,
+    ROLE_TABLE,
+    ROLE_ROW,                   /* from the first tr of the table */
+    ROLE_TH,
+    ROLE_TD,
+    ROLE_A,
+    ROLE_SPAN,
+};
+
+enum {
+    NODE_NONE = 0,
+    NODE_ELEMENT,
+    NODE_TEXT,
+    NODE_OTHER,                 /* comment or cdata, which have content too */
+};
+
+/*
+ * an element being parsed. strings are kept as offsets into the strings of
+ * the parse, or -1 for none.
+ */
+struct _sax_frame {
+    int role;
+    int tag;
+    int nth;                    /* among the siblings of the same tag */
+    int counts[N_TAGS];         /* of the child elements so far */
+    int n_elements;
+    int n_rows;                 /* of the table */
+    int n_children;             /* of the child nodes so far */
+    int last;                   /* NODE_* of the last child but comments */
+    int last_text;              /* the last child element may have text */
+    int in_text;                /* a text child is being read */
+    int capture;                /* and is kept */
+
+    int first_kind;             /* NODE_* of the first child */
+    int first;                  /* content of the first child */
+    int first_attr;             /* the first attribute of the first child */
+    int text;                   /* the first text child */
+    int attr;                   /* the first attribute of an anchor */
+
+    /* of the cells of a row, or of the children of a cell */
+    int th_text;                /* row: the text of the th */
+    int td_kind;                /* row: the first td */
+    int td_first;
+    int td_attr;
+    int cells[3];               /* row of a list: rank, site and system */
+    int a_text;                 /* td: the first anchor */
+    int a_attr;
+    int span_first;             /* td: the first span */
+};
+
+typedef struct _sax_frame sax_frame_t;
+
+struct _sax {
+    int type;                   /* SCRAP500_PAGE_* */
+    uint64_t id;
+    void *record;               /* list, site or system */
+    htmlParserCtxtPtr ctxt;
+    int ret;
+    int found;                  /* the content div */
+    int n_rows;
+
+    sax_frame_t frames[SAX_MAX_DEPTH];
+    int depth;
+    int overflow;               /* elements deeper than SAX_MAX_DEPTH */
+
+    char *strs;
+    size_t len;
+    size_t size;
+};
+
+typedef struct _sax sax_t;
+
+static __thread sax_t *sax_state;
+
+static inline int tag_of(const char *name)
+{
+    switch (name[0]) {
+    case 'a':
+        return name[1] == '\0' ? TAG_A : TAG_OTHER;
+    case 'b':
+        return strcmp(name, "body") ? TAG_OTHER : TAG_BODY;
+    case 'd':
+        return strcmp(name, "div") ? TAG_OTHER : TAG_DIV;
+    case 'h':
+        return strcmp(name, "h1") ? TAG_OTHER : TAG_H1;
+    case 's':
+        return strcmp(name, "span") ? TAG_OTHER : TAG_SPAN;
+    case 't':
+        if (0 == strcmp(name, "table"))
+            return TAG_TABLE;
+        if (0 == strcmp(name, "td"))
+            return TAG_TD;
+        if (0 == strcmp(name, "th"))
+            return TAG_TH;
+        if (0 == strcmp(name, "tr"))
+            return TAG_TR;
+        return TAG_OTHER;
+    default:
+        return TAG_OTHER;
+    }
+}
+
+static inline int is_tracked(sax_frame_t *f)
+{
+    return f->role >= ROLE_H1 && f->role != ROLE_TABLE && f->role != ROLE_ROW;
+}
+
+static inline const char *sax_str(sax_t *sax, int off)
+{
+    return off < 0 ? NULL : &sax->strs[off];
+}
+
+/*
+ * appends len bytes of str to the strings, to the last string if append is
+ * set, and returns the offset of the string.
+ */
+static int sax_store(sax_t *sax, const char *str, size_t len, int append)
+{
+    size_t off = sax->len;
+    size_t size = 0;
+    char *tmp = NULL;
+
+    if (append && sax->len) {
+        off = sax->len - 1;
+        while (off > 0 && sax->strs[off-1] != '\0')
+            off--;
+        sax->len--;     /* over the nul */
+    }
+
+    if (sax->len + len + 1 > sax->size) {
+        size = sax->size ? sax->size : 4096;
+        while (sax->len + len + 1 > size)
+            size *= 2;
+
+        tmp = realloc(sax->strs, size);
+        if (!tmp) {
+            sax->ret = ENOMEM;
+            xmlStopParser(sax->ctxt);
+            return -1;
+        }
+
+        sax->strs = tmp;
+        sax->size = size;
+    }
+
+    memcpy(&sax->strs[sax->len], str, len);
+    sax->len += len;
+    sax->strs[sax->len++] = '\0';
+
+    return (int) off;
+}
+
+static inline void frame_init(sax_frame_t *f, int role, int tag, int nth)
+{
+    memset((void *) f, 0, sizeof(*f));
+
+    f->role = role;
+    f->tag = tag;
+    f->nth = nth;
+    f->first = -1;
+    f->first_attr = -1;
+    f->text = -1;
+    f->attr = -1;
+    f->th_text = -1;
+    f->td_first = -1;
+    f->td_attr = -1;
+    f->cells[0] = -1;
+    f->cells[1] = -1;
+    f->cells[2] = -1;
+    f->a_text = -1;
+    f->a_attr = -1;
+    f->span_first = -1;
+}
+
+static int child_role(sax_t *sax, sax_frame_t *parent, int tag, int nth)
+{
+    switch (parent->role) {
+    case ROLE_DOC:
+        return parent->n_elements == 1 ? ROLE_ROOT : ROLE_NONE;
+    case ROLE_ROOT:
+        return tag == TAG_BODY && nth == 1 ? ROLE_BODY : ROLE_NONE;
+    case ROLE_BODY:
+        return tag == TAG_DIV && nth == 2 ? ROLE_OUTER : ROLE_NONE;
+    case ROLE_OUTER:
+        return tag == TAG_DIV && nth == 1 ? ROLE_INNER : ROLE_NONE;
+    case ROLE_INNER:
+        if (tag == TAG_DIV && nth == 1) {
+            sax->found = 1;
+            return ROLE_CONTENT;
+        }
+        return ROLE_NONE;
+    case ROLE_CONTENT:
+        if (tag == TAG_H1)
+            return ROLE_H1;
+        return tag == TAG_TABLE && nth == 1 ? ROLE_TABLE : ROLE_NONE;
+    case ROLE_TABLE:
+        /* the rows are the first tr and all that follow */
+        return parent->counts[TAG_TR] > 0 ? ROLE_ROW : ROLE_NONE;
+    case ROLE_ROW:
+        if (tag == TAG_TD)
+            return ROLE_TD;
+        return tag == TAG_TH && nth == 1 ? ROLE_TH : ROLE_NONE;
+    case ROLE_TD:
+        if (tag == TAG_A && nth == 1)
+            return ROLE_A;
+        return tag == TAG_SPAN && nth == 1 ? ROLE_SPAN : ROLE_NONE;
+    default:
+        return ROLE_NONE;
+    }
+}
+
+/* a child node other than text ends the text being read */
+static inline void add_child(sax_frame_t *f, int kind)
+{
+    f->in_text = 0;
+    f->capture = 0;
+    f->n_children++;
+
+    if (f->n_children == 1)
+        f->first_kind = kind;
+}
+
+static void sax_start_element(void *ctx, const xmlChar *name,
+                              const xmlChar **atts)
+{
+    int tag = TAG_OTHER;
+    int nth = 0;
+    int role = ROLE_NONE;
+    sax_t *sax = (sax_t *) ctx;
+    sax_frame_t *parent = NULL;
+
+    if (sax->overflow || sax->depth == SAX_MAX_DEPTH) {
+        sax->overflow++;
+        return;
+    }
+
+    parent = &sax->frames[sax->depth - 1];
+    parent->n_elements++;
+
+    if (parent->role != ROLE_NONE) {
+        tag = tag_of((const char *) name);
+        nth = ++parent->counts[tag];
+        role = child_role(sax, parent, tag, nth);
+    }
+
+    if (is_tracked(parent)) {
+        add_child(parent, NODE_ELEMENT);
+
+        parent->last = NODE_ELEMENT;
+        parent->last_text =
+                scrap500_parser_text_element((const char *) name);
+
+        if (parent->n_children == 1 && atts && atts[0] && atts[1])
+            parent->first_attr = sax_store(sax, (const char *) atts[1],
+                                           strlen((const char *) atts[1]), 0);
+    }
+
+    frame_init(&sax->frames[sax->depth++], role, tag, nth);
+
+    if (role == ROLE_A && atts && atts[0] && atts[1])
+        sax->frames[sax->depth - 1].attr =
+                sax_store(sax, (const char *) atts[1],
+                          strlen((const char *) atts[1]), 0);
+}
+
+static void end_row(sax_t *sax, sax_frame_t *row, sax_frame_t *table)
+{
+    int ret = 0;
+    scrap500_system_t *system = NULL;
+    scrap500_list_t *list = NULL;
+    scrap500_rank_t *rank = NULL;
+    int pos = 0;
+    int index = table->n_rows++;
+
+    switch (sax->type) {
+    case SCRAP500_PAGE_SITE:
+        break;      /* read from the cells, see sax_end_element() */
+
+    case SCRAP500_PAGE_SYSTEM:
+        if (sax->ret || row->td_kind == NODE_NONE)
+            break;  /* no td, or column shown but no data available */
+
+        system = (scrap500_system_t *) sax->record;
+
+        ret = scrap500_parser_system_attr(system, sax_str(sax, row->th_text),
+                                          sax_str(sax, row->td_first),
+                                          sax_str(sax, row->td_attr));
+        if (ret) {
+            fprintf(stderr, "failed to parse attribute %s\n",
+                            sax_str(sax, row->th_text));
+            sax->ret = ret;
+            xmlStopParser(sax->ctxt);
+        }
+        break;
+
+    default:
+        if (index >= 100)
+            break;
+
+        if (row->cells[0] < 0 || row->cells[1] < 0 || row->cells[2] < 0) {
+            sax->ret = EIO;
+            xmlStopParser(sax->ctxt);
+            break;
+        }
+
+        list = (scrap500_list_t *) sax->record;
+        pos = atoi(sax_str(sax, row->cells[0]));
+        if (pos < 1 || pos > 500) {
+            sax->ret = EIO;
+            xmlStopParser(sax->ctxt);
+            break;
+        }
+
+        rank = &list->rank[pos-1];
+        rank->rank = pos;
+        rank->site_id = scrap500_parser_link_id(sax_str(sax, row->cells[1]));
+        rank->system_id =
+                scrap500_parser_link_id(sax_str(sax, row->cells[2]));
+        if (!rank->site_id || !rank->system_id) {
+            sax->ret = EIO;
+            xmlStopParser(sax->ctxt);
+            break;
+        }
+
+        sax->n_rows++;
+        break;
+    }
+}
+
+static inline char *dup_str(sax_t *sax, int off)
+{
+    return off < 0 ? NULL : strdup(&sax->strs[off]);
+}
+
+static void sax_end_element(void *ctx, const xmlChar *name)
+{
+    sax_t *sax = (sax_t *) ctx;
+    sax_frame_t *f = NULL;
+    sax_frame_t *parent = NULL;
+    sax_frame_t *row = NULL;
+    scrap500_site_t *site = NULL;
+
+    if (sax->overflow) {
+        sax->overflow--;
+        return;
+    }
+
+    if (sax->depth <= 1)
+        return;
+
+    f = &sax->frames[--sax->depth];
+    parent = &sax->frames[sax->depth - 1];
+
+    switch (f->role) {
+    case ROLE_H1:
+        if (sax->type == SCRAP500_PAGE_SITE && f->nth == 2 && f->text >= 0) {
+            site = (scrap500_site_t *) sax->record;
+            site->name = dup_str(sax, f->text);
+        }
+        else if (sax->type == SCRAP500_PAGE_SYSTEM && f->nth == 1
+                 && f->text >= 0)
+            scrap500_parser_system_name((scrap500_system_t *) sax->record,
+                                        sax_str(sax, f->text));
+        break;
+
+    case ROLE_ROW:
+        end_row(sax, f, parent);
+        break;
+
+    case ROLE_TH:
+        parent->th_text = f->text;
+        break;
+
+    case ROLE_TD:
+        if (f->nth == 1) {
+            parent->td_kind = f->first_kind;
+            parent->td_first = f->first;
+            parent->td_attr = f->first_attr;
+            parent->cells[0] = f->span_first;
+        }
+        else if (f->nth <= 3)
+            parent->cells[f->nth - 1] = f->a_attr;
+
+        if (sax->type != SCRAP500_PAGE_SITE || parent->tag != TAG_TR)
+            break;
+
+        site = (scrap500_site_t *) sax->record;
+        row = parent;
+
+        if (f->nth != 1)
+            break;
+        else if (row->nth == 1 && f->a_text >= 0)
+            site->url = dup_str(sax, f->a_text);
+        else if (row->nth == 2 && f->text >= 0)
+            site->segment = dup_str(sax, f->text);
+        else if (row->nth == 3 && f->text >= 0)
+            site->city = dup_str(sax, f->text);
+        else if (row->nth == 4 && f->text >= 0)
+            site->country = dup_str(sax, f->text);
+        break;
+
+    case ROLE_A:
+        parent->a_text = f->text;
+        parent->a_attr = f->attr;
+        break;
+
+    case ROLE_SPAN:
+        parent->span_first = f->first;
+        break;
+
+    default:
+        break;
+    }
+}
+
+static inline int is_blank(const xmlChar *str, int len)
+{
+    int i = 0;
+
+    for (i = 0; i < len; i++)
+        if (!(str[i] == ' ' || str[i] == '\t' || str[i] == '\n'
+              || str[i] == '\r'))
+            return 0;
+
+    return 1;
+}
+
+static void sax_characters(void *ctx, const xmlChar *str, int len)
+{
+    sax_t *sax = (sax_t *) ctx;
+    sax_frame_t *f = NULL;
+
+    if (sax->overflow)
+        return;
+
+    f = &sax->frames[sax->depth - 1];
+    if (!is_tracked(f))
+        return;
+
+    if (f->in_text) {
+        if (f->capture)
+            sax_store(sax, (const char *) str, len, 1);
+        return;
+    }
+
+    /* blanks after an element without text are not in the tree */
+    if (f->last == NODE_ELEMENT && !f->last_text && is_blank(str, len))
+        return;
+
+    add_child(f, NODE_TEXT);
+    f->in_text = 1;
+    f->last = NODE_TEXT;
+
+    if (f->n_children == 1 || f->text < 0) {
+        f->capture = 1;
+        f->text = sax_store(sax, (const char *) str, len, 0);
+
+        if (f->n_children == 1)
+            f->first = f->text;
+    }
+}
+
+/* comments and cdata are nodes with content, too */
+static void sax_content_node(sax_t *sax, const xmlChar *str, int len)
+{
+    sax_frame_t *f = NULL;
+
+    if (sax->overflow)
+        return;
+
+    f = &sax->frames[sax->depth - 1];
+    if (!is_tracked(f))
+        return;
+
+    add_child(f, NODE_OTHER);
+
+    if (f->n_children == 1)
+        f->first = sax_store(sax, (const char *) str, len, 0);
+}
+
+static void sax_comment(void *ctx, const xmlChar *value)
+{
+    sax_content_node((sax_t *) ctx, value, strlen((const char *) value));
+}
+
+static void sax_cdata(void *ctx, const xmlChar *value, int len)
+{
+    sax_content_node((sax_t *) ctx, value, len);
+}
+
+static htmlParserCtxtPtr sax_ctxt(sax_t *sax)
+{
+    htmlParserCtxtPtr ctxt = htmlNewParserCtxt();
+
+    if (!ctxt)
+        return NULL;
+
+    memset((void *) ctxt->sax, 0, sizeof(*ctxt->sax));
+    ctxt->sax->initialized = 1;
+    ctxt->sax->startElement = sax_start_element;
+    ctxt->sax->endElement = sax_end_element;
+    ctxt->sax->characters = sax_characters;
+    ctxt->sax->comment = sax_comment;
+    ctxt->sax->cdataBlock = sax_cdata;
+    ctxt->userData = sax;
+
+    return ctxt;
+}
+
+/*
+ * parses the cached page with the callbacks into the record. the state and
+ * the parser context are kept for the next page of the thread.
+ */
+static int sax_parse(int type, uint64_t id, void *record)
+{
+    int ret = 0;
+    sax_t *sax = sax_state;
+    scrap500_page_t page = { 0, };
+
+    if (!sax) {
+        sax = calloc(1, sizeof(*sax));
+        if (!sax)
+            return ENOMEM;
+
+        sax->ctxt = sax_ctxt(sax);
+        if (!sax->ctxt) {
+            free(sax);
+            return ENOMEM;
+        }
+
+        sax_state = sax;
+    }
+
+    ret = scrap500_cache_map_page(type, id, &page);
+    if (ret)
+        return ret;
+
+    sax->type = type;
+    sax->id = id;
+    sax->record = record;
+    sax->ret = 0;
+    sax->found = 0;
+    sax->n_rows = 0;
+    sax->depth = 1;
+    sax->overflow = 0;
+    sax->len = 0;
+    frame_init(&sax->frames[0], ROLE_DOC, TAG_OTHER, 0);
+
+    htmlCtxtReadMemory(sax->ctxt, page.data, (int) page.len, NULL, NULL,
+                       SCRAP500_PARSER_OPTS);
+
+    scrap500_cache_unmap_page(&page);
+
+    return 0;
+}
+
+int scrap500_sax_parse_list(scrap500_list_t *list)
+{
+    int ret = 0;
+    int page = 0;
+
+    for (page = 1; page <= 5; page++) {
+        ret = sax_parse(SCRAP500_PAGE_LIST,
+                        scrap500_list_page_id(list->id, page), list);
+        if (ret || !sax_state->found || sax_state->ret
+            || sax_state->n_rows < 100) {
+            fprintf(stderr, "cannot parse the document (list=%d)\n", list->id);
+            return ret ? ret : EIO;
+        }
+    }
+
+    return 0;
+}
+
+int scrap500_sax_parse_site(uint64_t site_id, scrap500_site_t *site)
+{
+    int ret = 0;
+
+    site->id = site_id;
+
+    ret = sax_parse(SCRAP500_PAGE_SITE, site_id, site);
+    if (ret || !sax_state->found) {
+        fprintf(stderr, "cannot parse the document (site=%llu)\n",
+                        _llu(site_id));
+        return ret ? ret : EIO;
+    }
+
+    return sax_state->ret;
+}
+
+int scrap500_sax_parse_system(uint64_t system_id, scrap500_system_t *system)
+{
+    int ret = 0;
+
+    system->id = system_id;
+
+    ret = sax_parse(SCRAP500_PAGE_SYSTEM, system_id, system);
+    if (ret || !sax_state->found) {
+        fprintf(stderr, "cannot parse the document (system=%llu)\n",
+                        _llu(system_id));
+        return ret ? ret : EIO;
+    }
+
+    ret = sax_state->ret;
+    if (ret) {
+        fprintf(stderr, "failed to parse system table\n");
+        fprintf(stderr, "failed to parse the system record.\n");
+    }
+
+    return ret;
+}
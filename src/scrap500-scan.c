@@ -0,0 +1,1437 @@
+/* Copyright (C) 2019 - UT-Battelle, LLC. All right reserved.
+ *
+ * Please refer to COPYING for the license.
+ * Written by: Hyogi Sim <sandrain@gmail.com>
+ * ---------------------------------------------------------------------------
+ *
+ * the scan backend reads the same records as the parsers in scrap500-parser.c
+ * straight from the bytes of the page, without libxml2. the pages are made by
+ * a program and have the same layout, so the scanner knows only what these
+ * pages are made of: it steps from one '<' to the next, found with sse2 or
+ * avx2 where the cpu has them, and keeps the stack of the open elements,
+ * closing them where libxml2 would. text and attributes are taken as slices
+ * of the mapped page, and copied only when they go into the record, with
+ * their references decoded.
+ *
+ * the elements on the path to the records are followed as in scrap500-sax.c,
+ * and the scan stops at the end of the content div.
+ */
+#include <config.h>
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <libxml/HTMLparser.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCAN_X86    1
+#endif
+
+#include "scrap500.h"
+
+/* deeper elements are never on the path to the records */
+#define SCAN_MAX_DEPTH  256
+
+/* longer names are of no element the scanner knows */
+#define SCAN_NAME_MAX   16
+
+enum {
+    TAG_OTHER = 0,
+    TAG_A,
+    TAG_B,
+    TAG_BODY,
+    TAG_COL,
+    TAG_DIV,
+    TAG_FORM,
+    TAG_H1,
+    TAG_HEAD,
+    TAG_HR,
+    TAG_HTML,
+    TAG_LI,
+    TAG_OPTION,
+    TAG_P,
+    TAG_SCRIPT,
+    TAG_SPAN,
+    TAG_STYLE,
+    TAG_TABLE,
+    TAG_TBODY,
+    TAG_TD,
+    TAG_TFOOT,
+    TAG_TH,
+    TAG_THEAD,
+    TAG_TITLE,
+    TAG_TR,
+    TAG_UL,
+    TAG_VOID,                   /* the other elements without content */
+    N_TAGS,
+};
+
+#define T(tag)  (1U << TAG_##tag)
+
+/*
+ * the open elements that a new element closes, as htmlAutoClose() of libxml2
+ * does for the elements in these pages. the others close nothing.
+ */
+static const uint32_t start_closes[N_TAGS] = {
+    [TAG_A] = T(A),
+    [TAG_COL] = T(P),
+    [TAG_DIV] = T(P),
+    [TAG_FORM] = T(FORM) | T(H1) | T(P) | T(UL),
+    [TAG_H1] = T(P),
+    [TAG_HR] = T(P),
+    [TAG_LI] = T(H1) | T(LI) | T(P),
+    [TAG_OPTION] = T(OPTION),
+    [TAG_P] = T(B) | T(H1) | T(P),
+    [TAG_TABLE] = T(A) | T(H1) | T(P),
+    [TAG_TBODY] = T(P) | T(TBODY) | T(TD) | T(TFOOT) | T(TH) | T(THEAD)
+                  | T(TR),
+    [TAG_TD] = T(A) | T(B) | T(P) | T(SPAN) | T(TD) | T(TH),
+    [TAG_TFOOT] = T(P) | T(TBODY) | T(TD) | T(TH) | T(THEAD) | T(TR),
+    [TAG_TH] = T(A) | T(B) | T(P) | T(SPAN) | T(TD) | T(TH),
+    [TAG_TITLE] = T(P),
+    [TAG_TR] = T(P) | T(TD) | T(TH) | T(TR),
+    [TAG_UL] = T(P),
+};
+
+/*
+ * an end tag closes the elements opened after its own, but not across an
+ * element of a higher priority (htmlEndPriority[] of libxml2)
+ */
+static inline int end_priority(int tag)
+{
+    switch (tag) {
+    case TAG_DIV:
+        return 150;
+    case TAG_TD:
+    case TAG_TH:
+        return 160;
+    case TAG_TR:
+        return 170;
+    case TAG_TBODY:
+    case TAG_TFOOT:
+    case TAG_THEAD:
+        return 180;
+    case TAG_TABLE:
+        return 190;
+    case TAG_BODY:
+    case TAG_HEAD:
+        return 200;
+    case TAG_HTML:
+        return 220;
+    default:
+        return 100;
+    }
+}
+
+/* where an element is on the path to the records, as in scrap500-sax.c */
+enum {
+    ROLE_NONE = 0,
+    ROLE_DOC,
+    ROLE_ROOT,                  /* html */
+    ROLE_BODY,
+    ROLE_OUTER,                 /* the second div of the body */
+    ROLE_INNER,
+    ROLE_CONTENT,               /* the content div */
+    ROLE_H1,
+    ROLE_TABLE,
+    ROLE_ROW,                   /* from the first tr of the table */
+    ROLE_TH,
+    ROLE_TD,
+    ROLE_A,
+    ROLE_SPAN,
+};
+
+enum {
+    NODE_NONE = 0,
+    NODE_ELEMENT,
+    NODE_TEXT,
+    NODE_OTHER,                 /* comment or pi, which have content too */
+};
+
+enum {
+    MARKUP_NONE = 0,            /* a '<' of the text */
+    MARKUP_START,
+    MARKUP_END,
+    MARKUP_COMMENT,
+    MARKUP_DOCTYPE,
+    MARKUP_PI,
+};
+
+/* blanks longer than the buffer of libxml2 for text are always kept */
+#define SCAN_BLANKS_MAX 1000
+
+/* a slice of the page, NULL for none */
+struct _scan_str {
+    const char *ptr;
+    size_t len;
+    int refs;                   /* references are to be decoded */
+    int attr;                   /* of an attribute */
+};
+
+typedef struct _scan_str scan_str_t;
+
+/*
+ * an open element. only those on the path to the records have more than the
+ * first few fields set.
+ */
+struct _scan_frame {
+    int tag;
+    int role;
+    const char *name;           /* in the page, for TAG_OTHER */
+    int namelen;
+
+    int nth;                    /* among the siblings of the same tag */
+    int counts[N_TAGS];         /* of the child elements so far */
+    int n_elements;
+    int n_rows;                 /* of the table */
+    int n_children;             /* of the child nodes so far */
+    int last;                   /* NODE_* of the last child but comments */
+    int last_text;              /* the last child element may have text */
+    int in_text;                /* the last child is text */
+    int capture;                /* and is the first text child */
+
+    int first_kind;             /* NODE_* of the first child */
+    scan_str_t first;           /* content of the first child */
+    scan_str_t first_attr;      /* the first attribute of the first child */
+    scan_str_t text;            /* the first text child */
+    scan_str_t attr;            /* the first attribute of an anchor */
+
+    /* of the cells of a row, or of the children of a cell */
+    scan_str_t th_text;         /* row: the text of the th */
+    int td_kind;                /* row: the first td */
+    scan_str_t td_first;
+    scan_str_t td_attr;
+    scan_str_t cells[3];        /* row of a list: rank, site and system */
+    scan_str_t a_text;          /* td: the first anchor */
+    scan_str_t a_attr;
+    scan_str_t span_first;      /* td: the first span */
+};
+
+typedef struct _scan_frame scan_frame_t;
+
+struct _scan {
+    int type;                   /* SCRAP500_PAGE_* */
+    uint64_t id;
+    void *record;               /* list, site or system */
+    int ret;
+    int found;                  /* the content div */
+    int done;                   /* and its end */
+    int n_rows;
+
+    scan_frame_t frames[SCAN_MAX_DEPTH];
+    int depth;
+    int misplaced;              /* html, head and body tags dropped */
+
+    char *strs;                 /* decoded, for the record */
+    size_t len;
+    size_t size;
+
+    char **spills;              /* texts not in one slice, freed per page */
+    int n_spills;
+    int max_spills;
+};
+
+typedef struct _scan scan_t;
+
+static __thread scan_t *scan_state;
+
+/*
+ * finding the next '<', with the widest vectors the cpu has, chosen once by
+ * scan_init()
+ */
+static const char *find_lt_memchr(const char *pos, const char *end)
+{
+    const char *lt = memchr(pos, '<', end - pos);
+
+    return lt ? lt : end;
+}
+
+#ifdef SCAN_X86
+static const char *find_lt_sse2(const char *pos, const char *end)
+{
+    const __m128i lt = _mm_set1_epi8('<');
+    __m128i chunk;
+    int mask = 0;
+
+    for ( ; end - pos >= 16; pos += 16) {
+        chunk = _mm_loadu_si128((const __m128i *) pos);
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lt));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+    }
+
+    return find_lt_memchr(pos, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_lt_avx2(const char *pos, const char *end)
+{
+    const __m256i lt = _mm256_set1_epi8('<');
+    __m256i chunk;
+    unsigned int mask = 0;
+
+    for ( ; end - pos >= 32; pos += 32) {
+        chunk = _mm256_loadu_si256((const __m256i *) pos);
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lt));
+        if (mask)
+            return pos + __builtin_ctz(mask);
+    }
+
+    return find_lt_sse2(pos, end);
+}
+#endif
+
+static const char *(*find_lt)(const char *pos, const char *end);
+
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_init(void)
+{
+    find_lt = find_lt_memchr;
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        find_lt = find_lt_avx2;
+    else
+        find_lt = find_lt_sse2;
+#endif
+}
+
+static inline int is_alpha(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline int is_digit(int c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline int is_blank_char(int c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline int is_name_char(int c)
+{
+    return is_alpha(c) || is_digit(c) || c == '_' || c == ':' || c == '.'
+           || c == '-';
+}
+
+static inline int is_blank(const char *str, size_t len)
+{
+    size_t i = 0;
+
+    for (i = 0; i < len; i++)
+        if (!is_blank_char(str[i]))
+            return 0;
+
+    return 1;
+}
+
+/* name is in lower case */
+static int tag_of(const char *name, int len)
+{
+    switch (len) {
+    case 1:
+        if (name[0] == 'a')
+            return TAG_A;
+        if (name[0] == 'b')
+            return TAG_B;
+        if (name[0] == 'p')
+            return TAG_P;
+        break;
+    case 2:
+        if (!memcmp(name, "br", 2))
+            return TAG_VOID;
+        if (!memcmp(name, "h1", 2))
+            return TAG_H1;
+        if (!memcmp(name, "hr", 2))
+            return TAG_HR;
+        if (!memcmp(name, "li", 2))
+            return TAG_LI;
+        if (!memcmp(name, "td", 2))
+            return TAG_TD;
+        if (!memcmp(name, "th", 2))
+            return TAG_TH;
+        if (!memcmp(name, "tr", 2))
+            return TAG_TR;
+        if (!memcmp(name, "ul", 2))
+            return TAG_UL;
+        break;
+    case 3:
+        if (!memcmp(name, "col", 3))
+            return TAG_COL;
+        if (!memcmp(name, "div", 3))
+            return TAG_DIV;
+        if (!memcmp(name, "img", 3))
+            return TAG_VOID;
+        break;
+    case 4:
+        if (!memcmp(name, "area", 4) || !memcmp(name, "base", 4)
+            || !memcmp(name, "link", 4) || !memcmp(name, "meta", 4))
+            return TAG_VOID;
+        if (!memcmp(name, "body", 4))
+            return TAG_BODY;
+        if (!memcmp(name, "form", 4))
+            return TAG_FORM;
+        if (!memcmp(name, "head", 4))
+            return TAG_HEAD;
+        if (!memcmp(name, "html", 4))
+            return TAG_HTML;
+        if (!memcmp(name, "span", 4))
+            return TAG_SPAN;
+        break;
+    case 5:
+        if (!memcmp(name, "frame", 5) || !memcmp(name, "input", 5)
+            || !memcmp(name, "param", 5))
+            return TAG_VOID;
+        if (!memcmp(name, "style", 5))
+            return TAG_STYLE;
+        if (!memcmp(name, "table", 5))
+            return TAG_TABLE;
+        if (!memcmp(name, "tbody", 5))
+            return TAG_TBODY;
+        if (!memcmp(name, "tfoot", 5))
+            return TAG_TFOOT;
+        if (!memcmp(name, "thead", 5))
+            return TAG_THEAD;
+        if (!memcmp(name, "title", 5))
+            return TAG_TITLE;
+        break;
+    case 6:
+        if (!memcmp(name, "option", 6))
+            return TAG_OPTION;
+        if (!memcmp(name, "script", 6))
+            return TAG_SCRIPT;
+        break;
+    case 7:
+        if (!memcmp(name, "isindex", 7))
+            return TAG_VOID;
+        break;
+    case 8:
+        if (!memcmp(name, "basefont", 8))
+            return TAG_VOID;
+        break;
+    default:
+        break;
+    }
+
+    return TAG_OTHER;
+}
+
+/*
+ * reads a tag name at pos into name in lower case, and returns the end of the
+ * name. *len is 0 if there is no name, and over SCAN_NAME_MAX if too long.
+ */
+static const char *scan_name(const char *pos, const char *end, char *name,
+                             int *len)
+{
+    int n = 0;
+
+    if (pos < end && (is_alpha(*pos) || *pos == '_' || *pos == ':')) {
+        for ( ; pos < end && is_name_char(*pos); pos++, n++)
+            if (n < SCAN_NAME_MAX)
+                name[n] = (*pos >= 'A' && *pos <= 'Z') ? *pos + 32 : *pos;
+    }
+
+    name[n < SCAN_NAME_MAX ? n : SCAN_NAME_MAX - 1] = '\0';
+    *len = n;
+
+    return pos;
+}
+
+/* returns the end of the name at pos, of an attribute */
+static inline const char *skip_name(const char *pos, const char *end)
+{
+    if (pos < end && (is_alpha(*pos) || *pos == '_' || *pos == ':'))
+        for (pos++; pos < end && is_name_char(*pos); pos++)
+            ;
+
+    return pos;
+}
+
+static inline int utf8_encode(char *out, unsigned int c)
+{
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xc0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3f);
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xe0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3f);
+        out[2] = 0x80 | (c & 0x3f);
+        return 3;
+    }
+
+    out[0] = 0xf0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3f);
+    out[2] = 0x80 | ((c >> 6) & 0x3f);
+    out[3] = 0x80 | (c & 0x3f);
+    return 4;
+}
+
+static inline int is_xml_char(unsigned int c)
+{
+    return c == 0x9 || c == 0xa || c == 0xd
+           || (c >= 0x20 && c <= 0xd7ff) || (c >= 0xe000 && c <= 0xfffd)
+           || (c >= 0x10000 && c <= 0x10ffff);
+}
+
+static inline int hex_value(int c)
+{
+    if (is_digit(c))
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * decodes the reference at amp into *out, as htmlParseReference() and
+ * htmlParseHTMLAttribute() of libxml2 do: a reference that cannot be decoded
+ * is kept as it is, except a bad character reference, which is dropped from
+ * a text and ends an attribute (*stop is set). returns the position after
+ * the reference.
+ */
+static const char *scan_reference(const char *amp, const char *end,
+                                  char **out, int attr, int *stop)
+{
+    const char *pos = amp + 1;
+    const char *name = NULL;
+    const htmlEntityDesc *ent = NULL;
+    unsigned int val = 0;
+    int d = 0;
+    char buf[32] = { 0, };
+
+    if (pos < end && *pos == '#') {
+        pos++;
+
+        if (pos < end && (*pos == 'x' || *pos == 'X')) {
+            for (pos++; pos < end && *pos != ';'; pos++) {
+                d = hex_value(*pos);
+                if (d < 0)
+                    break;
+                if (val < 0x110000)
+                    val = val*16 + d;
+            }
+        }
+        else {
+            for ( ; pos < end && *pos != ';'; pos++) {
+                if (!is_digit(*pos))
+                    break;
+                if (val < 0x110000)
+                    val = val*10 + (*pos - '0');
+            }
+        }
+
+        if (pos < end && *pos == ';')
+            pos++;
+
+        if (is_xml_char(val))
+            *out += utf8_encode(*out, val);
+        else if (attr)
+            *stop = 1;
+
+        return pos;
+    }
+
+    name = pos;
+    if (pos < end && (is_alpha(*pos) || *pos == '_' || *pos == ':'))
+        for (pos++; pos < end && is_name_char(*pos); pos++)
+            ;
+
+    if (pos == name) {
+        *(*out)++ = '&';
+        return pos;
+    }
+
+    if (pos < end && *pos == ';' && pos - name < (long) sizeof(buf)) {
+        memcpy(buf, name, pos - name);
+        buf[pos - name] = '\0';
+
+        ent = htmlEntityLookup((const xmlChar *) buf);
+        if (ent) {
+            *out += utf8_encode(*out, ent->value);
+            return pos + 1;
+        }
+    }
+
+    *(*out)++ = '&';
+    memcpy(*out, name, pos - name);
+    *out += pos - name;
+
+    return pos;
+}
+
+/*
+ * decodes the slice into out, which has room for as many bytes as the slice,
+ * terminates it and returns its length. a reference never decodes longer than
+ * itself.
+ */
+static size_t scan_decode(scan_str_t *str, char *out)
+{
+    char *start = out;
+    const char *pos = str->ptr;
+    const char *end = str->ptr + str->len;
+    const char *amp = NULL;
+    int stop = 0;
+
+    if (str->refs) {
+        while (!stop && (amp = memchr(pos, '&', end - pos)) != NULL) {
+            memcpy(out, pos, amp - pos);
+            out += amp - pos;
+            pos = scan_reference(amp, end, &out, str->attr, &stop);
+        }
+    }
+
+    if (!stop) {
+        memcpy(out, pos, end - pos);
+        out += end - pos;
+    }
+
+    *out = '\0';
+
+    return out - start;
+}
+
+/*
+ * copies the slice to the strings of the scan, decoded, and returns its
+ * offset, or -1 for none.
+ */
+static long scan_store(scan_t *scan, scan_str_t *str)
+{
+    size_t off = scan->len;
+    size_t size = 0;
+    char *tmp = NULL;
+
+    if (!str->ptr)
+        return -1;
+
+    if (scan->len + str->len + 1 > scan->size) {
+        size = scan->size ? scan->size : 4096;
+        while (scan->len + str->len + 1 > size)
+            size *= 2;
+
+        tmp = realloc(scan->strs, size);
+        if (!tmp) {
+            scan->ret = ENOMEM;
+            scan->done = 1;
+            return -1;
+        }
+
+        scan->strs = tmp;
+        scan->size = size;
+    }
+
+    scan->len += scan_decode(str, &scan->strs[off]) + 1;
+
+    return (long) off;
+}
+
+static inline const char *scan_str(scan_t *scan, long off)
+{
+    return off < 0 ? NULL : &scan->strs[off];
+}
+
+static char *scan_strdup(scan_t *scan, scan_str_t *str)
+{
+    char *buf = NULL;
+
+    if (!str->ptr)
+        return NULL;
+
+    buf = malloc(str->len + 1);
+    if (!buf) {
+        scan->ret = ENOMEM;
+        scan->done = 1;
+        return NULL;
+    }
+
+    scan_decode(str, buf);
+
+    return buf;
+}
+
+static inline void set_str(scan_str_t *str, const char *ptr, size_t len,
+                           int refs, int attr)
+{
+    str->ptr = ptr;
+    str->len = len;
+    str->refs = refs;
+    str->attr = attr;
+}
+
+/*
+ * appends len bytes of the page at str to the text of the element. the text
+ * has ended at a tag that made no node, and goes on after it. it is decoded
+ * into a buffer of its own, unless it is still one slice of the page.
+ */
+static void scan_append(scan_t *scan, scan_frame_t *f, const char *str,
+                        size_t len)
+{
+    char *buf = NULL;
+    char **tmp = NULL;
+    size_t n = 0;
+    scan_str_t more = { 0, };
+
+    if (f->text.refs && f->text.ptr + f->text.len == str) {
+        f->text.len += len;
+        goto out;
+    }
+
+    if (scan->n_spills == scan->max_spills) {
+        tmp = realloc(scan->spills, sizeof(char *)*(scan->max_spills + 16));
+        if (!tmp)
+            goto nomem;
+
+        scan->spills = tmp;
+        scan->max_spills += 16;
+    }
+
+    buf = malloc(f->text.len + len + 1);
+    if (!buf)
+        goto nomem;
+
+    scan->spills[scan->n_spills++] = buf;
+
+    set_str(&more, str, len, 1, 0);
+    n = scan_decode(&f->text, buf);
+    n += scan_decode(&more, &buf[n]);
+    set_str(&f->text, buf, n, 0, 0);
+
+out:
+    if (f->n_children == 1)
+        f->first = f->text;
+    return;
+
+nomem:
+    scan->ret = ENOMEM;
+    scan->done = 1;
+}
+
+static inline int is_tracked(scan_frame_t *f)
+{
+    return f->role >= ROLE_H1 && f->role != ROLE_TABLE && f->role != ROLE_ROW;
+}
+
+static int child_role(scan_t *scan, scan_frame_t *parent, int tag, int nth)
+{
+    switch (parent->role) {
+    case ROLE_DOC:
+        return parent->n_elements == 1 ? ROLE_ROOT : ROLE_NONE;
+    case ROLE_ROOT:
+        return tag == TAG_BODY && nth == 1 ? ROLE_BODY : ROLE_NONE;
+    case ROLE_BODY:
+        return tag == TAG_DIV && nth == 2 ? ROLE_OUTER : ROLE_NONE;
+    case ROLE_OUTER:
+        return tag == TAG_DIV && nth == 1 ? ROLE_INNER : ROLE_NONE;
+    case ROLE_INNER:
+        if (tag == TAG_DIV && nth == 1) {
+            scan->found = 1;
+            return ROLE_CONTENT;
+        }
+        return ROLE_NONE;
+    case ROLE_CONTENT:
+        if (tag == TAG_H1)
+            return ROLE_H1;
+        return tag == TAG_TABLE && nth == 1 ? ROLE_TABLE : ROLE_NONE;
+    case ROLE_TABLE:
+        /* the rows are the first tr and all that follow */
+        return parent->counts[TAG_TR] > 0 ? ROLE_ROW : ROLE_NONE;
+    case ROLE_ROW:
+        if (tag == TAG_TD)
+            return ROLE_TD;
+        return tag == TAG_TH && nth == 1 ? ROLE_TH : ROLE_NONE;
+    case ROLE_TD:
+        if (tag == TAG_A && nth == 1)
+            return ROLE_A;
+        return tag == TAG_SPAN && nth == 1 ? ROLE_SPAN : ROLE_NONE;
+    default:
+        return ROLE_NONE;
+    }
+}
+
+/* a child node other than text ends the text being read */
+static inline void add_child(scan_frame_t *f, int kind)
+{
+    f->in_text = 0;
+    f->capture = 0;
+    f->n_children++;
+
+    if (f->n_children == 1)
+        f->first_kind = kind;
+}
+
+static void end_row(scan_t *scan, scan_frame_t *row, scan_frame_t *table)
+{
+    int ret = 0;
+    int pos = 0;
+    int index = table->n_rows++;
+    size_t mark = scan->len;
+    long th = 0;
+    long content = 0;
+    long href = 0;
+    long cells[3] = { 0, };
+    scrap500_list_t *list = NULL;
+    scrap500_rank_t *rank = NULL;
+
+    switch (scan->type) {
+    case SCRAP500_PAGE_SITE:
+        break;      /* read from the cells, see scan_pop() */
+
+    case SCRAP500_PAGE_SYSTEM:
+        if (scan->ret || row->td_kind == NODE_NONE)
+            break;  /* no td, or column shown but no data available */
+
+        th = scan_store(scan, &row->th_text);
+        content = scan_store(scan, &row->td_first);
+        href = scan_store(scan, &row->td_attr);
+        if (scan->ret)
+            break;
+
+        ret = scrap500_parser_system_attr((scrap500_system_t *) scan->record,
+                                          scan_str(scan, th),
+                                          scan_str(scan, content),
+                                          scan_str(scan, href));
+        if (ret) {
+            fprintf(stderr, "failed to parse attribute %s\n",
+                            scan_str(scan, th));
+            scan->ret = ret;
+            scan->done = 1;
+        }
+        break;
+
+    default:
+        if (index >= 100)
+            break;
+
+        cells[0] = scan_store(scan, &row->cells[0]);
+        cells[1] = scan_store(scan, &row->cells[1]);
+        cells[2] = scan_store(scan, &row->cells[2]);
+        if (scan->ret)
+            break;
+
+        if (cells[0] < 0 || cells[1] < 0 || cells[2] < 0) {
+            scan->ret = EIO;
+            scan->done = 1;
+            break;
+        }
+
+        list = (scrap500_list_t *) scan->record;
+        pos = atoi(scan_str(scan, cells[0]));
+        if (pos < 1 || pos > 500) {
+            scan->ret = EIO;
+            scan->done = 1;
+            break;
+        }
+
+        rank = &list->rank[pos-1];
+        rank->rank = pos;
+        rank->site_id = scrap500_parser_link_id(scan_str(scan, cells[1]));
+        rank->system_id =
+                scrap500_parser_link_id(scan_str(scan, cells[2]));
+        if (!rank->site_id || !rank->system_id) {
+            scan->ret = EIO;
+            scan->done = 1;
+            break;
+        }
+
+        scan->n_rows++;
+        break;
+    }
+
+    scan->len = mark;
+}
+
+static inline void frame_init(scan_frame_t *f, int tag, int role,
+                              const char *name, int namelen, int nth)
+{
+    if (role == ROLE_NONE) {
+        f->tag = tag;
+        f->role = role;
+        f->name = name;
+        f->namelen = namelen;
+        return;
+    }
+
+    memset((void *) f, 0, sizeof(*f));
+
+    f->tag = tag;
+    f->role = role;
+    f->name = name;
+    f->namelen = namelen;
+    f->nth = nth;
+}
+
+/* closes the innermost element, and keeps what the record needs from it */
+static void scan_pop(scan_t *scan)
+{
+    scan_frame_t *f = &scan->frames[--scan->depth];
+    scan_frame_t *parent = &scan->frames[scan->depth - 1];
+    scan_frame_t *row = NULL;
+    scrap500_site_t *site = NULL;
+    size_t mark = scan->len;
+    long off = 0;
+
+    switch (f->role) {
+    case ROLE_CONTENT:
+        scan->done = 1;
+        break;
+
+    case ROLE_H1:
+        if (scan->type == SCRAP500_PAGE_SITE && f->nth == 2 && f->text.ptr) {
+            site = (scrap500_site_t *) scan->record;
+            site->name = scan_strdup(scan, &f->text);
+        }
+        else if (scan->type == SCRAP500_PAGE_SYSTEM && f->nth == 1
+                 && f->text.ptr) {
+            off = scan_store(scan, &f->text);
+            if (off >= 0)
+                scrap500_parser_system_name(
+                        (scrap500_system_t *) scan->record,
+                        scan_str(scan, off));
+            scan->len = mark;
+        }
+        break;
+
+    case ROLE_ROW:
+        end_row(scan, f, parent);
+        break;
+
+    case ROLE_TH:
+        parent->th_text = f->text;
+        break;
+
+    case ROLE_TD:
+        if (f->nth == 1) {
+            parent->td_kind = f->first_kind;
+            parent->td_first = f->first;
+            parent->td_attr = f->first_attr;
+            parent->cells[0] = f->span_first;
+        }
+        else if (f->nth <= 3)
+            parent->cells[f->nth - 1] = f->a_attr;
+
+        if (scan->type != SCRAP500_PAGE_SITE || parent->tag != TAG_TR)
+            break;
+
+        site = (scrap500_site_t *) scan->record;
+        row = parent;
+
+        if (f->nth != 1)
+            break;
+        else if (row->nth == 1 && f->a_text.ptr)
+            site->url = scan_strdup(scan, &f->a_text);
+        else if (row->nth == 2 && f->text.ptr)
+            site->segment = scan_strdup(scan, &f->text);
+        else if (row->nth == 3 && f->text.ptr)
+            site->city = scan_strdup(scan, &f->text);
+        else if (row->nth == 4 && f->text.ptr)
+            site->country = scan_strdup(scan, &f->text);
+        break;
+
+    case ROLE_A:
+        parent->a_text = f->text;
+        parent->a_attr = f->attr;
+        break;
+
+    case ROLE_SPAN:
+        parent->span_first = f->first;
+        break;
+
+    default:
+        break;
+    }
+}
+
+static inline int has_open(scan_t *scan, int tag)
+{
+    int i = 0;
+
+    for (i = 1; i < scan->depth; i++)
+        if (scan->frames[i].tag == tag)
+            return 1;
+
+    return 0;
+}
+
+/*
+ * opens an element, as the last child of the innermost one. returns 1 if it
+ * is opened.
+ */
+static int scan_start(scan_t *scan, int tag, const char *name, int namelen,
+                      const char *lname, scan_str_t *attr)
+{
+    int nth = 0;
+    int role = ROLE_NONE;
+    scan_frame_t *parent = NULL;
+
+    /* a misplaced html, head or body is dropped, and so is its end tag */
+    if ((tag == TAG_HTML && scan->depth > 1)
+        || (tag == TAG_HEAD && scan->depth != 2)
+        || (tag == TAG_BODY && has_open(scan, TAG_BODY))) {
+        scan->misplaced++;
+        return 0;
+    }
+
+    while (scan->depth > 1
+           && (start_closes[tag] & (1U << scan->frames[scan->depth-1].tag)))
+        scan_pop(scan);
+
+    if (scan->done || scan->depth == SCAN_MAX_DEPTH)
+        return 0;
+
+    parent = &scan->frames[scan->depth - 1];
+    parent->n_elements++;
+
+    if (parent->role != ROLE_NONE) {
+        nth = ++parent->counts[tag];
+        role = child_role(scan, parent, tag, nth);
+    }
+
+    if (is_tracked(parent)) {
+        add_child(parent, NODE_ELEMENT);
+
+        parent->last = NODE_ELEMENT;
+        parent->last_text = namelen < SCAN_NAME_MAX
+                            && scrap500_parser_text_element(lname);
+
+        if (parent->n_children == 1)
+            parent->first_attr = *attr;
+    }
+
+    frame_init(&scan->frames[scan->depth++], tag, role, name, namelen, nth);
+
+    if (role == ROLE_A)
+        scan->frames[scan->depth - 1].attr = *attr;
+
+    return 1;
+}
+
+static inline int is_element(scan_frame_t *f, int tag, const char *name,
+                             int namelen)
+{
+    return f->tag == tag
+           && (tag != TAG_OTHER || (f->namelen == namelen
+                                    && !strncasecmp(f->name, name, namelen)));
+}
+
+/* closes the element of the end tag, and those opened after it */
+static void scan_end(scan_t *scan, int tag, const char *name, int namelen)
+{
+    int i = 0;
+    int priority = end_priority(tag);
+
+    for (i = scan->depth - 1; i > 0; i--) {
+        if (is_element(&scan->frames[i], tag, name, namelen))
+            break;
+        if (end_priority(scan->frames[i].tag) > priority)
+            return;
+    }
+
+    while (i > 0 && scan->depth > i && !scan->done)
+        scan_pop(scan);
+}
+
+static void scan_text(scan_t *scan, const char *str, size_t len, int at_end)
+{
+    scan_frame_t *f = &scan->frames[scan->depth - 1];
+
+    if (!is_tracked(f))
+        return;
+
+    if (f->in_text) {
+        if (f->capture)
+            scan_append(scan, f, str, len);
+        return;
+    }
+
+    /* blanks after an element without text are not in the tree */
+    if (len <= SCAN_BLANKS_MAX && is_blank(str, len)
+        && (at_end || (f->last == NODE_ELEMENT && !f->last_text)))
+        return;
+
+    add_child(f, NODE_TEXT);
+    f->in_text = 1;
+    f->last = NODE_TEXT;
+
+    if (!f->text.ptr) {
+        f->capture = 1;
+        set_str(&f->text, str, len, 1, 0);
+    }
+
+    if (f->n_children == 1)
+        f->first = f->text;
+}
+
+/* a comment or a pi, of which the content is kept as it is */
+static void scan_content_node(scan_t *scan, const char *str, size_t len)
+{
+    scan_frame_t *f = &scan->frames[scan->depth - 1];
+
+    if (!is_tracked(f))
+        return;
+
+    add_child(f, NODE_OTHER);
+
+    if (f->n_children == 1)
+        set_str(&f->first, str, len, 0, 0);
+}
+
+/*
+ * reads the start tag after '<' at pos, with the value of its first
+ * attribute, and returns the position after the tag.
+ */
+static const char *scan_start_tag(scan_t *scan, const char *pos,
+                                  const char *end)
+{
+    int tag = TAG_OTHER;
+    int namelen = 0;
+    int empty = 0;
+    int first = 1;
+    const char *name = pos;
+    const char *value = NULL;
+    char quote = 0;
+    char lname[SCAN_NAME_MAX] = { 0, };
+    scan_str_t attr = { 0, };
+
+    pos = scan_name(pos, end, lname, &namelen);
+    tag = namelen < SCAN_NAME_MAX ? tag_of(lname, namelen) : TAG_OTHER;
+
+    while (pos < end) {
+        if (is_blank_char(*pos)) {
+            pos++;
+            continue;
+        }
+
+        if (*pos == '>') {
+            pos++;
+            break;
+        }
+
+        if (*pos == '/' && pos + 1 < end && pos[1] == '>') {
+            empty = 1;
+            pos += 2;
+            break;
+        }
+
+        value = pos;
+        pos = skip_name(pos, end);
+
+        if (pos == value) {
+            /* not an attribute, up to the next blank or the end */
+            while (pos < end && !is_blank_char(*pos) && *pos != '>'
+                   && !(*pos == '/' && pos + 1 < end && pos[1] == '>'))
+                pos++;
+            continue;
+        }
+
+        while (pos < end && is_blank_char(*pos))
+            pos++;
+
+        if (pos == end || *pos != '=') {
+            first = 0;      /* an attribute without value */
+            continue;
+        }
+
+        for (pos++; pos < end && is_blank_char(*pos); pos++)
+            ;
+
+        if (pos < end && (*pos == '"' || *pos == '\'')) {
+            quote = *pos++;
+            value = pos;
+            pos = memchr(pos, quote, end - pos);
+            if (!pos)
+                pos = end;
+            if (first)
+                set_str(&attr, value, pos - value, 1, 1);
+            if (pos < end)
+                pos++;
+        }
+        else {
+            value = pos;
+            while (pos < end && !is_blank_char(*pos) && *pos != '>')
+                pos++;
+            if (first)
+                set_str(&attr, value, pos - value, 1, 1);
+        }
+
+        first = 0;
+    }
+
+    if (scan_start(scan, tag, name, namelen, lname, &attr)
+        && (empty || tag == TAG_VOID || tag == TAG_COL || tag == TAG_HR))
+        scan_pop(scan);
+
+    return pos;
+}
+
+/*
+ * reads the end tag after "</" at pos. without a name, only the "</" is read
+ * and what follows is text.
+ */
+static const char *scan_end_tag(scan_t *scan, const char *pos,
+                                const char *end)
+{
+    int tag = TAG_OTHER;
+    int len = 0;
+    const char *name = pos;
+    char lname[SCAN_NAME_MAX] = { 0, };
+
+    pos = scan_name(pos, end, lname, &len);
+    if (len == 0)
+        return pos;
+
+    if (len < SCAN_NAME_MAX)
+        tag = tag_of(lname, len);
+
+    if (scan->misplaced > 0
+        && (tag == TAG_HTML || tag == TAG_HEAD || tag == TAG_BODY))
+        scan->misplaced--;
+    else
+        scan_end(scan, tag, name, len);
+
+    pos = memchr(pos, '>', end - pos);
+
+    return pos ? pos + 1 : end;
+}
+
+/* returns MARKUP_* at lt, as htmlParseContent() of libxml2 tells it */
+static inline int markup_at(const char *lt, const char *end)
+{
+    if (end - lt < 2)
+        return MARKUP_NONE;
+
+    if (is_alpha(lt[1]))
+        return MARKUP_START;
+
+    switch (lt[1]) {
+    case '/':
+        return MARKUP_END;
+    case '?':
+        return MARKUP_PI;
+    case '!':
+        if (end - lt >= 4 && lt[2] == '-' && lt[3] == '-')
+            return MARKUP_COMMENT;
+        if (end - lt >= 9 && !strncasecmp(&lt[2], "doctype", 7))
+            return MARKUP_DOCTYPE;
+        return MARKUP_NONE;
+    default:
+        return MARKUP_NONE;
+    }
+}
+
+/* reads the markup of the kind at lt, and returns the position after it */
+static const char *scan_markup(scan_t *scan, int kind, const char *lt,
+                               const char *end)
+{
+    int len = 0;
+    const char *pos = NULL;
+    const char *close = NULL;
+    char name[SCAN_NAME_MAX] = { 0, };
+
+    switch (kind) {
+    case MARKUP_START:
+        return scan_start_tag(scan, lt + 1, end);
+
+    case MARKUP_END:
+        return scan_end_tag(scan, lt + 2, end);
+
+    case MARKUP_COMMENT:
+        close = memmem(lt + 4, end - lt - 4, "-->", 3);
+        if (!close)
+            return end;
+
+        scan_content_node(scan, lt + 4, close - lt - 4);
+        return close + 3;
+
+    case MARKUP_PI:
+        /* the content is what follows the target, up to '>' */
+        pos = scan_name(lt + 2, end, name, &len);
+        close = memchr(pos, '>', end - pos);
+        if (len > 0) {
+            while (pos < end && is_blank_char(*pos))
+                pos++;
+            if (close && pos > close)
+                pos = close;
+
+            scan_content_node(scan, pos, (close ? close : end) - pos);
+        }
+        return close ? close + 1 : end;
+
+    default:
+        /* a doctype makes no node here */
+        close = memchr(lt, '>', end - lt);
+        return close ? close + 1 : end;
+    }
+}
+
+static inline int is_raw(scan_t *scan)
+{
+    int tag = scan->frames[scan->depth - 1].tag;
+
+    return tag == TAG_SCRIPT || tag == TAG_STYLE;
+}
+
+/*
+ * scans the page up to the end of the content div. the content of a script
+ * or a style ends at the first "</" and a letter, as in libxml2.
+ */
+static void scan_page(scan_t *scan, const char *pos, const char *end)
+{
+    int kind = 0;
+    const char *text = pos;
+    const char *lt = NULL;
+
+    while (!scan->done) {
+        lt = find_lt(pos, end);
+        if (lt == end) {
+            if (!is_raw(scan) && lt > text)
+                scan_text(scan, text, end - text, 1);
+            break;
+        }
+
+        kind = markup_at(lt, end);
+
+        if (is_raw(scan)) {
+            if (kind != MARKUP_END || lt + 2 == end || !is_alpha(lt[2])) {
+                pos = lt + 1;
+                continue;
+            }
+        }
+        else if (kind == MARKUP_NONE) {
+            /* the blanks before it are text of their own to libxml2 */
+            if (lt > text && is_blank(text, lt - text)) {
+                scan_text(scan, text, lt - text, 0);
+                text = lt;
+            }
+
+            pos = lt + 1;
+            continue;
+        }
+        else if (lt > text)
+            scan_text(scan, text, lt - text, 0);
+
+        pos = text = scan_markup(scan, kind, lt, end);
+    }
+
+    while (scan->depth > 1 && !scan->done)
+        scan_pop(scan);
+}
+
+/*
+ * scans the cached page into the record. the state is kept for the next page
+ * of the thread.
+ */
+static int scan_parse(int type, uint64_t id, void *record)
+{
+    int ret = 0;
+    scan_t *scan = scan_state;
+    scrap500_page_t page = { 0, };
+
+    if (!scan) {
+        pthread_once(&scan_once, scan_init);
+
+        scan = calloc(1, sizeof(*scan));
+        if (!scan)
+            return ENOMEM;
+
+        scan_state = scan;
+    }
+
+    ret = scrap500_cache_map_page(type, id, &page);
+    if (ret)
+        return ret;
+
+    scan->type = type;
+    scan->id = id;
+    scan->record = record;
+    scan->ret = 0;
+    scan->found = 0;
+    scan->done = 0;
+    scan->n_rows = 0;
+    scan->depth = 1;
+    scan->misplaced = 0;
+    scan->len = 0;
+    frame_init(&scan->frames[0], TAG_OTHER, ROLE_DOC, NULL, 0, 0);
+
+    scan_page(scan, page.data, page.data + page.len);
+
+    while (scan->n_spills > 0)
+        free(scan->spills[--scan->n_spills]);
+
+    scrap500_cache_unmap_page(&page);
+
+    return 0;
+}
+
+int scrap500_scan_parse_list(scrap500_list_t *list)
+{
+    int ret = 0;
+    int page = 0;
+
+    for (page = 1; page <= 5; page++) {
+        ret = scan_parse(SCRAP500_PAGE_LIST,
+                         scrap500_list_page_id(list->id, page), list);
+        if (ret || !scan_state->found || scan_state->ret
+            || scan_state->n_rows < 100) {
+            fprintf(stderr, "cannot parse the document (list=%d)\n", list->id);
+            return ret ? ret : EIO;
+        }
+    }
+
+    return 0;
+}
+
+int scrap500_scan_parse_site(uint64_t site_id, scrap500_site_t *site)
+{
+    int ret = 0;
+
+    site->id = site_id;
+
+    ret = scan_parse(SCRAP500_PAGE_SITE, site_id, site);
+    if (ret || !scan_state->found) {
+        fprintf(stderr, "cannot parse the document (site=%llu)\n",
+                        _llu(site_id));
+        return ret ? ret : EIO;
+    }
+
+    return scan_state->ret;
+}
+
+int scrap500_scan_parse_system(uint64_t system_id, scrap500_system_t *system)
+{
+    int ret = 0;
+
+    system->id = system_id;
+
+    ret = scan_parse(SCRAP500_PAGE_SYSTEM, system_id, system);
+    if (ret || !scan_state->found) {
+        fprintf(stderr, "cannot parse the document (system=%llu)\n",
+                        _llu(system_id));
+        return ret ? ret : EIO;
+    }
+
+    ret = scan_state->ret;
+    if (ret) {
+        fprintf(stderr, "failed to parse system table\n");
+        fprintf(stderr, "failed to parse the system record.\n");
+    }
+
+    return ret;
+}
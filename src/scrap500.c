@@ -25,18 +25,18 @@ static int debug;
 static int initdb;
 static int no_fetch;
 static int specs;
+static int update;
 
 static uint64_t query_site;
 
 static uint32_t n_list;
 static uint32_t n_list_all;
+static uint32_t this_month;     /* YYYYMM */
 static scrap500_list_t *scrap500_list;
 
 char *scrap500_datadir = "/tmp/scrap500";
 static char *dbname = "scrap500.sqlite3.db";
 
-static uint32_t n_threads;
-
 static int prepare_datadir(void)
 {
     int ret = 0;
@@ -66,9 +66,10 @@ out:
 
 static inline scrap500_list_t *allocate_list(struct tm *now)
 {
-    uint32_t years = (now->tm_year + 1900) - 1993;
+    uint32_t years = (now->tm_year + 1900) - 1993 + 1;
 
     n_list_all = years*2;
+    this_month = (now->tm_year + 1900)*100 + now->tm_mon + 1;
 
     return calloc(n_list_all, sizeof(*scrap500_list));
 }
@@ -77,20 +78,18 @@ static inline void set_all_list(void)
 {
     uint32_t i = 0;
     uint32_t id = 0;
-    scrap500_list_t *list = NULL;
 
-    for (i = 0; i < n_list_all; i += 2) {
-        id = (1993 + i/2)*100;
+    n_list = 0;
 
-        list = &scrap500_list[i];
-        list->id = id + 6;
+    for (i = 0; i < n_list_all; i++) {
+        id = (1993 + i/2)*100 + (i % 2 ? 11 : 6);
 
+        /* a list is published during its month, take it from the next */
+        if (id >= this_month)
+            break;
 
-        list = &list[1];
-        list->id = id + 11;
+        scrap500_list[n_list++].id = id;
     }
-
-    n_list = n_list_all;
 }
 
 static inline void list_append(char *datestr)
@@ -121,76 +120,74 @@ die:
     exit(errno);
 }
 
-static inline int open_tmpfiles(scrap500_list_t *list)
+static inline void dump_list(scrap500_list_t *list)
 {
     int i = 0;
-    FILE *fp = NULL;
-    char filename[PATH_MAX] = { 0, };
+    scrap500_rank_t *rank = NULL;
 
     if (!list)
-        return EINVAL;
-
-    for (i = 0; i < 5; i++) {
-        scrap500_list_html_filename(list, i+1, filename);
-        fp = fopen(filename, "w");
-        if (!fp) {
-            perror("failed to create a tmpfile");
-            return errno;
-        }
-
-        list->tmpfp[i] = fp;
-    }
-
-    return 0;
-}
+        return;
 
-static inline void rewind_tmpfiles(scrap500_list_t *list)
-{
-    int i = 0;
+    printf("## list: %d\n", list->id);
 
-    if (!list)
-        return;
+    for (i = 0; i < 500; i++) {
+        rank = &list->rank[i];
 
-    for (i = 0; i < 5; i++)
-        if (list->tmpfp[i])
-            rewind(list->tmpfp[i]);
+        printf("[%3d] site=%6llu, system=%6llu\n",
+                rank->rank, _llu(rank->site_id), _llu(rank->system_id));
+    }
 }
 
-static inline void close_tmpfiles(scrap500_list_t *list)
+static int parse_list_cb(scrap500_list_t *list, void *data)
 {
-    int i = 0;
+    int ret = 0;
 
-    if (!list)
-        return;
+    /*
+     * the pages have been parsed while they were fetched, unless some were
+     * not fetched at all, e.g., those of an interrupted crawl, or with -n.
+     */
+    if (scrap500_list_streamed(list))
+        return 0;
 
-    for (i = 0; i < 5; i++)
-        if (list->tmpfp[i])
-            fclose(list->tmpfp[i]);
+    ret = scrap500_parser_parse_list(list);
+    if (ret)
+        fprintf(stderr, "failed to parse the list.\n");
+
+    return ret;
 }
 
-static inline void dump_list(scrap500_list_t *list)
+/*
+ * for the incremental crawl (-U): keeps only the lists newer than the latest
+ * one in the database. of their sites and systems, the fetcher skips those
+ * that are cached already, as in any crawl.
+ */
+static int prepare_update(scrap500_db_t db)
 {
-    int i = 0;
-    scrap500_rank_t *rank = NULL;
+    int ret = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+    uint32_t latest = 0;
 
-    if (!list)
-        return;
+    ret = scrap500_db_read_latest(db, &latest);
+    if (ret)
+        return ret;
 
-    printf("## list: %d\n", list->id);
+    for (i = 0; i < n_list; i++) {
+        if (scrap500_list[i].id > latest)
+            scrap500_list[n++].id = scrap500_list[i].id;
+    }
 
-    for (i = 0; i < 500; i++) {
-        rank = &list->rank[i];
+    n_list = n;
 
-        printf("[%3d] site=%6llu, system=%6llu\n",
-                rank->rank, _llu(rank->site_id), _llu(rank->system_id));
-    }
+    printf("## %u new lists since %u\n", n_list, latest);
+
+    return 0;
 }
 
 static void *scrap500_run(void *data)
 {
     int i = 0;
     int ret = 0;
-    int page = 0;
     scrap500_db_t db = NULL;
     scrap500_list_t *list = NULL;
 
@@ -200,42 +197,47 @@ static void *scrap500_run(void *data)
         goto out;
     }
 
-    for (i = 0; i < n_list; i++) {
-        list = &scrap500_list[i];
-        if (!list)
-            continue;
-
-        if (!no_fetch) {
-            open_tmpfiles(list);
-
-            ret = scrap500_http_fetch_list(list);
-            if (ret) {
-                fprintf(stderr, "failed to fetch the list.\n");
-                goto out;
-            }
+    if (update) {
+        ret = prepare_update(db);
+        if (ret || !n_list)
+            goto out_close;
+    }
 
-            close_tmpfiles(list);
+    if (!no_fetch) {
+        ret = scrap500_http_fetch_lists(scrap500_list, n_list,
+                                        parse_list_cb, NULL);
+        if (ret) {
+            fprintf(stderr, "failed to fetch the list.\n");
+            goto out_close;
         }
+    }
+    else {
+        for (i = 0; i < n_list; i++) {
+            ret = parse_list_cb(&scrap500_list[i], NULL);
+            if (ret)
+                goto out_close;
+        }
+    }
 
-        ret = scrap500_parser_parse_list(list);
+    if (!no_fetch && specs) {
+        ret = scrap500_http_fetch_specs(scrap500_list, n_list);
         if (ret) {
-            fprintf(stderr, "failed to parse the list.\n");
-            goto out;
+            fprintf(stderr, "failed to fetch specifications.\n");
+            goto out_close;
         }
+    }
 
-        if (!no_fetch && specs) {
-            ret = scrap500_http_fetch_specs(list);
-            if (ret) {
-                fprintf(stderr, "failed to fetch specifications.\n");
-                goto out;
-            }
-        }
+    if (!no_fetch)
+        scrap500_journal_finish();
+
+    for (i = 0; i < n_list; i++) {
+        list = &scrap500_list[i];
 
         if (specs) {
             ret = scrap500_parser_parse_specs(list);
             if (ret) {
                 fprintf(stderr, "failed to parse specs.\n");
-                goto out;
+                goto out_close;
             }
         }
 
@@ -245,10 +247,11 @@ static void *scrap500_run(void *data)
         ret = scrap500_db_write_list(db, list);
         if (ret) {
             fprintf(stderr, "failed to process the database.\n");
-            goto out;
+            goto out_close;
         }
     }
 
+out_close:
     scrap500_db_close(db);
 
 out:
@@ -270,36 +273,68 @@ static inline void read_program_name(const char *path)
 
 static struct option const long_opts[] = {
     { "all", 0, 0, 'a' },
+    { "trim", 0, 0, 'c' },
     { "debug", 0, 0, 'd' },
     { "dbname", 1, 0, 'D' },
+    { "hedge", 0, 0, 'e' },
     { "help", 0, 0, 'h' },
+    { "http2", 0, 0, 'H' },
     { "initdb", 0, 0, 'i' },
+    { "inflight", 1, 0, 'I' },
+    { "pack", 0, 0, 'k' },
     { "list", 1, 0, 'l' },
+    { "max-rate", 1, 0, 'M' },
     { "no-fetch", 0, 0, 'n' },
+    { "no-save", 0, 0, 'N' },
     { "path", 1, 0, 'p' },
+    { "stream", 0, 0, 'P' },
+    { "rate", 1, 0, 'R' },
     { "specs", 0, 0, 's' },
     { "site", 1, 0, 'S' },
-    { "threads", 1, 0, 'n' },
+    { "refresh", 0, 0, 'r' },
+    { "threads", 1, 0, 't' },
+    { "timeout", 1, 0, 'T' },
+    { "url", 1, 0, 'u' },
+    { "update", 0, 0, 'U' },
+    { "compress", 1, 0, 'z' },
     { 0, 0, 0, 0},
 };
 
-static const char *short_opts = "adD:hil:np:sS:t:";
+static const char *short_opts = "acdD:ehHiI:kl:M:nNp:PrR:sS:t:T:u:Uz:";
 
 static const char *usage_str =
 "Usage: %s [options..]\n"
 "\n"
 "  available options:\n"
 "  -a, --all              get all available list\n"
+"  -c, --trim             keep only the content of the fetched pages\n"
 "  -d, --debug            run in a debugging mode with noisy output\n"
 "  -D, --dbname=<db file> store output in sqlite datbase <db file>\n"
+"  -e, --hedge            resend site/system requests slower than usual\n"
 "  -h, --help             print help message\n"
+"  -H, --http2            multiplex requests over HTTP/2 when supported\n"
 "  -i, --initdb           initialize the database\n"
+"  -I, --inflight=<N>     keep up to <N> list page requests in flight\n"
+"  -k, --pack             keep the pages in one file, <dirname>/pages.pack\n"
 "  -l, --list=<YYYYMM>    get the list of <YYYYMM>\n"
+"  -M, --max-rate=<N>     never send more than <N> requests per second\n"
+"                         (default: 32), 0 for no bound\n"
 "  -n, --no-fetch         do not fetch from network but use the cached files\n"
+"  -N, --no-save          with -P, do not store the raw list pages\n"
 "  -p, --path=<dirname>   store data in <dirname> (default: /tmp/scrap500)\n"
+"  -P, --stream           parse list pages while they are downloaded\n"
+"  -r, --refresh          revalidate cached pages with conditional requests\n"
+"  -R, --rate=<N>         limit the requests, starting at <N> per second\n"
+"                         (default: 8), 0 to disable rate limiting\n"
 "  -s, --specs            fetch system and site details\n"
 "  -S, --site=<site_id>   print the information of site <site_id>\n"
-"  -t, --threads=<N>      spawn n threads\n"
+"  -t, --threads=<N>      fetch specifications with <N> threads\n"
+"  -T, --timeout=<sec>    abort a request after <sec> seconds (default: 120)\n"
+"  -u, --url=<baseurl>    fetch pages from <baseurl> instead of top500.org\n"
+"  -U, --update           fetch only the lists newer than the database has,\n"
+"                         and the sites and systems not cached yet\n"
+"  -z, --compress=<fmt>   store pages with <fmt>: zstd (default if built\n"
+"                         with libzstd), gzip, or none\n"
 "\n";
 
 static inline void usage(int ec)
@@ -335,6 +370,10 @@ int main(int argc, char **argv)
             set_all_list();
             break;
 
+        case 'c':
+            scrap500_http_config.trim = 1;
+            break;
+
         case 'd':
             debug = 1;
             break;
@@ -343,10 +382,26 @@ int main(int argc, char **argv)
             dbname = optarg;
             break;
 
+        case 'e':
+            scrap500_http_config.hedge = 1;
+            break;
+
         case 'i':
             initdb = 1;
             break;
 
+        case 'H':
+            scrap500_http_config.http2 = 1;
+            break;
+
+        case 'I':
+            scrap500_http_config.max_inflight = atoi(optarg);
+            break;
+
+        case 'k':
+            scrap500_http_config.pack = 1;
+            break;
+
         case 'l':
             list_append(optarg);
             break;
@@ -355,10 +410,18 @@ int main(int argc, char **argv)
             no_fetch = 1;
             break;
 
+        case 'N':
+            scrap500_http_config.nosave = 1;
+            break;
+
         case 'p':
             scrap500_datadir = optarg;
             break;
 
+        case 'P':
+            scrap500_http_config.stream = 1;
+            break;
+
         case 's':
             specs = 1;
             break;
@@ -367,8 +430,41 @@ int main(int argc, char **argv)
             query_site = strtoull(optarg, NULL, 0);
             break;
 
+        case 'M':
+            scrap500_http_config.max_rate = atof(optarg);
+            break;
+
+        case 'r':
+            scrap500_http_config.refresh = 1;
+            break;
+
+        case 'R':
+            scrap500_http_config.rate = atof(optarg);
+            break;
+
         case 't':
-            n_threads = atoi(optarg);
+            scrap500_http_config.nthreads = atoi(optarg);
+            break;
+
+        case 'T':
+            scrap500_http_config.timeout = atol(optarg);
+            break;
+
+        case 'u':
+            scrap500_http_config.baseurl = optarg;
+            break;
+
+        case 'U':
+            update = 1;
+            break;
+
+        case 'z':
+            scrap500_http_config.compress =
+                scrap500_cache_format_by_name(optarg);
+            if (scrap500_http_config.compress < 0) {
+                fprintf(stderr, "unknown format %s\n", optarg);
+                usage(1);
+            }
             break;
 
         case 'h':
@@ -378,6 +474,10 @@ int main(int argc, char **argv)
         }
     }
 
+    /* an update looks for new lists among all of them by default */
+    if (update && !n_list)
+        set_all_list();
+
     if (query_site) {
         scrap500_site_t site = { 0, };
 
@@ -397,10 +497,25 @@ int main(int argc, char **argv)
         goto out;
     }
 
+    /* without fetching, the crawl journal and the page index stay as are */
+    if (no_fetch) {
+        scrap500_run(NULL);
+        goto out;
+    }
+
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
+    ret = scrap500_http_init();
+    if (ret) {
+        fprintf(stderr, "failed to initialize http.\n");
+        goto out_cleanup;
+    }
+
     scrap500_run(NULL);
 
+    scrap500_http_exit();
+
+out_cleanup:
     curl_global_cleanup();
 
 out:
@@ -11,6 +11,7 @@
 #include <config.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
@@ -68,107 +69,143 @@ static inline void scrap500_site_dump(scrap500_site_t *site)
            __strprint(site->country));
 }
 
+/*
+ * the attributes of a system, from the rows of the table on its page:
+ *
+ *   X(field, type, label, first, last, unit)
+ *
+ * field is that of scrap500_system_t, and the column of the system table.
+ * type is SCRAP500_ATTR_<type> below. label is that of the row, in lowercase
+ * and without the colon, and first and last are its first and last characters
+ * for the hash in scrap500-parser.c. unit is that of the number on the page.
+ */
+#define SCRAP500_SYSTEM_ATTRS(X)                                            \
+    X(site_id, ID, "site", 's', 'e', "")                                    \
+    X(url, LINK, "system url", 's', 'l', "")                                \
+    X(manufacturer, STR, "manufacturer", 'm', 'r', "")                      \
+    X(cores, NUM, "cores", 'c', 's', "")                                    \
+    X(memory, NUM, "memory", 'm', 'y', "GB")                                \
+    X(processor, STR, "processor", 'p', 'r', "")                            \
+    X(interconnect, STR, "interconnect", 'i', 't', "")                      \
+    X(linpack, NUM, "linpack performance (rmax)", 'l', ')', "TFlop/s")      \
+    X(tpeak, NUM, "theoretical peak (rpeak)", 't', ')', "TFlop/s")          \
+    X(nmax, NUM, "nmax", 'n', 'x', "")                                      \
+    X(nhalf, NUM, "nhalf", 'n', 'f', "")                                    \
+    X(hpcg, NUM, "hpcg [tflop/s]", 'h', ']', "TFlop/s")                     \
+    X(power, NUM, "power", 'p', 'r', "kW")                                  \
+    X(pml, NUM, "power measurement level", 'p', 'l', "")                    \
+    X(mcores, NUM, "measured cores", 'm', 's', "")                          \
+    X(os, STR, "operating system", 'o', 'm', "")                            \
+    X(compiler, STR, "compiler", 'c', 'r', "")                              \
+    X(mathlib, STR, "math library", 'm', 'y', "")                           \
+    X(mpi, STR, "mpi", 'm', 'i', "")
+
+enum {
+    SCRAP500_ATTR_ID = 0,       /* uint64_t, the id at the end of the link */
+    SCRAP500_ATTR_LINK,         /* char *, the link */
+    SCRAP500_ATTR_STR,          /* char *, the text */
+    SCRAP500_ATTR_NUM,          /* double, the number in the text */
+};
+
+#define SCRAP500_ATTR_CTYPE_ID      uint64_t
+#define SCRAP500_ATTR_CTYPE_LINK    char *
+#define SCRAP500_ATTR_CTYPE_STR     char *
+#define SCRAP500_ATTR_CTYPE_NUM     double
+
+#define SCRAP500_SYSATTR_FIELD(field, type, label, first, last, unit)     \
+        SCRAP500_ATTR_CTYPE_##type field;
+
+#define SCRAP500_SYSATTR_INDEX(field, type, label, first, last, unit)     \
+        SCRAP500_SYSATTR_##field,
+
 struct _scrap500_system {
     uint64_t id;
-    uint64_t site_id;
     char *name;
-    char *url;
-    char *manufacturer;
-
-    double cores;
-    double memory;
-    char *processor;
-    char *interconnect;
-    double linpack;
-    double tpeak;
-    double nmax;
-    double nhalf;
-    double hpcg;
-    double power;
-    double pml;
-    double mcores;
-    char *os;
-    char *compiler;
-    char *mathlib;
-    char *mpi;
+    SCRAP500_SYSTEM_ATTRS(SCRAP500_SYSATTR_FIELD)
 };
 
 typedef struct _scrap500_system scrap500_system_t;
 
+/* the index of each attribute in scrap500_sysattrs */
+enum {
+    SCRAP500_SYSTEM_ATTRS(SCRAP500_SYSATTR_INDEX)
+    N_SCRAP500_SYSATTRS,
+};
+
+struct _scrap500_sysattr {
+    const char *field;
+    const char *label;
+    int type;
+    size_t offset;              /* of the field in scrap500_system_t */
+    const char *unit;
+};
+
+typedef struct _scrap500_sysattr scrap500_sysattr_t;
+
+/* SCRAP500_SYSTEM_ATTRS, as a table, see scrap500-parser.c */
+extern const scrap500_sysattr_t scrap500_sysattrs[N_SCRAP500_SYSATTRS];
+
+static inline void *scrap500_sysattr_field(scrap500_system_t *system,
+                                           const scrap500_sysattr_t *attr)
+{
+    return (char *) system + attr->offset;
+}
+
+static inline int scrap500_sysattr_is_str(const scrap500_sysattr_t *attr)
+{
+    return attr->type == SCRAP500_ATTR_LINK || attr->type == SCRAP500_ATTR_STR;
+}
+
 static inline void scrap500_system_reset(scrap500_system_t *system)
 {
+    int i = 0;
+    const scrap500_sysattr_t *attr = NULL;
+
     if (system) {
         if (system->name)
             free(system->name);
-        if (system->url)
-            free(system->url);
-        if (system->manufacturer)
-            free(system->manufacturer);
-        if (system->processor)
-            free(system->processor);
-        if (system->interconnect)
-            free(system->interconnect);
-        if (system->os)
-            free(system->os);
-        if (system->compiler)
-            free(system->compiler);
-        if (system->mathlib)
-            free(system->mathlib);
-        if (system->mpi)
-            free(system->mpi);
+
+        for (i = 0; i < N_SCRAP500_SYSATTRS; i++) {
+            attr = &scrap500_sysattrs[i];
+            if (scrap500_sysattr_is_str(attr))
+                free(*(char **) scrap500_sysattr_field(system, attr));
+        }
 
         memset((void *) system, 0, sizeof(*system));
     }
 }
 
-
 static inline void scrap500_system_dump(scrap500_system_t *system)
 {
+    int i = 0;
+    void *val = NULL;
+    const scrap500_sysattr_t *attr = NULL;
+
     if (!system)
         return;
 
-    printf("\n## system: %s (id=%llu)\n"
-           "## site_id: %llu\n"
-           "## url: %s\n"
-           "## manufacturer: %s\n"
-           "## cores: %lu\n"
-           "## memory: %lu GB\n"
-           "## processor: %s\n"
-           "## interconnect: %s\n"
-           "## linpack: %.2lf\n"
-           "## tpeak: %.2lf\n"
-           "## nmax: %.2lf\n"
-           "## nhalf: %.2lf\n"
-           "## hpcg: %.2lf\n"
-           "## power: %.2lf\n"
-           "## pml: %.2lf\n"
-           "## mcores: %.2lf\n"
-           "## os: %s\n"
-           "## compiler: %s\n"
-           "## mathlib: %s\n"
-           "## mpi: %s\n"
-           "\n",
-           __strprint(system->name), _llu(system->id),
-           _llu(system->site_id),
-           __strprint(system->url),
-           __strprint(system->manufacturer),
-           (unsigned long) system->cores,
-           (unsigned long) system->memory,
-           __strprint(system->processor),
-           __strprint(system->interconnect),
-           system->linpack,
-           system->tpeak,
-           system->nmax,
-           system->nhalf,
-           system->hpcg,
-           system->power,
-           system->pml,
-           system->mcores,
-           __strprint(system->os),
-           __strprint(system->compiler),
-           __strprint(system->mathlib),
-           __strprint(system->mpi));
+    printf("\n## system: %s (id=%llu)\n",
+           __strprint(system->name), _llu(system->id));
+
+    for (i = 0; i < N_SCRAP500_SYSATTRS; i++) {
+        attr = &scrap500_sysattrs[i];
+        val = scrap500_sysattr_field(system, attr);
+
+        switch (attr->type) {
+        case SCRAP500_ATTR_ID:
+            printf("## %s: %llu\n", attr->field, _llu(*(uint64_t *) val));
+            break;
+        case SCRAP500_ATTR_NUM:
+            printf("## %s: %.2lf%s%s\n", attr->field, *(double *) val,
+                   attr->unit[0] ? " " : "", attr->unit);
+            break;
+        default:
+            printf("## %s: %s\n", attr->field, __strprint(*(char **) val));
+            break;
+        }
+    }
 
+    printf("\n");
 }
 
 struct _scrap500_rank {
@@ -183,12 +220,24 @@ typedef struct _scrap500_rank scrap500_rank_t;
 struct _scrap500_list {
     uint32_t id;                /* YYYYMM */
     char url[5][PATH_MAX];      /* five webpages ..?page=[1-5] */
-    FILE *tmpfp[5];
+    int streamed;               /* pages parsed as they arrived, bit per page */
     scrap500_rank_t rank[500];
 };
 
 typedef struct _scrap500_list scrap500_list_t;
 
+/* returns 1 if all five pages of the list were parsed as they arrived */
+static inline int scrap500_list_streamed(scrap500_list_t *list)
+{
+    return list->streamed == (1 << 5) - 1;
+}
+
+enum {
+    SCRAP500_PAGE_LIST = 0,
+    SCRAP500_PAGE_SITE,
+    SCRAP500_PAGE_SYSTEM,
+};
+
 extern char *scrap500_datadir;
 
 static inline void read_program_name(const char *path, char *program)
@@ -201,11 +250,23 @@ static inline void read_program_name(const char *path, char *program)
 }
 
 static inline
-void scrap500_list_html_filename(scrap500_list_t *list, int page, char *buf)
+void scrap500_list_page_html_filename(uint32_t list_id, int page, char *buf)
 {
     if (buf)
         sprintf(buf, "%s/list/%d%02d.%d.html",
-                     scrap500_datadir, list->id/100, list->id%100, page);
+                     scrap500_datadir, list_id/100, list_id%100, page);
+}
+
+/* the page id of a list page, as in the index, the journal and the pack */
+static inline uint64_t scrap500_list_page_id(uint32_t list_id, int page)
+{
+    return (uint64_t) list_id*10 + page;
+}
+
+static inline
+void scrap500_list_html_filename(scrap500_list_t *list, int page, char *buf)
+{
+    scrap500_list_page_html_filename(list->id, page, buf);
 }
 
 static inline void scrap500_site_html_filename(uint64_t site_id, char *buf)
@@ -220,18 +281,411 @@ static inline void scrap500_system_html_filename(uint64_t site_id, char *buf)
         sprintf(buf, "%s/system/%llu.html", scrap500_datadir, _llu(site_id));
 }
 
-int scrap500_http_fetch_list(scrap500_list_t *list);
+enum {
+    SCRAP500_HTTP_LOOP_EPOLL = 0,   /* epoll + curl_multi_socket_action */
+    SCRAP500_HTTP_LOOP_WAIT,        /* legacy curl_multi_wait polling */
+};
+
+struct _scrap500_http_config {
+    int nthreads;               /* number of spec fetcher threads */
+    int max_inflight;           /* max. list page requests in flight */
+    int http2;                  /* multiplex over HTTP/2 if available */
+    int loop;                   /* SCRAP500_HTTP_LOOP_* */
+    const char *baseurl;        /* e.g., https://www.top500.org */
+    int refresh;                /* revalidate cached site/system pages */
+    double rate;                /* initial requests/sec, 0 for no limit */
+    double max_rate;            /* upper bound of the rate, 0 for none */
+    int max_retries;            /* per page, before giving up on it */
+    int stream;                 /* parse list pages as they arrive */
+    int nosave;                 /* do not keep the raw list pages */
+    int quiet;                  /* no progress output */
+    long timeout;               /* sec, per request, 0 for no limit */
+    long connect_timeout;       /* sec, to establish a connection */
+    long low_speed_limit;       /* bytes/sec, abort a slower transfer.. */
+    long low_speed_time;        /* ..after this many seconds */
+    int hedge;                  /* duplicate slow site/system requests */
+    int compress;               /* SCRAP500_CACHE_* of the cached pages */
+    int pack;                   /* keep the pages in <datadir>/pages.pack */
+    int trim;                   /* keep only the content of the pages */
+};
+
+typedef struct _scrap500_http_config scrap500_http_config_t;
+
+extern scrap500_http_config_t scrap500_http_config;
+
+int scrap500_http_init(void);
+
+void scrap500_http_exit(void);
+
+struct _scrap500_http_stats {
+    uint64_t pages;             /* responses received */
+    double p50;                 /* response time, in seconds */
+    double p99;
+    double max;
+};
+
+typedef struct _scrap500_http_stats scrap500_http_stats_t;
+
+/* response times since the last reset */
+void scrap500_http_get_stats(scrap500_http_stats_t *stats, int reset);
+
+/* called once all pages of a list have been fetched. non-zero return value
+ * stops fetching further lists. */
+typedef int (*scrap500_list_cb_t)(scrap500_list_t *list, void *data);
+
+int scrap500_http_fetch_lists(scrap500_list_t *lists, uint32_t n_lists,
+                              scrap500_list_cb_t cb, void *data);
+
+int scrap500_http_fetch_specs(scrap500_list_t *lists, uint32_t n_lists);
+
+struct _scrap500_page_meta {
+    int type;                   /* SCRAP500_PAGE_* */
+    uint64_t id;                /* for list pages, YYYYMM*10 + page */
+    char etag[128];
+    char last_modified[64];
+    uint64_t size;
+    uint64_t fetched;           /* unix time */
+    uint64_t stored;            /* bytes in the cache, as compressed */
+    uint32_t crc;               /* crc32 of the stored bytes */
+    int status;                 /* SCRAP500_MANIFEST_* */
+};
+
+typedef struct _scrap500_page_meta scrap500_page_meta_t;
+
+enum {
+    SCRAP500_MANIFEST_NEW = 0,      /* not yet ingested by scrap500-build */
+    SCRAP500_MANIFEST_INGESTED,
+    SCRAP500_MANIFEST_FAILED,       /* could not be parsed */
+};
+
+int scrap500_index_open(void);
+
+void scrap500_index_close(void);
+
+/* returns ENOENT if the page is not in the index */
+int scrap500_index_lookup(int type, uint64_t id, scrap500_page_meta_t *meta);
+
+int scrap500_index_update(scrap500_page_meta_t *meta);
+
+int scrap500_index_set_status(int type, uint64_t id, int status);
+
+/*
+ * the ids of the pages of the type in the index, in ascending order, only
+ * those not ingested yet if pending is set. *ids should be freed by caller.
+ */
+int scrap500_index_list(int type, int pending, uint64_t **ids,
+                        uint64_t *count);
+
+enum {
+    SCRAP500_JOURNAL_PENDING = 'P',
+    SCRAP500_JOURNAL_COMPLETED = 'C',
+    SCRAP500_JOURNAL_FAILED = 'F',
+};
+
+int scrap500_journal_open(void);
+
+void scrap500_journal_close(void);
+
+void scrap500_journal_record(int state, int type, uint64_t id);
+
+/* marks the crawl as finished, so that the next run starts a new one */
+void scrap500_journal_finish(void);
+
+/* returns 1 if the page has been completed by the interrupted crawl */
+int scrap500_journal_done(int type, uint64_t id);
+
+struct _scrap500_idset {
+    uint64_t *slots;
+    uint64_t size;
+    uint64_t count;
+};
+
+typedef struct _scrap500_idset scrap500_idset_t;
+
+/* returns 0 if added, EEXIST if the id is already in the set */
+int scrap500_idset_add(scrap500_idset_t *set, uint64_t id);
+
+int scrap500_idset_has(scrap500_idset_t *set, uint64_t id);
+
+void scrap500_idset_free(scrap500_idset_t *set);
 
-int scrap500_http_fetch_specs(scrap500_list_t *list);
+#define SCRAP500_PARSER_OPTS                                \
+        (HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR           \
+         | HTML_PARSE_NOWARNING | HTML_PARSE_NONET)
+
+enum {
+    SCRAP500_PARSER_DOM = 0,        /* libxml2, into a document tree */
+    SCRAP500_PARSER_SAX,            /* libxml2 sax callbacks, without a tree */
+    SCRAP500_PARSER_SCAN,           /* scrap500-scan.c, without libxml2 */
+    N_SCRAP500_PARSERS,
+};
+
+/* the backend of scrap500_parser_parse_{list,site,system}() */
+extern int scrap500_parser_backend;
+
+extern const char *scrap500_parser_backend_names[];
+
+/* selects the backend by its name, EINVAL if unknown */
+int scrap500_parser_set_backend(const char *name);
 
 int scrap500_parser_parse_list(scrap500_list_t *list);
 
+/* parses a single list page, already parsed into doc */
+int scrap500_parser_parse_list_doc(scrap500_list_t *list, htmlDocPtr doc);
+
 int scrap500_parser_parse_specs(scrap500_list_t *list);
 
 int scrap500_parser_parse_site(uint64_t site_id, scrap500_site_t *site);
 
+int scrap500_parser_parse_site_doc(uint64_t site_id, htmlDocPtr doc,
+                                   scrap500_site_t *site);
+
 int scrap500_parser_parse_system(uint64_t system_id, scrap500_system_t *system);
 
+int scrap500_parser_parse_system_doc(uint64_t system_id, htmlDocPtr doc,
+                                     scrap500_system_t *system);
+
+/* returns 1 if blanks after a child element of the element are kept in the
+ * tree, as libxml2 decides (see scrap500-sax.c) */
+int scrap500_parser_text_element(const char *name);
+
+/* sets the name of the system from the heading of the page */
+int scrap500_parser_system_name(scrap500_system_t *system, const char *str);
+
+/*
+ * sets an attribute of the system from a row of the table on the page:
+ * attr_str is the text of the th, content is the content of the first node in
+ * the td, and href is the first attribute of that node, i.e., of an anchor.
+ */
+int scrap500_parser_system_attr(scrap500_system_t *system, const char *attr_str,
+                                const char *content, const char *href);
+
+enum {
+    SCRAP500_UNIT_NONE = 0,
+    SCRAP500_UNIT_FLOPS,            /* Flop/s */
+    SCRAP500_UNIT_BYTE,
+    SCRAP500_UNIT_WATT,
+    SCRAP500_UNIT_UNKNOWN,
+};
+
+struct _scrap500_unit {
+    int base;                       /* SCRAP500_UNIT_* */
+    int exp;                        /* power of ten of the prefix, e.g., 12 */
+};
+
+typedef struct _scrap500_unit scrap500_unit_t;
+
+/* parses the unit at the start of str, e.g., "TFlop/s" or "kW", after blanks,
+ * ENOENT if there is none */
+int scrap500_parser_unit(const char *str, scrap500_unit_t *unit);
+
+/*
+ * parses the number at the start of str as sscanf("%lf") would, after blanks,
+ * skipping the thousands separators (,), and the unit after it if any. it does
+ * not depend on the locale, and returns ENOENT if there is no number. unlike
+ * sscanf(), it takes the longest number, e.g., inf of "infi".
+ */
+int scrap500_parser_number(const char *str, double *val,
+                           scrap500_unit_t *unit);
+
+/*
+ * the id at the end of a link, e.g., https://www.top500.org/system/177931, or
+ * 0 if the link has no path. ids start from 1.
+ */
+static inline uint64_t scrap500_parser_link_id(const char *href)
+{
+    const char *pos = href ? strrchr(href, '/') : NULL;
+
+    return pos ? strtoull(&pos[1], NULL, 10) : 0;
+}
+
+/* the same parsers with the sax backend, see scrap500-sax.c */
+int scrap500_sax_parse_list(scrap500_list_t *list);
+
+int scrap500_sax_parse_site(uint64_t site_id, scrap500_site_t *site);
+
+int scrap500_sax_parse_system(uint64_t system_id, scrap500_system_t *system);
+
+/* the same parsers with the scan backend, see scrap500-scan.c */
+int scrap500_scan_parse_list(scrap500_list_t *list);
+
+int scrap500_scan_parse_site(uint64_t site_id, scrap500_site_t *site);
+
+int scrap500_scan_parse_system(uint64_t system_id, scrap500_system_t *system);
+
+/* the first line of a trimmed page, followed by the length and the crc32 of
+ * the page as it was received */
+#define SCRAP500_TRIM_MARKER        "<!-- scrap500-trim"
+
+/*
+ * serializes only the content of the page, which is all the parsers read,
+ * into *buf that the caller should free. doc may be NULL for an empty page.
+ */
+int scrap500_parser_trim_doc(htmlDocPtr doc, uint64_t length, uint32_t crc,
+                             char **buf, size_t *len);
+
+enum {
+    SCRAP500_CACHE_RAW = 0,
+    SCRAP500_CACHE_GZIP,
+    SCRAP500_CACHE_ZSTD,            /* gzip when built without libzstd */
+};
+
+#ifdef HAVE_ZSTD
+#define SCRAP500_CACHE_DEFAULT      SCRAP500_CACHE_ZSTD
+#else
+#define SCRAP500_CACHE_DEFAULT      SCRAP500_CACHE_GZIP
+#endif
+
+/* returns SCRAP500_CACHE_* by its name, or -1 if unknown */
+static inline int scrap500_cache_format_by_name(const char *name)
+{
+    if (!strcmp(name, "none"))
+        return SCRAP500_CACHE_RAW;
+    if (!strcmp(name, "gzip"))
+        return SCRAP500_CACHE_GZIP;
+    if (!strcmp(name, "zstd"))
+        return SCRAP500_CACHE_ZSTD;
+
+    return -1;
+}
+
+/* returns SCRAP500_CACHE_* of the data, told by its magic bytes */
+int scrap500_cache_format(const void *buf, size_t len);
+
+struct _scrap500_cache_writer;
+
+typedef struct _scrap500_cache_writer scrap500_cache_writer_t;
+
+/* creates filename to write a page in the format, NULL with errno set */
+scrap500_cache_writer_t *scrap500_cache_create(const char *filename,
+                                               int format);
+
+/* same, but the page is written to memory, see scrap500_cache_take */
+scrap500_cache_writer_t *scrap500_cache_create_buffer(int format);
+
+int scrap500_cache_write(scrap500_cache_writer_t *w, const void *buf,
+                         size_t len);
+
+/* finishes the file (and fsyncs it if sync is set), and frees w. the size
+ * and crc32 of the stored page are set in meta, if given. */
+int scrap500_cache_close(scrap500_cache_writer_t *w, int sync,
+                         scrap500_page_meta_t *meta);
+
+/* finishes the page of a memory writer into *buf that the caller should
+ * free, and frees w */
+int scrap500_cache_take(scrap500_cache_writer_t *w, char **buf, size_t *len,
+                        scrap500_page_meta_t *meta);
+
+/* closes the unfinished file, and frees w */
+void scrap500_cache_abort(scrap500_cache_writer_t *w);
+
+/* reads the page, decompressed, into *buf that the caller should free */
+int scrap500_cache_read(const char *filename, char **buf, size_t *len);
+
+/* reads and parses the page, NULL on errors */
+htmlDocPtr scrap500_cache_read_html(const char *filename);
+
+/* returns 1 if the page is cached, in the pack or in its own file */
+int scrap500_cache_has_page(int type, uint64_t id);
+
+/*
+ * the ids of all cached pages of the type, in the pack or in their own files,
+ * in ascending order. a list is taken by its first page, and by the id of the
+ * list. *ids should be freed by caller.
+ */
+int scrap500_cache_page_ids(int type, uint64_t **ids, uint64_t *count);
+
+/* sets the size and crc32 of the page as stored in meta, for verification */
+int scrap500_cache_checksum(int type, uint64_t id, scrap500_page_meta_t *meta);
+
+/* reads and parses the page from the pack or its own file, NULL on errors */
+htmlDocPtr scrap500_cache_read_page(int type, uint64_t id);
+
+/* same, but reads the page, decompressed, into *buf to be freed by caller */
+int scrap500_cache_read_page_data(int type, uint64_t id,
+                                  char **buf, size_t *len);
+
+/* a cached page, decompressed. a page stored raw is not copied, but read
+ * from the pack or from its own file mapped in memory. */
+struct _scrap500_page {
+    const char *data;
+    size_t len;
+    const char *map;            /* of its own file */
+    size_t maplen;
+    char *buf;                  /* decompressed */
+};
+
+typedef struct _scrap500_page scrap500_page_t;
+
+int scrap500_cache_map_page(int type, uint64_t id, scrap500_page_t *page);
+
+void scrap500_cache_unmap_page(scrap500_page_t *page);
+
+/* makes this thread parse the pages it reads with one parser context and
+ * dictionary until scrap500_cache_batch_end(), instead of new ones for each */
+int scrap500_cache_batch_begin(void);
+
+void scrap500_cache_batch_end(void);
+
+/* forgets the zstd dictionary of the data directory, e.g., replaced by
+ * scrap500-repack, to be loaded again for the next page that needs it */
+void scrap500_cache_drop_dict(void);
+
+/* starts reading the page into the page cache in the background, to be read
+ * shortly */
+void scrap500_cache_prefetch(int type, uint64_t id);
+
+enum {
+    SCRAP500_PACK_READ = 0,         /* read-only */
+    SCRAP500_PACK_APPEND,           /* read-write, if the pack exists */
+    SCRAP500_PACK_CREATE,           /* read-write, created if missing */
+};
+
+/*
+ * the pack of the data directory (<datadir>/pages.pack). readers open it on
+ * their first access, the fetcher opens it to append pages. returns ENOENT if
+ * there is no pack to open.
+ */
+int scrap500_pack_open(int mode);
+
+/* writes the offset index if the pack has been appended to */
+void scrap500_pack_close(void);
+
+/* returns 1 if the pack is open for appending */
+int scrap500_pack_active(void);
+
+/* appends the page, as stored by the cache writer */
+int scrap500_pack_append(int type, uint64_t id, const void *buf, size_t len);
+
+/* points *buf to the page in the mapped pack, valid until the pack closes */
+int scrap500_pack_get(int type, uint64_t id, const char **buf, size_t *len);
+
+int scrap500_pack_has(int type, uint64_t id);
+
+/* adds the ids of all pages of the type in the pack to set */
+int scrap500_pack_ids(int type, scrap500_idset_t *set);
+
+struct _scrap500_pack_writer;
+
+typedef struct _scrap500_pack_writer scrap500_pack_writer_t;
+
+/*
+ * starts a new pack in filename, truncated if it exists, of pages compressed
+ * against the zstd dictionary dict_id (0 if none). NULL on errors.
+ */
+scrap500_pack_writer_t *scrap500_pack_create(const char *filename,
+                                             uint32_t dict_id);
+
+/* appends the page, as stored by the cache writer, to the new pack */
+int scrap500_pack_write(scrap500_pack_writer_t *w, int type, uint64_t id,
+                        const void *buf, size_t len);
+
+/* writes the index of the new pack to <filename>.idx, and frees w */
+int scrap500_pack_finish(scrap500_pack_writer_t *w);
+
+/* removes the new pack, and frees w */
+void scrap500_pack_abort(scrap500_pack_writer_t *w);
+
 typedef void * scrap500_db_t;
 
 scrap500_db_t scrap500_db_open(const char *dbname, int initdb);
@@ -240,5 +694,8 @@ void scrap500_db_close(scrap500_db_t db);
 
 int scrap500_db_write_list(scrap500_db_t db, scrap500_list_t *list);
 
+/* for an incremental crawl: reads the latest list (YYYYMM, 0 if none) */
+int scrap500_db_read_latest(scrap500_db_t db, uint32_t *latest);
+
 #endif /* __SCRAP500_H__ */
 